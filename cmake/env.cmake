@@ -7,10 +7,19 @@ set(EXECUTABLE_OUTPUT_PATH ${PROJECT_BINARY_DIR}/bin)
 # Flags
 #set(CMAKE_CXX_FLAGS "--std=c++14 -g -fmax-errors=1")
 IF (NOT WIN32)
-set(CMAKE_CXX_FLAGS "--std=c++14 -g")
+set(CMAKE_CXX_FLAGS "--std=c++20 -g")
+ENDIF ()
+
+# Trace zones (src/trace.h) are compiled out unless this is on.
+OPTION(CRAFT_TRACE "Record Chrome trace events" OFF)
+IF (CRAFT_TRACE)
+ADD_DEFINITIONS(-DCRAFT_TRACE)
 ENDIF ()
 
 # Packages
+FIND_PACKAGE(Threads REQUIRED)
+LIST(APPEND stdgl_libraries ${CMAKE_THREAD_LIBS_INIT})
+
 FIND_PACKAGE(OpenGL REQUIRED)
 INCLUDE_DIRECTORIES(${OPENGL_INCLUDE_DIRS})
 LINK_DIRECTORIES(${OPENGL_LIBRARY_DIRS})
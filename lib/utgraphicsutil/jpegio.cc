@@ -1,92 +1,376 @@
 #include "jpegio.h"
+#include <algorithm>
+#include <thread>
 #include <vector>
-#include <jpeglib.h>
+#include <setjmp.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <jpeglib.h>
 
-bool SaveJPEG(const std::string& filename,
-              int image_width,
-              int image_height,
-              const unsigned char* pixels)
+namespace {
+
+/*
+ * libjpeg's default error handler calls exit(); route fatal errors back to
+ * the caller instead so a corrupt file or buffer just fails the call.
+ */
+struct ErrorManager {
+	struct jpeg_error_mgr pub;
+	jmp_buf jump;
+};
+
+void ErrorExit(j_common_ptr cinfo)
 {
-	struct jpeg_compress_struct cinfo;
-	struct jpeg_error_mgr jerr;
-	FILE* outfile;
-	JSAMPROW row_pointer[1];
-	int row_stride;
+	ErrorManager* err = reinterpret_cast<ErrorManager*>(cinfo->err);
+	(*cinfo->err->output_message)(cinfo);
+	longjmp(err->jump, 1);
+}
 
-	cinfo.err = jpeg_std_error(&jerr);
-	jpeg_create_compress(&cinfo);
+int McuHeight(const JPEGOptions& options)
+{
+	return options.subsampling == JPEGOptions::kSubsample420 ? 16 : 8;
+}
 
-	outfile = fopen(filename.c_str(), "wb");
-	if (outfile == NULL)
-		return false;
+/*
+ * Compresses image rows [first_row, first_row + rows) as a standalone JPEG.
+ * With restart_rows set a restart marker follows every MCU row, which is
+ * what lets independently compressed strips be concatenated.
+ */
+bool EncodeRows(int image_width,
+                int image_height,
+                int first_row,
+                int rows,
+                const unsigned char* pixels,
+                const JPEGOptions& options,
+                bool restart_rows,
+                std::vector<unsigned char>* jpeg)
+{
+	struct jpeg_compress_struct cinfo;
+	ErrorManager jerr;
+	unsigned char* buffer = NULL;
+	unsigned long size = 0;
 
-	jpeg_stdio_dest(&cinfo, outfile);
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = ErrorExit;
+	if (setjmp(jerr.jump)) {
+		jpeg_destroy_compress(&cinfo);
+		free(buffer);
+		return false;
+	}
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, &buffer, &size);
 
 	cinfo.image_width = image_width;
-	cinfo.image_height = image_height;
+	cinfo.image_height = rows;
 	cinfo.input_components = 3;
 	cinfo.in_color_space = JCS_RGB;
 	jpeg_set_defaults(&cinfo);
-	jpeg_set_quality(&cinfo, 100, (boolean)true);
+	jpeg_set_quality(&cinfo, options.quality, (boolean)true);
+	switch (options.subsampling) {
+		case JPEGOptions::kSubsample444:
+			cinfo.comp_info[0].h_samp_factor = 1;
+			cinfo.comp_info[0].v_samp_factor = 1;
+			break;
+		case JPEGOptions::kSubsample422:
+			cinfo.comp_info[0].h_samp_factor = 2;
+			cinfo.comp_info[0].v_samp_factor = 1;
+			break;
+		case JPEGOptions::kSubsample420:
+			cinfo.comp_info[0].h_samp_factor = 2;
+			cinfo.comp_info[0].v_samp_factor = 2;
+			break;
+	}
+	// Strips must share the standard Huffman tables to be stitchable.
+	cinfo.optimize_coding = (boolean)false;
+	if (restart_rows)
+		cinfo.restart_in_rows = 1;
 	jpeg_start_compress(&cinfo, (boolean)true);
 
-	row_stride = image_width * 3;
-
+	const int kBatch = 16;
+	JSAMPROW row_pointers[kBatch];
+	size_t row_stride = size_t(image_width) * 3;
 	while (cinfo.next_scanline < cinfo.image_height) {
-		row_pointer[0] = const_cast<unsigned char*>(
-				&pixels[(cinfo.image_height - 1 - cinfo.next_scanline) * row_stride]);
-		jpeg_write_scanlines(&cinfo, row_pointer, 1);
+		int count = std::min<int>(kBatch, cinfo.image_height - cinfo.next_scanline);
+		for (int i = 0; i < count; ++i) {
+			size_t y = first_row + cinfo.next_scanline + i;
+			if (options.bottom_up)
+				y = image_height - 1 - y;
+			row_pointers[i] = const_cast<unsigned char*>(&pixels[y * row_stride]);
+		}
+		jpeg_write_scanlines(&cinfo, row_pointers, count);
 	}
 
 	jpeg_finish_compress(&cinfo);
-	fclose(outfile);
-
+	jpeg->assign(buffer, buffer + size);
 	jpeg_destroy_compress(&cinfo);
+	free(buffer);
 	return true;
 }
 
-bool LoadJPEG(const std::string& file_name, Image* image)
+/*
+ * Returns the offset of the first entropy-coded byte (just past the SOS
+ * segment), or 0 if the stream is malformed. *sof_height receives the offset
+ * of the frame height field.
+ */
+size_t FindScanData(const std::vector<unsigned char>& jpeg, size_t* sof_height)
+{
+	size_t pos = 2;
+	while (pos + 4 <= jpeg.size()) {
+		if (jpeg[pos] != 0xFF)
+			return 0;
+		unsigned char marker = jpeg[pos + 1];
+		size_t length = (size_t(jpeg[pos + 2]) << 8) | jpeg[pos + 3];
+		if (marker == 0xC0 || marker == 0xC1)
+			*sof_height = pos + 5;
+		pos += 2 + length;
+		if (marker == 0xDA)
+			return pos < jpeg.size() ? pos : 0;
+	}
+	return 0;
+}
+
+/*
+ * Joins strips compressed with a restart marker after every MCU row into a
+ * single image: the headers of the first strip are kept (with the frame
+ * height patched), the scan data of the others is appended and their
+ * restart markers are renumbered to continue the global RST0..RST7 cycle.
+ */
+bool StitchStrips(const std::vector<std::vector<unsigned char> >& strips,
+                  int strip_mcu_rows,
+                  int image_height,
+                  std::vector<unsigned char>* jpeg)
+{
+	size_t sof_height = 0;
+	size_t header = FindScanData(strips[0], &sof_height);
+	if (header == 0 || sof_height == 0)
+		return false;
+
+	size_t total = 0;
+	for (const auto& strip : strips)
+		total += strip.size();
+	jpeg->clear();
+	jpeg->reserve(total);
+	jpeg->insert(jpeg->end(), strips[0].begin(), strips[0].begin() + header);
+	(*jpeg)[sof_height] = (image_height >> 8) & 0xFF;
+	(*jpeg)[sof_height + 1] = image_height & 0xFF;
+
+	for (size_t s = 0; s < strips.size(); ++s) {
+		const std::vector<unsigned char>& strip = strips[s];
+		size_t unused = 0;
+		size_t begin = s == 0 ? header : FindScanData(strip, &unused);
+		if (begin == 0 || strip.size() < begin + 2)
+			return false;
+		size_t end = strip.size() - 2; // Drop EOI.
+		int first_mcu_row = int(s) * strip_mcu_rows;
+		if (s > 0) {
+			jpeg->push_back(0xFF);
+			jpeg->push_back(0xD0 + (first_mcu_row - 1) % 8);
+		}
+		for (size_t i = begin; i < end; ++i) {
+			unsigned char byte = strip[i];
+			jpeg->push_back(byte);
+			if (byte == 0xFF && i + 1 < end &&
+			    strip[i + 1] >= 0xD0 && strip[i + 1] <= 0xD7) {
+				int local = strip[i + 1] - 0xD0;
+				jpeg->push_back(0xD0 + (local + first_mcu_row) % 8);
+				++i;
+			}
+		}
+	}
+	jpeg->push_back(0xFF);
+	jpeg->push_back(0xD9);
+	return true;
+}
+
+}
+
+bool EncodeJPEG(int image_width,
+                int image_height,
+                const unsigned char* pixels,
+                const JPEGOptions& options,
+                std::vector<unsigned char>* jpeg)
+{
+	if (image_width <= 0 || image_height <= 0)
+		return false;
+
+	int mcu_height = McuHeight(options);
+	int mcu_rows = (image_height + mcu_height - 1) / mcu_height;
+	int strips = std::max(1, std::min(options.threads, mcu_rows));
+	if (strips == 1)
+		return EncodeRows(image_width, image_height, 0, image_height,
+		                  pixels, options, false, jpeg);
+
+	int strip_mcu_rows = (mcu_rows + strips - 1) / strips;
+	strips = (mcu_rows + strip_mcu_rows - 1) / strip_mcu_rows;
+
+	std::vector<std::vector<unsigned char> > parts(strips);
+	std::vector<char> ok(strips, 0);
+	auto encode = [&](int s) {
+		int first_row = s * strip_mcu_rows * mcu_height;
+		int rows = std::min(strip_mcu_rows * mcu_height,
+		                    image_height - first_row);
+		ok[s] = EncodeRows(image_width, image_height, first_row, rows,
+		                   pixels, options, true, &parts[s]);
+	};
+	std::vector<std::thread> workers;
+	for (int s = 1; s < strips; ++s)
+		workers.emplace_back(encode, s);
+	encode(0);
+	for (auto& worker : workers)
+		worker.join();
+
+	for (char strip_ok : ok)
+		if (!strip_ok)
+			return false;
+	return StitchStrips(parts, strip_mcu_rows, image_height, jpeg);
+}
+
+bool SaveJPEG(const std::string& filename,
+              int image_width,
+              int image_height,
+              const unsigned char* pixels)
+{
+	return SaveJPEG(filename, image_width, image_height, pixels, JPEGOptions());
+}
+
+bool SaveJPEG(const std::string& filename,
+              int image_width,
+              int image_height,
+              const unsigned char* pixels,
+              const JPEGOptions& options)
+{
+	std::vector<unsigned char> jpeg;
+	if (!EncodeJPEG(image_width, image_height, pixels, options, &jpeg))
+		return false;
+
+	FILE* outfile = fopen(filename.c_str(), "wb");
+	if (outfile == NULL)
+		return false;
+	bool written = fwrite(jpeg.data(), 1, jpeg.size(), outfile) == jpeg.size();
+	return fclose(outfile) == 0 && written;
+}
+
+bool ReadFileBytes(const std::string& file_name,
+                   std::vector<unsigned char>* bytes)
 {
 	FILE* file = fopen(file_name.c_str(), "rb");
+	if (file == NULL)
+		return false;
+	bool ok = fseek(file, 0, SEEK_END) == 0;
+	long size = ok ? ftell(file) : -1;
+	ok = size >= 0 && fseek(file, 0, SEEK_SET) == 0;
+	if (ok) {
+		bytes->resize(size);
+		ok = fread(bytes->data(), 1, size, file) == size_t(size);
+	}
+	fclose(file);
+	return ok;
+}
+
+bool ReadJPEGSize(const unsigned char* jpeg, size_t size,
+                  int* width, int* height)
+{
 	struct jpeg_decompress_struct info;
-	struct jpeg_error_mgr err;
+	ErrorManager jerr;
 
-	info.err = jpeg_std_error(&err);
+	info.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = ErrorExit;
+	if (setjmp(jerr.jump)) {
+		jpeg_destroy_decompress(&info);
+		return false;
+	}
 	jpeg_create_decompress(&info);
+	jpeg_mem_src(&info, const_cast<unsigned char*>(jpeg), size);
+	bool ok = jpeg_read_header(&info, (boolean)true) == JPEG_HEADER_OK;
+	if (ok) {
+		*width = info.image_width;
+		*height = info.image_height;
+	}
+	jpeg_destroy_decompress(&info);
+	return ok;
+}
 
-	if (file == NULL)
+bool DecodeJPEGInto(const unsigned char* jpeg, size_t size,
+                    unsigned char* dst, size_t dst_stride, int channels,
+                    bool bottom_up)
+{
+	if (channels != 3 && channels != 4)
 		return false;
 
-	jpeg_stdio_src(&info, file);
-	jpeg_read_header(&info, (boolean)true);
-	jpeg_start_decompress(&info);
-
-	image->width = info.output_width;
-	image->height = info.output_height;
+	struct jpeg_decompress_struct info;
+	ErrorManager jerr;
+	std::vector<unsigned char> scan_line;
 
-	int channels = info.num_components;
-	long size = image->width * image->height * 3;
+	info.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = ErrorExit;
+	if (setjmp(jerr.jump)) {
+		jpeg_destroy_decompress(&info);
+		return false;
+	}
+	jpeg_create_decompress(&info);
+	jpeg_mem_src(&info, const_cast<unsigned char*>(jpeg), size);
+	if (jpeg_read_header(&info, (boolean)true) != JPEG_HEADER_OK) {
+		jpeg_destroy_decompress(&info);
+		return false;
+	}
+#ifdef JCS_EXTENSIONS
+	// libjpeg-turbo can emit RGBA (alpha = 0xFF) itself.
+	info.out_color_space = channels == 4 ? JCS_EXT_RGBA : JCS_RGB;
+#else
+	if (info.jpeg_color_space != JCS_GRAYSCALE)
+		info.out_color_space = JCS_RGB;
+#endif
+	jpeg_start_decompress(&info);
 
-	image->bytes.resize(size);
+	int components = info.output_components;
+	bool direct = components == channels;
+	if (!direct)
+		scan_line.resize(size_t(info.output_width) * components);
+	int a = (components > 2 ? 1 : 0);
+	int b = (components > 2 ? 2 : 0);
 
-	int a = (channels > 2 ? 1 : 0);
-	int b = (channels > 2 ? 2 : 0);
-	std::vector<unsigned char> scan_line(image->width * channels, 0);
-	unsigned char* p1 = &scan_line[0];
-	unsigned char** p2 = &p1;
-	unsigned char* out_scan_line = image->bytes.data();
 	while (info.output_scanline < info.output_height) {
-		jpeg_read_scanlines(&info, p2, 1);
-		for (int i = 0; i < image->width; ++i) {
-			out_scan_line[3 * i] = scan_line[channels * i];
-			out_scan_line[3 * i + 1] = scan_line[channels * i + a];
-			out_scan_line[3 * i + 2] = scan_line[channels * i + b];
+		size_t y = info.output_scanline;
+		if (bottom_up)
+			y = info.output_height - 1 - y;
+		unsigned char* out_scan_line = dst + y * dst_stride;
+		if (direct) {
+			JSAMPROW row = out_scan_line;
+			jpeg_read_scanlines(&info, &row, 1);
+			continue;
+		}
+		JSAMPROW row = scan_line.data();
+		jpeg_read_scanlines(&info, &row, 1);
+		for (size_t i = 0; i < info.output_width; ++i) {
+			unsigned char* pixel = out_scan_line + channels * i;
+			pixel[0] = scan_line[components * i];
+			pixel[1] = scan_line[components * i + a];
+			pixel[2] = scan_line[components * i + b];
+			if (channels == 4)
+				pixel[3] = 0xFF;
 		}
-		out_scan_line += image->width * 3;
 	}
 	jpeg_finish_decompress(&info);
-	fclose(file);
+	jpeg_destroy_decompress(&info);
 	return true;
 }
 
+bool DecodeJPEG(const unsigned char* jpeg, size_t size, Image* image)
+{
+	int width = 0, height = 0;
+	if (!ReadJPEGSize(jpeg, size, &width, &height))
+		return false;
+
+	image->width = width;
+	image->height = height;
+	image->stride = width * 3;
+	image->bytes.resize(size_t(image->stride) * height);
+	return DecodeJPEGInto(jpeg, size, image->bytes.data(), image->stride, 3);
+}
+
+bool LoadJPEG(const std::string& file_name, Image* image)
+{
+	std::vector<unsigned char> jpeg;
+	if (!ReadFileBytes(file_name, &jpeg))
+		return false;
+	return DecodeJPEG(jpeg.data(), jpeg.size(), image);
+}
@@ -1,13 +1,70 @@
 #ifndef JPEGIO_H
 #define JPEGIO_H
 
+#include <stddef.h>
 #include <string>
+#include <vector>
 #include "image.h"
 
+struct JPEGOptions {
+	enum Subsampling {
+		kSubsample444,
+		kSubsample422,
+		kSubsample420,
+	};
+
+	int quality = 100;
+	Subsampling subsampling = kSubsample420;
+	/*
+	 * Number of threads used for encoding. Images taller than a few MCU
+	 * rows are split into horizontal strips that are compressed
+	 * independently and stitched together at restart markers, so the
+	 * result is still a single baseline JPEG.
+	 */
+	int threads = 1;
+	/*
+	 * Pixel rows are stored bottom-up (the glReadPixels/glTexImage2D
+	 * convention) rather than top-down.
+	 */
+	bool bottom_up = true;
+};
+
 bool SaveJPEG(const std::string& filename,
               int image_width,
               int image_height,
               const unsigned char* pixels);
+bool SaveJPEG(const std::string& filename,
+              int image_width,
+              int image_height,
+              const unsigned char* pixels,
+              const JPEGOptions& options);
+/*
+ * Compresses tightly packed RGB pixels into an in-memory JPEG.
+ */
+bool EncodeJPEG(int image_width,
+                int image_height,
+                const unsigned char* pixels,
+                const JPEGOptions& options,
+                std::vector<unsigned char>* jpeg);
+
 bool LoadJPEG(const std::string& file_name, Image* image);
+bool DecodeJPEG(const unsigned char* jpeg, size_t size, Image* image);
+/*
+ * Reads only the dimensions, so the caller can size a destination buffer
+ * (e.g. a mapped pixel unpack buffer) before calling DecodeJPEGInto.
+ */
+bool ReadJPEGSize(const unsigned char* jpeg, size_t size,
+                  int* width, int* height);
+/*
+ * Decodes directly into caller-owned memory with 3 (RGB) or 4 (RGBA, alpha
+ * set to 255) channels per pixel. Rows are dst_stride bytes apart and are
+ * written top-down unless bottom_up is set.
+ */
+bool DecodeJPEGInto(const unsigned char* jpeg, size_t size,
+                    unsigned char* dst, size_t dst_stride, int channels,
+                    bool bottom_up = false);
+
+bool ReadFileBytes(const std::string& file_name,
+                   std::vector<unsigned char>* bytes);
 
 #endif
@@ -0,0 +1,183 @@
+#include "block_textures.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <debuggl.h>
+#include <jpegio.h>
+
+namespace {
+double millis(std::chrono::steady_clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+// Nearest-neighbour resample of an RGBA image into a square layer.
+void resample(const unsigned char* src, int width, int height,
+              unsigned char* dst, int size) {
+    for (int y = 0; y < size; y++) {
+        int sy = y * height / size;
+        for (int x = 0; x < size; x++) {
+            int sx = x * width / size;
+            std::memcpy(dst + (size_t(y) * size + x) * 4,
+                        &src[(size_t(sy) * width + sx) * 4], 4);
+        }
+    }
+}
+};  // namespace
+
+BlockTextures::BlockTextures(ThreadPool& pool, int layer_size)
+    : pool_(pool), layer_size_(layer_size) {}
+
+BlockTextures::~BlockTextures() {
+    // Workers write into our mapped buffers; let them finish first.
+    if (outstanding_ > 0) pool_.wait();
+}
+
+void BlockTextures::load(const std::string& directory,
+                         const std::vector<std::string>& files) {
+    started_ = Clock::now();
+    layers_.resize(files.size());
+    stats_.assign(files.size(), LayerStats());
+    ready_mask_ = 0;
+
+    size_t layer_bytes = size_t(layer_size_) * layer_size_ * 4;
+    CHECK_GL_ERROR(glGenTextures(1, &texture_));
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D_ARRAY, texture_));
+    CHECK_GL_ERROR(glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, layer_size_,
+                                layer_size_, files.size(), 0, GL_RGBA,
+                                GL_UNSIGNED_BYTE, nullptr));
+    // With its mipmaps, a third again.
+    texture_bytes_.set(layer_bytes * files.size() * 4 / 3);
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                                   GL_NEAREST_MIPMAP_LINEAR));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER,
+                                   GL_NEAREST));
+    CHECK_GL_ERROR(
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT));
+    CHECK_GL_ERROR(
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT));
+
+    for (size_t i = 0; i < files.size(); i++) {
+        Layer& layer = layers_[i];
+        layer.path = directory + "/" + files[i];
+        CHECK_GL_ERROR(glGenBuffers(1, &layer.pbo));
+        CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, layer.pbo));
+        CHECK_GL_ERROR(glBufferData(GL_PIXEL_UNPACK_BUFFER, layer_bytes,
+                                    nullptr, GL_STREAM_DRAW));
+        CHECK_GL_ERROR(layer.mapped = static_cast<unsigned char*>(
+                           glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0,
+                                            layer_bytes,
+                                            GL_MAP_WRITE_BIT |
+                                                GL_MAP_INVALIDATE_BUFFER_BIT)));
+        pbo_bytes_.set(pbo_bytes_.bytes() + layer_bytes);
+        outstanding_++;
+        Clock::time_point queued = Clock::now();
+        pool_.submit([this, i, queued]() { decode(i, queued); });
+    }
+    CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+}
+
+void BlockTextures::decode(size_t index, Clock::time_point queued) {
+    Clock::time_point start = Clock::now();
+    Layer& layer = layers_[index];
+    size_t stride = size_t(layer_size_) * 4;
+
+    std::vector<unsigned char> jpeg;
+    int width = 0, height = 0;
+    bool ok = layer.mapped != nullptr && ReadFileBytes(layer.path, &jpeg) &&
+              ReadJPEGSize(jpeg.data(), jpeg.size(), &width, &height);
+    if (ok && width == layer_size_ && height == layer_size_) {
+        // The common case: decode straight into the mapped unpack buffer.
+        ok = DecodeJPEGInto(jpeg.data(), jpeg.size(), layer.mapped, stride, 4,
+                            true);
+    } else if (ok) {
+        TrackedVector<unsigned char, MemoryTag::kImages> pixels(
+            size_t(width) * height * 4);
+        ok = DecodeJPEGInto(jpeg.data(), jpeg.size(), pixels.data(),
+                            size_t(width) * 4, 4, true);
+        if (ok)
+            resample(pixels.data(), width, height, layer.mapped, layer_size_);
+    }
+
+    Clock::time_point end = Clock::now();
+    std::lock_guard<std::mutex> lock(done_mutex_);
+    LayerStats& stats = stats_[index];
+    stats.loaded = ok;
+    stats.queue_ms = millis(start - queued);
+    stats.decode_ms = millis(end - start);
+    done_.push_back(index);
+}
+
+void BlockTextures::update() {
+    std::vector<size_t> done;
+    {
+        std::lock_guard<std::mutex> lock(done_mutex_);
+        if (done_.empty()) return;
+        done.swap(done_);
+    }
+
+    bool uploaded = false;
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D_ARRAY, texture_));
+    for (size_t index : done) {
+        Layer& layer = layers_[index];
+        CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, layer.pbo));
+        CHECK_GL_ERROR(glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER));
+        layer.mapped = nullptr;
+        if (stats_[index].loaded) {
+            // Sources from the bound PBO; the copy is queued, not waited on.
+            CHECK_GL_ERROR(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+            CHECK_GL_ERROR(glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0,
+                                           index, layer_size_, layer_size_,
+                                           1, GL_RGBA, GL_UNSIGNED_BYTE, 0));
+            ready_mask_ |= 1 << index;
+            uploaded = true;
+        } else {
+            std::cerr << "BlockTextures: could not load " << layer.path
+                      << ", using procedural colour" << std::endl;
+        }
+        // Deletion is deferred by the driver until the copy has completed.
+        CHECK_GL_ERROR(glDeleteBuffers(1, &layer.pbo));
+        layer.pbo = 0;
+        pbo_bytes_.set(pbo_bytes_.bytes() -
+                       size_t(layer_size_) * layer_size_ * 4);
+        stats_[index].total_ms = millis(Clock::now() - started_);
+        outstanding_--;
+    }
+    CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+    if (uploaded) CHECK_GL_ERROR(glGenerateMipmap(GL_TEXTURE_2D_ARRAY));
+
+    if (outstanding_ == 0) report();
+}
+
+void BlockTextures::report() const {
+    double decode_total = 0.0, decode_max = 0.0, resident = 0.0;
+    size_t loaded = 0;
+    for (const auto& stats : stats_) {
+        if (!stats.loaded) continue;
+        loaded++;
+        decode_total += stats.decode_ms;
+        decode_max = std::max(decode_max, stats.decode_ms);
+        resident = std::max(resident, stats.total_ms);
+    }
+    std::cout << "Block textures: " << loaded << "/" << stats_.size()
+              << " layers resident after " << resident << " ms (decode avg "
+              << (loaded ? decode_total / loaded : 0.0) << " ms, max "
+              << decode_max << " ms)" << std::endl;
+}
+
+void BlockTextures::bind(GLuint unit) const {
+    CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0 + unit));
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D_ARRAY, texture_));
+}
+
+void BlockTextures::release() {
+    if (outstanding_ > 0) {
+        pool_.wait();
+        update();
+    }
+    if (texture_ != 0) glDeleteTextures(1, &texture_);
+    texture_ = 0;
+    texture_bytes_.set(0);
+    ready_mask_ = 0;
+}
@@ -0,0 +1,78 @@
+#ifndef BLOCK_TEXTURES_H
+#define BLOCK_TEXTURES_H
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "memory_tracker.h"
+#include "thread_pool.h"
+
+// Block textures packed into a single GL_TEXTURE_2D_ARRAY, one layer per
+// block kind.
+//
+// Loading never blocks the render thread: each layer gets a pixel unpack
+// buffer that is mapped up front, a worker decodes the JPEG straight into
+// the mapped memory, and update() later unmaps it and issues an
+// asynchronous glTexSubImage3D from the PBO. Layers that are not resident
+// yet (or failed to load) are reported through readyMask() so the shader
+// can keep using its procedural colours for them.
+class BlockTextures {
+   public:
+    struct LayerStats {
+        bool loaded = false;
+        double queue_ms = 0.0;   // waiting for a worker
+        double decode_ms = 0.0;  // file read + JPEG decode
+        double total_ms = 0.0;   // load() to resident on the GPU
+    };
+
+    BlockTextures(ThreadPool& pool, int layer_size = 256);
+    ~BlockTextures();
+
+    // Starts loading one layer per file. Requires the GL context.
+    void load(const std::string& directory,
+              const std::vector<std::string>& files);
+    // Uploads any layers the workers have finished. Call once per frame.
+    void update();
+    // Binds the array to the given texture unit.
+    void bind(GLuint unit) const;
+    // Frees the GL objects; call while the context is current.
+    void release();
+
+    // Bit i is set once layer i is resident.
+    GLint readyMask() const { return ready_mask_; }
+    bool loading() const { return outstanding_ > 0; }
+    const std::vector<LayerStats>& stats() const { return stats_; }
+
+   private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Layer {
+        std::string path;
+        GLuint pbo = 0;
+        unsigned char* mapped = nullptr;
+    };
+
+    void decode(size_t layer, Clock::time_point queued);
+    void report() const;
+
+    ThreadPool& pool_;
+    int layer_size_;
+    GLuint texture_ = 0;
+    TrackedBytes texture_bytes_{MemoryTag::kGpuBuffers};
+    TrackedBytes pbo_bytes_{MemoryTag::kGpuBuffers};  // of unloaded layers
+    GLint ready_mask_ = 0;
+    size_t outstanding_ = 0;
+    Clock::time_point started_;
+
+    std::vector<Layer> layers_;
+    std::vector<LayerStats> stats_;
+
+    std::mutex done_mutex_;
+    std::vector<size_t> done_;  // layers decoded but not yet uploaded
+};
+
+#endif
@@ -0,0 +1,339 @@
+#include "block_world.h"
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <random>
+
+#include "chunk_store.h"
+#include "terrain.h"
+
+namespace {
+// Whether a section is one solid block type, so none of its blocks can be
+// exposed through it. Sections below the world count as solid, sections
+// above it and in unloaded columns do not and are treated separately.
+bool solidSection(const ChunkSection& section) {
+    return section.uniform() && section.uniformBlock() != kAir;
+}
+
+// Minimum corners of the blocks get() reports solid in the cube of the
+// given radius around pos.
+template <typename Get>
+std::vector<glm::vec3> solidNear(const glm::vec3& pos, int radius, Get get) {
+    std::vector<glm::vec3> blocks;
+    glm::ivec3 center = glm::ivec3(glm::floor(pos));
+    for (int y = -radius; y <= radius; y++)
+        for (int z = -radius; z <= radius; z++)
+            for (int x = -radius; x <= radius; x++) {
+                glm::ivec3 block = center + glm::ivec3(x, y, z);
+                if (get(block) != kAir) blocks.push_back(glm::vec3(block));
+            }
+    return blocks;
+}
+};  // namespace
+
+BlockId BlockWorld::Neighbourhood::get(const glm::ivec3& block) const {
+    glm::ivec2 d = glm::ivec2(floorDiv(block.x, kChunkSize),
+                              floorDiv(block.z, kChunkSize)) -
+                   center + glm::ivec2(1);
+    if (d.x < 0 || d.x > 2 || d.y < 0 || d.y > 2) return kAir;
+    const ColumnPtr& column = columns[d.x + 3 * d.y];
+    if (!column) return kAir;
+    return column->get(floorMod(block.x, kChunkSize), block.y,
+                       floorMod(block.z, kChunkSize));
+}
+
+std::vector<glm::vec3> BlockWorld::Neighbourhood::blocksNear(
+    const glm::vec3& pos, int radius) const {
+    return solidNear(pos, radius,
+                     [this](const glm::ivec3& block) { return get(block); });
+}
+
+BlockWorld::BlockWorld(int seed, int smoothing)
+    : seed_(seed), smoothing_(smoothing) {}
+
+void BlockWorld::load(glm::ivec2 lo, glm::ivec2 hi, ThreadPool& pool) {
+    std::vector<glm::ivec2> missing;
+    std::vector<std::future<ColumnPtr>> jobs;
+    for (int z = lo.y; z < hi.y; z++) {
+        for (int x = lo.x; x < hi.x; x++) {
+            glm::ivec2 coords(x, z);
+            if (columns_.count(coords)) continue;
+            missing.push_back(coords);
+            jobs.push_back(
+                pool.submit([this, coords]() { return generate(coords); }));
+        }
+    }
+    for (size_t i = 0; i < jobs.size(); i++) insert(missing[i], jobs[i].get());
+}
+
+BlockWorld::ColumnPtr BlockWorld::generate(glm::ivec2 coords) const {
+    auto column = std::make_shared<ChunkColumn>();
+    if (store_ && store_->read(coords, column.get())) return column;
+    // A private Chunk, as in ChunkMesher: its noise depends only on the
+    // seed.
+    std::mt19937 gen;
+    Chunk chunk(coords, kChunkSize, gen, nullptr, seed_);
+    column->generate(chunk, smoothing_);
+    return column;
+}
+
+void BlockWorld::insert(glm::ivec2 coords, ColumnPtr column) {
+    if (!columns_.emplace(coords, column).second) return;
+    top_ = std::max(top_, column->top());
+}
+
+BlockWorld::ColumnPtr BlockWorld::column(glm::ivec2 coords) const {
+    auto it = columns_.find(coords);
+    return it == columns_.end() ? nullptr : it->second;
+}
+
+BlockWorld::Snapshot BlockWorld::snapshot(glm::ivec2 coords) const {
+    Snapshot snapshot;
+    snapshot.coords = coords;
+    snapshot.center = column(coords);
+    snapshot.sides[0] = column(coords + glm::ivec2(-1, 0));
+    snapshot.sides[1] = column(coords + glm::ivec2(1, 0));
+    snapshot.sides[2] = column(coords + glm::ivec2(0, -1));
+    snapshot.sides[3] = column(coords + glm::ivec2(0, 1));
+    return snapshot;
+}
+
+BlockWorld::Neighbourhood BlockWorld::neighbourhood(
+    glm::ivec2 center) const {
+    Neighbourhood neighbourhood;
+    neighbourhood.center = center;
+    for (int z = -1; z <= 1; z++)
+        for (int x = -1; x <= 1; x++)
+            neighbourhood.columns[(x + 1) + 3 * (z + 1)] =
+                column(center + glm::ivec2(x, z));
+    return neighbourhood;
+}
+
+BlockId BlockWorld::get(const glm::ivec3& block) const {
+    auto it = columns_.find(glm::ivec2(floorDiv(block.x, kChunkSize),
+                                       floorDiv(block.z, kChunkSize)));
+    if (it == columns_.end()) return kAir;
+    return it->second->get(floorMod(block.x, kChunkSize), block.y,
+                           floorMod(block.z, kChunkSize));
+}
+
+bool BlockWorld::set(const glm::ivec3& block, BlockId id,
+                     std::vector<glm::ivec2>* dirty) {
+    if (block.y < ChunkColumn::kMinY ||
+        block.y >= ChunkColumn::kMinY + ChunkColumn::kHeight)
+        return false;
+    glm::ivec2 coords(floorDiv(block.x, kChunkSize),
+                      floorDiv(block.z, kChunkSize));
+    auto it = columns_.find(coords);
+    if (it == columns_.end()) return false;
+    glm::ivec2 local(floorMod(block.x, kChunkSize),
+                     floorMod(block.z, kChunkSize));
+
+    // Copy on write: meshers may still hold the old column.
+    auto column = std::make_shared<ChunkColumn>(*it->second);
+    column->set(local.x, block.y, local.y, id);
+    it->second = column;
+    // Breaking blocks leaves top_ as a loose but valid bound.
+    if (id != kAir) top_ = std::max(top_, block.y + 1);
+
+    if (dirty) {
+        dirty->push_back(coords);
+        if (local.x == 0) dirty->push_back(coords + glm::ivec2(-1, 0));
+        if (local.x == kChunkSize - 1)
+            dirty->push_back(coords + glm::ivec2(1, 0));
+        if (local.y == 0) dirty->push_back(coords + glm::ivec2(0, -1));
+        if (local.y == kChunkSize - 1)
+            dirty->push_back(coords + glm::ivec2(0, 1));
+    }
+    return true;
+}
+
+RayHit BlockWorld::raycast(const glm::vec3& origin,
+                           const glm::vec3& direction,
+                           float max_distance) const {
+    Ray ray = {origin, direction};
+    RayHit hit;
+    raycastRange(&ray, 1, max_distance, &hit);
+    return hit;
+}
+
+void BlockWorld::raycast(const std::vector<Ray>& rays, float max_distance,
+                         std::vector<RayHit>* hits, ThreadPool* pool) const {
+    hits->resize(rays.size());
+    if (!pool || pool->size() <= 1 || rays.size() < 256) {
+        raycastRange(rays.data(), rays.size(), max_distance, hits->data());
+        return;
+    }
+    // A few batches per thread even out rays of different lengths. The
+    // caller waits, so the columns cannot change underneath the workers.
+    size_t batches = pool->size() * 4;
+    size_t batch = (rays.size() + batches - 1) / batches;
+    std::vector<std::future<void>> jobs;
+    for (size_t begin = 0; begin < rays.size(); begin += batch) {
+        size_t count = std::min(batch, rays.size() - begin);
+        jobs.push_back(pool->submit([this, &rays, hits, begin, count,
+                                     max_distance]() {
+            raycastRange(&rays[begin], count, max_distance,
+                         &(*hits)[begin]);
+        }));
+    }
+    for (auto& job : jobs) job.get();
+}
+
+void BlockWorld::raycastRange(const Ray* rays, size_t count,
+                              float max_distance, RayHit* hits) const {
+    // Rays stay in one column for many cells, so the map is only searched
+    // when they cross into another chunk.
+    glm::ivec2 cached(0);
+    const ChunkColumn* column = nullptr;
+    bool looked_up = false;
+    static_assert(kChunkSize == 16, "the shifts below divide by 16");
+    auto solid = [&](const glm::ivec3& block) {
+        // Arithmetic shifts round towards negative infinity like floorDiv.
+        glm::ivec2 coords(block.x >> 4, block.z >> 4);
+        if (!looked_up || coords != cached) {
+            auto it = columns_.find(coords);
+            column = it == columns_.end() ? nullptr : it->second.get();
+            cached = coords;
+            looked_up = true;
+        }
+        return column &&
+               column->get(block.x & 15, block.y, block.z & 15) != kAir;
+    };
+    for (size_t i = 0; i < count; i++) {
+        const Ray& ray = rays[i];
+        // Rays climbing above the highest block cannot hit anything, which
+        // cuts most misses short.
+        float limit = max_distance;
+        float length = glm::length(ray.direction);
+        if (ray.direction.y > 0.0f && length > 0.0f)
+            limit = std::min(limit, (top_ - ray.origin.y) /
+                                        (ray.direction.y / length));
+        hits[i] = limit < 0.0f ? RayHit()
+                               : VoxelRaycast(ray.origin, ray.direction,
+                                              limit, solid);
+    }
+}
+
+std::vector<glm::vec3> BlockWorld::blocksNear(const glm::vec3& pos,
+                                              int radius) const {
+    return solidNear(pos, radius,
+                     [this](const glm::ivec3& block) { return get(block); });
+}
+
+std::vector<glm::vec3> BlockWorld::exposedBlocks(const Snapshot& snapshot) {
+    std::vector<glm::vec3> blocks;
+    if (!snapshot.center) return blocks;
+    const ChunkColumn& column = *snapshot.center;
+    const int n = kChunkSize;
+
+    // The block at chunk-local x, z, which may be one past either edge.
+    // Below the world and in unloaded neighbours everything is solid, so
+    // nothing is drawn against them.
+    auto at = [&](int x, int y, int z) -> BlockId {
+        if (y < ChunkColumn::kMinY) return kStone;
+        const ChunkColumn* source = &column;
+        if (x < 0) {
+            source = snapshot.sides[0].get();
+            x += n;
+        } else if (x >= n) {
+            source = snapshot.sides[1].get();
+            x -= n;
+        } else if (z < 0) {
+            source = snapshot.sides[2].get();
+            z += n;
+        } else if (z >= n) {
+            source = snapshot.sides[3].get();
+            z -= n;
+        }
+        return source ? source->get(x, y, z) : BlockId(kStone);
+    };
+    // Whether section i of a neighbouring column hides everything behind
+    // it.
+    auto hides = [&](const ChunkColumn* source, int i) {
+        if (i < 0 || !source) return true;
+        if (i >= ChunkColumn::kSections) return false;
+        return solidSection(source->section(i));
+    };
+
+    glm::ivec3 origin(snapshot.coords.x * n, 0, snapshot.coords.y * n);
+    for (int i = 0; i < ChunkColumn::kSections; i++) {
+        const ChunkSection& section = column.section(i);
+        if (section.uniform() && section.uniformBlock() == kAir) continue;
+        // Buried sections, which is most of the ground, are skipped whole.
+        if (solidSection(section) && hides(&column, i - 1) &&
+            hides(&column, i + 1) && hides(snapshot.sides[0].get(), i) &&
+            hides(snapshot.sides[1].get(), i) &&
+            hides(snapshot.sides[2].get(), i) &&
+            hides(snapshot.sides[3].get(), i))
+            continue;
+
+        int y0 = ChunkColumn::kMinY + i * ChunkSection::kSize;
+        for (int y = y0; y < y0 + ChunkSection::kSize; y++) {
+            for (int z = 0; z < n; z++) {
+                for (int x = 0; x < n; x++) {
+                    if (section.get(x, y - y0, z) == kAir) continue;
+                    if (at(x - 1, y, z) == kAir || at(x + 1, y, z) == kAir ||
+                        at(x, y - 1, z) == kAir || at(x, y + 1, z) == kAir ||
+                        at(x, y, z - 1) == kAir || at(x, y, z + 1) == kAir)
+                        blocks.push_back(
+                            glm::vec3(origin + glm::ivec3(x, y, z)));
+                }
+            }
+        }
+    }
+    return blocks;
+}
+
+std::vector<OcclusionCuller::Box> BlockWorld::occluders(
+    const Snapshot& snapshot) {
+    const int kGroup = 4;
+    // Occluders only need to be solid, not complete, so they stop this far
+    // below their top to keep their sides small on screen.
+    const int kDepth = 8;
+    std::vector<OcclusionCuller::Box> boxes;
+    if (!snapshot.center) return boxes;
+    const ChunkColumn& column = *snapshot.center;
+    const int n = kChunkSize;
+
+    // The height below which each column has no air.
+    std::vector<int> solid(n * n);
+    for (int z = 0; z < n; z++) {
+        for (int x = 0; x < n; x++) {
+            int y = ChunkColumn::kMinY;
+            for (int i = 0; i < ChunkColumn::kSections; i++) {
+                const ChunkSection& section = column.section(i);
+                if (solidSection(section)) {
+                    y += ChunkSection::kSize;
+                    continue;
+                }
+                int local = 0;
+                while (local < ChunkSection::kSize &&
+                       section.get(x, local, z) != kAir)
+                    local++;
+                y += local;
+                if (local < ChunkSection::kSize) break;
+            }
+            solid[x + z * n] = y;
+        }
+    }
+
+    glm::vec3 origin(snapshot.coords.x * n, 0.0f, snapshot.coords.y * n);
+    for (int gz = 0; gz < n; gz += kGroup) {
+        for (int gx = 0; gx < n; gx += kGroup) {
+            int top = ChunkColumn::kMinY + ChunkColumn::kHeight;
+            for (int z = gz; z < gz + kGroup; z++)
+                for (int x = gx; x < gx + kGroup; x++)
+                    top = std::min(top, solid[x + z * n]);
+            if (top <= ChunkColumn::kMinY) continue;
+            OcclusionCuller::Box box;
+            box.lo = origin + glm::vec3(gx, std::max(ChunkColumn::kMinY,
+                                                     top - kDepth),
+                                        gz);
+            box.hi = origin + glm::vec3(gx + kGroup, top, gz + kGroup);
+            boxes.push_back(box);
+        }
+    }
+    return boxes;
+}
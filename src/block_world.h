@@ -0,0 +1,120 @@
+#ifndef BLOCK_WORLD_H
+#define BLOCK_WORLD_H
+
+#include <glm/glm.hpp>
+#include <glm/gtx/hash.hpp>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk_section.h"
+#include "occlusion_culler.h"
+#include "thread_pool.h"
+#include "voxel_raycast.h"
+
+class ChunkStore;
+
+// The editable blocks of the world: one ChunkColumn per terrain chunk,
+// generated from the terrain's height field on first use.
+//
+// Columns are immutable once published. An edit copies the column it
+// touches and swaps the copy in, so a Snapshot taken for a background
+// mesher stays valid and unlocked however the world changes meanwhile.
+// All methods are for the main thread; only Snapshot and Neighbourhood
+// are shared.
+class BlockWorld {
+   public:
+    static const int kChunkSize = ChunkSection::kSize;
+
+    typedef std::shared_ptr<const ChunkColumn> ColumnPtr;
+
+    // A chunk's column and its four horizontal neighbours (-x, +x, -z,
+    // +z), which decide whether blocks on its border are exposed.
+    struct Snapshot {
+        glm::ivec2 coords;
+        ColumnPtr center;
+        ColumnPtr sides[4];
+    };
+
+    // The columns of the 3 x 3 chunks around a centre chunk, for reading
+    // the blocks near a point in it from another thread, as they were
+    // when it was taken.
+    struct Neighbourhood {
+        glm::ivec2 center = glm::ivec2(0);
+        ColumnPtr columns[9];  // row by row, from center - (1, 1)
+
+        // Air outside the nine chunks and in unloaded ones.
+        BlockId get(const glm::ivec3& block) const;
+        // As BlockWorld::blocksNear.
+        std::vector<glm::vec3> blocksNear(const glm::vec3& pos,
+                                          int radius) const;
+    };
+
+    explicit BlockWorld(int seed, int smoothing = 0);
+
+    // Generates the missing columns of chunks lo <= c < hi on the pool's
+    // threads and waits for them.
+    void load(glm::ivec2 lo, glm::ivec2 hi, ThreadPool& pool);
+    // A chunk's column as load() generates it, or as the store holds it.
+    // Runs on any thread.
+    ColumnPtr generate(glm::ivec2 coords) const;
+    // Adds a column from generate(), unless the chunk is loaded already.
+    void insert(glm::ivec2 coords, ColumnPtr column);
+    // Null if the chunk is not loaded.
+    ColumnPtr column(glm::ivec2 coords) const;
+    Snapshot snapshot(glm::ivec2 coords) const;
+    Neighbourhood neighbourhood(glm::ivec2 center) const;
+
+    // Air in chunks that are not loaded.
+    BlockId get(const glm::ivec3& block) const;
+    // Fails if the block's chunk is not loaded. Otherwise appends to dirty
+    // the chunks whose exposed blocks may have changed: the block's own,
+    // and the neighbour across any chunk border it touches.
+    bool set(const glm::ivec3& block, BlockId id,
+             std::vector<glm::ivec2>* dirty);
+
+    // The first non-air block along the ray within max_distance. Blocks
+    // in unloaded chunks count as air.
+    RayHit raycast(const glm::vec3& origin, const glm::vec3& direction,
+                   float max_distance) const;
+    // raycast() for many rays at once (line of sight, ambient occlusion
+    // samples), split across the pool's threads when one is given. hits
+    // is resized to match rays.
+    void raycast(const std::vector<Ray>& rays, float max_distance,
+                 std::vector<RayHit>* hits, ThreadPool* pool = nullptr) const;
+
+    // Minimum corners of the non-air blocks in the cube of the given
+    // radius around pos, for Camera::physics.
+    std::vector<glm::vec3> blocksNear(const glm::vec3& pos, int radius) const;
+
+    // Minimum corners of the chunk's blocks that touch air on at least one
+    // side; everything else is hidden. Runs on any thread.
+    static std::vector<glm::vec3> exposedBlocks(const Snapshot& snapshot);
+
+    // Solid boxes for OcclusionCuller: one per 4 x 4 columns of the
+    // chunk, reaching up to the lowest height below which all 16 columns
+    // are unbroken ground. Runs on any thread.
+    static std::vector<OcclusionCuller::Box> occluders(
+        const Snapshot& snapshot);
+
+    // Columns in the store are read from it rather than generated. It
+    // must be for this world's seed and smoothing; null for none.
+    void setStore(ChunkStore* store) { store_ = store; }
+
+    size_t loadedColumns() const { return columns_.size(); }
+    // Nothing at or above this height is solid.
+    int top() const { return top_; }
+
+   private:
+    void raycastRange(const Ray* rays, size_t count, float max_distance,
+                      RayHit* hits) const;
+
+    int seed_;
+    int smoothing_;
+    int top_ = ChunkColumn::kMinY;
+    ChunkStore* store_ = nullptr;
+    std::unordered_map<glm::ivec2, ColumnPtr> columns_;
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "camera.h"
+#include "trace.h"
 #include <algorithm>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
@@ -117,6 +118,7 @@ void Camera::rotate(double dx, double dy) {
 }
 
 void Camera::physics(float time_delta, std::vector<glm::vec3>& cubes) {
+    TRACE_SCOPE("Camera::physics");
     this->velocity += glm::vec3(0.0, gravity, 0.0);
 
     this->velocity *= pow(0.001, time_delta);
@@ -167,6 +169,17 @@ void Camera::physics(float time_delta, std::vector<glm::vec3>& cubes) {
     this->pos_ += time_delta * this->velocity;
 }
 
+Camera Camera::interpolate(const Camera& next, float t) const {
+    Camera camera = next;
+    camera.pos_ = glm::mix(pos_, next.pos_, t);
+    // A tick turns the camera far less than half a turn, so the blend of
+    // the two directions never comes near zero length.
+    camera.look_ = glm::normalize(glm::mix(look_, next.look_, t));
+    camera.up_ = glm::normalize(glm::mix(up_, next.up_, t));
+    camera.update();
+    return camera;
+}
+
 void Camera::move(Camera::Direction dir) {
     glm::vec3 forward(view[0][2], view[1][2], view[2][2]);
     glm::vec3 strafe(view[0][0], view[1][0], view[2][0]);
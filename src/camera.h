@@ -22,6 +22,10 @@ class Camera {
     void strafe(int direction);
     void jump();
     glm::vec3 getPos() { return pos_; }
+    glm::vec3 getLook() { return look_; }
+    // The camera a fraction t of the way from this one to next, for
+    // drawing in between two simulation ticks.
+    Camera interpolate(const Camera& next, float t) const;
 
     // FIXME: add functions to manipulate camera objects.
    private:
@@ -0,0 +1,76 @@
+#include "chunk_mesher.h"
+
+#include <cmath>
+#include <random>
+
+#include "terrain.h"
+
+namespace {
+// Appends quad (a, b, c, d) as triangles (a, b, c) and (a, c, d); the
+// corners must run counter-clockwise seen from outside.
+void addQuad(ChunkMesh& mesh, const glm::vec3& a, const glm::vec3& b,
+             const glm::vec3& c, const glm::vec3& d) {
+    unsigned base = mesh.vertices.size();
+    mesh.vertices.push_back(glm::vec4(a, 1.0f));
+    mesh.vertices.push_back(glm::vec4(b, 1.0f));
+    mesh.vertices.push_back(glm::vec4(c, 1.0f));
+    mesh.vertices.push_back(glm::vec4(d, 1.0f));
+    mesh.faces.push_back(glm::uvec3(base, base + 1, base + 2));
+    mesh.faces.push_back(glm::uvec3(base, base + 2, base + 3));
+}
+};  // namespace
+
+ChunkMesher::ChunkMesher(int seed, int chunk_size, int smoothing)
+    : seed_(seed), chunk_size_(chunk_size), smoothing_(smoothing) {}
+
+ChunkMesh ChunkMesher::mesh(glm::ivec2 coords) const {
+    // A private Chunk: its noise depends only on the seed, and the
+    // generator it is handed only feeds the texture seed.
+    std::mt19937 gen;
+    Chunk chunk(coords, chunk_size_, gen, nullptr, seed_);
+
+    // Tops of the surface cubes, with a one-column border so the sides
+    // facing neighbouring chunks are known.
+    int n = chunk_size_ + 2;
+    std::vector<float> tops = chunk.regionHeights(-1, -1, n, n, smoothing_);
+    for (float& height : tops) height = std::round(height) + 1.0f;
+    auto top = [&](int x, int z) { return tops[(z + 1) * n + x + 1]; };
+
+    ChunkMesh mesh;
+    mesh.coords = coords;
+    mesh.vertices.reserve(chunk_size_ * chunk_size_ * 8);
+    mesh.faces.reserve(chunk_size_ * chunk_size_ * 4);
+
+    float x0 = float(coords.x * chunk_size_);
+    float z0 = float(coords.y * chunk_size_);
+    for (int z = 0; z < chunk_size_; z++) {
+        for (int x = 0; x < chunk_size_; x++) {
+            float hi = top(x, z);
+            float wx = x0 + x, wz = z0 + z;
+            addQuad(mesh, glm::vec3(wx, hi, wz), glm::vec3(wx, hi, wz + 1),
+                    glm::vec3(wx + 1, hi, wz + 1), glm::vec3(wx + 1, hi, wz));
+
+            float lo = top(x + 1, z);
+            if (lo < hi)
+                addQuad(mesh, glm::vec3(wx + 1, lo, wz),
+                        glm::vec3(wx + 1, hi, wz),
+                        glm::vec3(wx + 1, hi, wz + 1),
+                        glm::vec3(wx + 1, lo, wz + 1));
+            lo = top(x - 1, z);
+            if (lo < hi)
+                addQuad(mesh, glm::vec3(wx, lo, wz), glm::vec3(wx, lo, wz + 1),
+                        glm::vec3(wx, hi, wz + 1), glm::vec3(wx, hi, wz));
+            lo = top(x, z + 1);
+            if (lo < hi)
+                addQuad(mesh, glm::vec3(wx, lo, wz + 1),
+                        glm::vec3(wx + 1, lo, wz + 1),
+                        glm::vec3(wx + 1, hi, wz + 1),
+                        glm::vec3(wx, hi, wz + 1));
+            lo = top(x, z - 1);
+            if (lo < hi)
+                addQuad(mesh, glm::vec3(wx, lo, wz), glm::vec3(wx, hi, wz),
+                        glm::vec3(wx + 1, hi, wz), glm::vec3(wx + 1, lo, wz));
+        }
+    }
+    return mesh;
+}
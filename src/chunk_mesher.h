@@ -0,0 +1,36 @@
+#ifndef CHUNK_MESHER_H
+#define CHUNK_MESHER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+struct ChunkMesh {
+    glm::ivec2 coords;
+    std::vector<glm::vec4> vertices;  // world space
+    std::vector<glm::uvec3> faces;
+};
+
+// Builds the blocky surface of terrain chunks as a triangle mesh: a quad
+// on top of every column, plus one quad per side where the neighbouring
+// column is lower, spanning the whole drop. Faces are wound outwards like
+// Cube::faces.
+//
+// Unlike Terrain::getChunk this keeps no cache and touches no shared
+// state, so chunks can be meshed on any number of threads at once.
+// Heights match Terrain's seamless edge mode with the same smoothing.
+class ChunkMesher {
+   public:
+    ChunkMesher(int seed, int chunk_size, int smoothing = 0);
+
+    ChunkMesh mesh(glm::ivec2 coords) const;
+
+    int chunkSize() const { return chunk_size_; }
+
+   private:
+    int seed_;
+    int chunk_size_;
+    int smoothing_;
+};
+
+#endif
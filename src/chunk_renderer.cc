@@ -0,0 +1,870 @@
+#include "chunk_renderer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+#include <debuggl.h>
+
+#include "frustum.h"
+#include "terrain.h"
+#include "trace.h"
+
+namespace {
+// Levels of the depth pyramid the cull shader accepts, enough for a
+// 65536-pixel-wide occlusion buffer.
+const int kMaxDepthLevels = 16;
+
+// One invocation per instance slot, one row of work groups per chunk
+// slot. Instances are the tightly packed vec3s of the instance buffer,
+// hence the plain float arrays. Survivors stay in their slot's range and
+// are counted into that slot's draw command. The occlusion test is
+// OcclusionCuller::test() on the finest pyramid level at which the box's
+// rectangle spans at most 2 x 2 texels, in view depth with the same bias.
+const char* kCullShader =
+    R"zzz(#version 430 core
+layout(local_size_x = 64) in;
+
+struct DrawCommand {
+    uint index_count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance;
+};
+
+layout(std430, binding = 0) readonly buffer Instances { float instances[]; };
+// Instances to test and draw command, per slot.
+layout(std430, binding = 1) readonly buffer Slots { uvec2 slots[]; };
+layout(std430, binding = 2) writeonly buffer Visible { float visible[]; };
+layout(std430, binding = 3) buffer Commands { DrawCommand commands[]; };
+layout(std430, binding = 4) readonly buffer Depth { float depth[]; };
+layout(std430, binding = 5) buffer Stats {
+    uint frustum_culled;
+    uint occlusion_culled;
+};
+
+uniform uint capacity;
+uniform vec4 planes[6];
+uniform mat4 view_projection;
+uniform int depth_levels;       // 0 without occlusion culling
+uniform ivec3 depth_level[16];  // offset, width, height
+
+const float kNearW = 0.05;
+const float kDepthBias = 1e-3;
+
+bool outsideFrustum(vec3 lo, vec3 hi)
+{
+    for (int i = 0; i < 6; i++) {
+        // The box corner furthest along the plane normal.
+        vec3 p = mix(lo, hi, greaterThanEqual(planes[i].xyz, vec3(0.0)));
+        if (dot(planes[i].xyz, p) + planes[i].w < 0.0)
+            return true;
+    }
+    return false;
+}
+
+bool occluded(vec3 lo, vec3 hi)
+{
+    if (depth_levels == 0)
+        return false;
+    ivec2 size = depth_level[0].yz;
+    vec2 lo_s = vec2(1e30), hi_s = vec2(-1e30);
+    float near_w = 1e30;
+    for (int i = 0; i < 8; i++) {
+        vec3 corner = vec3((i & 1) != 0 ? hi.x : lo.x,
+                           (i & 2) != 0 ? hi.y : lo.y,
+                           (i & 4) != 0 ? hi.z : lo.z);
+        vec4 clip = view_projection * vec4(corner, 1.0);
+        if (clip.w < kNearW)
+            return false;
+        vec2 s = (clip.xy / clip.w * 0.5 + 0.5) * vec2(size);
+        lo_s = min(lo_s, s);
+        hi_s = max(hi_s, s);
+        near_w = min(near_w, clip.w);
+    }
+    ivec2 p0 = max(ivec2(floor(lo_s)) - 1, ivec2(0));
+    ivec2 p1 = min(ivec2(ceil(hi_s)) + 1, size - 1);
+    if (any(greaterThan(p0, p1)))
+        return true;  // off screen
+    int level = 0;
+    while (level + 1 < depth_levels &&
+           any(greaterThan((p1 >> level) - (p0 >> level), ivec2(1))))
+        level++;
+    ivec3 info = depth_level[level];
+    float nearest = near_w * (1.0 - kDepthBias);
+    ivec2 t0 = p0 >> level, t1 = p1 >> level;
+    for (int y = t0.y; y <= t1.y; y++)
+        for (int x = t0.x; x <= t1.x; x++)
+            if (depth[info.x + y * info.y + x] > nearest)
+                return false;
+    return true;
+}
+
+void main()
+{
+    uint slot = gl_WorkGroupID.y;
+    uint local = gl_GlobalInvocationID.x;
+    uvec2 info = slots[slot];
+    if (local >= info.x)
+        return;
+    uint base = slot * capacity;
+    uint i = 3 * (base + local);
+    vec3 lo = vec3(instances[i], instances[i + 1], instances[i + 2]);
+    vec3 hi = lo + vec3(1.0);
+    if (outsideFrustum(lo, hi)) {
+        atomicAdd(frustum_culled, 1u);
+        return;
+    }
+    if (occluded(lo, hi)) {
+        atomicAdd(occlusion_culled, 1u);
+        return;
+    }
+    uint j = 3 * (base + atomicAdd(commands[info.y].instance_count, 1u));
+    visible[j] = lo.x;
+    visible[j + 1] = lo.y;
+    visible[j + 2] = lo.z;
+}
+)zzz";
+
+struct CullStats {
+    GLuint frustum_culled;
+    GLuint occlusion_culled;
+};
+
+// Squared distance from eye to the box. Non-negative floats order like
+// their bits, which makes this a radix sort key.
+uint32_t distanceKey(const OcclusionCuller::Box& box, const glm::vec3& eye) {
+    glm::vec3 d =
+        glm::max(glm::max(box.lo - eye, eye - box.hi), glm::vec3(0.0f));
+    float squared = glm::dot(d, d);
+    uint32_t key;
+    std::memcpy(&key, &squared, sizeof(key));
+    return key;
+}
+
+// Stable LSD radix sort on the keys, a byte per pass; passes in which
+// every key has the same byte are skipped.
+void radixSort(std::vector<std::pair<uint32_t, int>>* items,
+               std::vector<std::pair<uint32_t, int>>* scratch) {
+    scratch->resize(items->size());
+    for (int shift = 0; shift < 32 && !items->empty(); shift += 8) {
+        size_t offsets[257] = {};
+        for (const auto& item : *items)
+            offsets[((item.first >> shift) & 0xFF) + 1]++;
+        if (offsets[((items->front().first >> shift) & 0xFF) + 1] ==
+            items->size())
+            continue;
+        for (int i = 0; i < 256; i++) offsets[i + 1] += offsets[i];
+        for (const auto& item : *items)
+            (*scratch)[offsets[(item.first >> shift) & 0xFF]++] = item;
+        items->swap(*scratch);
+    }
+}
+};  // namespace
+
+ChunkRenderer::ChunkRenderer(int radius, size_t slot_capacity)
+    : radius_(std::max(radius, 0)),
+      width_(2 * radius_ + 1),
+      capacity_(std::max<size_t>(slot_capacity, 1)),
+      slots_(width_ * width_) {}
+
+void ChunkRenderer::setup(const std::vector<glm::vec4>& vertices,
+                          const std::vector<glm::uvec3>& faces) {
+    index_count_ = faces.size() * 3;
+
+    CHECK_GL_ERROR(glGenVertexArrays(1, &vao_));
+    CHECK_GL_ERROR(glBindVertexArray(vao_));
+
+    CHECK_GL_ERROR(glGenBuffers(1, &mesh_buffer_));
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, mesh_buffer_));
+    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
+                                sizeof(glm::vec4) * vertices.size(),
+                                vertices.data(), GL_STATIC_DRAW));
+    CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0));
+    CHECK_GL_ERROR(glEnableVertexAttribArray(0));
+
+    // The attribute pointer is re-aimed at each slot in draw().
+    CHECK_GL_ERROR(glGenBuffers(1, &instance_buffer_));
+    grow(capacity_);
+    CHECK_GL_ERROR(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0));
+    CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+    CHECK_GL_ERROR(glVertexAttribDivisor(1, 1));
+
+    CHECK_GL_ERROR(glGenBuffers(1, &index_buffer_));
+    CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_));
+    CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                                sizeof(glm::uvec3) * faces.size(),
+                                faces.data(), GL_STATIC_DRAW));
+    CHECK_GL_ERROR(glBindVertexArray(0));
+    mesh_bytes_.set(sizeof(glm::vec4) * vertices.size() +
+                    sizeof(glm::uvec3) * faces.size());
+}
+
+void ChunkRenderer::release() {
+    GLuint arrays[] = {vao_, visible_vao_};
+    glDeleteVertexArrays(2, arrays);
+    GLuint buffers[] = {mesh_buffer_,  index_buffer_,   instance_buffer_,
+                        slots_buffer_, visible_buffer_, depth_buffer_};
+    glDeleteBuffers(6, buffers);
+    glDeleteBuffers(kBuffered, command_buffers_);
+    glDeleteBuffers(kBuffered, stats_buffers_);
+    for (auto& readback : readbacks_) {
+        if (readback.fence != nullptr) glDeleteSync(readback.fence);
+        if (readback.buffer != 0) glDeleteBuffers(1, &readback.buffer);
+        readback = Readback();
+    }
+    if (cull_program_ != 0) glDeleteProgram(cull_program_);
+    vao_ = mesh_buffer_ = index_buffer_ = instance_buffer_ = 0;
+    visible_vao_ = slots_buffer_ = visible_buffer_ = depth_buffer_ = 0;
+    cull_program_ = 0;
+    std::fill(command_buffers_, command_buffers_ + kBuffered, 0);
+    std::fill(stats_buffers_, stats_buffers_ + kBuffered, 0);
+    next_readback_ = pending_readbacks_ = 0;
+    dispatched_ = false;
+    mesh_bytes_.set(0);
+    instance_bytes_.set(0);
+    culling_bytes_.set(0);
+    depth_bytes_.set(0);
+    readback_bytes_.set(0);
+}
+
+bool ChunkRenderer::setupGpuCulling(ShaderCache& shader_cache) {
+    if (!GLEW_VERSION_4_3) {
+        std::cerr << "No compute shaders before OpenGL 4.3; culling stays "
+                     "on the CPU"
+                  << std::endl;
+        return false;
+    }
+    cull_program_ =
+        shader_cache.build("cull", {{GL_COMPUTE_SHADER, kCullShader}});
+    CHECK_GL_ERROR(capacity_location_ =
+                       glGetUniformLocation(cull_program_, "capacity"));
+    CHECK_GL_ERROR(planes_location_ =
+                       glGetUniformLocation(cull_program_, "planes"));
+    CHECK_GL_ERROR(view_projection_location_ = glGetUniformLocation(
+                       cull_program_, "view_projection"));
+    CHECK_GL_ERROR(depth_levels_location_ =
+                       glGetUniformLocation(cull_program_, "depth_levels"));
+    CHECK_GL_ERROR(depth_level_location_ =
+                       glGetUniformLocation(cull_program_, "depth_level"));
+
+    GLuint buffers[3];
+    CHECK_GL_ERROR(glGenBuffers(3, buffers));
+    slots_buffer_ = buffers[0];
+    visible_buffer_ = buffers[1];
+    depth_buffer_ = buffers[2];
+    CHECK_GL_ERROR(glGenBuffers(kBuffered, command_buffers_));
+    CHECK_GL_ERROR(glGenBuffers(kBuffered, stats_buffers_));
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, slots_buffer_));
+    CHECK_GL_ERROR(glBufferData(GL_SHADER_STORAGE_BUFFER,
+                                sizeof(glm::uvec2) * slots_.size(), nullptr,
+                                GL_STREAM_DRAW));
+    for (int i = 0; i < kBuffered; i++) {
+        CHECK_GL_ERROR(
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, command_buffers_[i]));
+        CHECK_GL_ERROR(glBufferData(GL_SHADER_STORAGE_BUFFER,
+                                    sizeof(DrawCommand) * slots_.size(),
+                                    nullptr, GL_STREAM_DRAW));
+        CHECK_GL_ERROR(
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, stats_buffers_[i]));
+        CHECK_GL_ERROR(glBufferData(GL_SHADER_STORAGE_BUFFER,
+                                    sizeof(CullStats), nullptr,
+                                    GL_STREAM_DRAW));
+    }
+    // Bound even when occlusion culling is off.
+    float far = std::numeric_limits<float>::infinity();
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, depth_buffer_));
+    CHECK_GL_ERROR(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(far), &far,
+                                GL_STREAM_DRAW));
+    culling_bytes_.set(sizeof(glm::uvec2) * slots_.size() +
+                       kBuffered * (sizeof(DrawCommand) * slots_.size() +
+                                    sizeof(CullStats)));
+    depth_bytes_.set(sizeof(far));
+    allocateVisibleBuffer();
+
+    // The survivors keep their slot's range, so base_instance finds them.
+    CHECK_GL_ERROR(glGenVertexArrays(1, &visible_vao_));
+    CHECK_GL_ERROR(glBindVertexArray(visible_vao_));
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, mesh_buffer_));
+    CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0));
+    CHECK_GL_ERROR(glEnableVertexAttribArray(0));
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, visible_buffer_));
+    CHECK_GL_ERROR(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0));
+    CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+    CHECK_GL_ERROR(glVertexAttribDivisor(1, 1));
+    CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_));
+    CHECK_GL_ERROR(glBindVertexArray(0));
+    return true;
+}
+
+ChunkRenderer::Slot& ChunkRenderer::slotFor(glm::ivec2 coords) {
+    return slots_[floorMod(coords.x, width_) +
+                  width_ * floorMod(coords.y, width_)];
+}
+
+bool ChunkRenderer::inWindow(glm::ivec2 coords) const {
+    glm::ivec2 d = glm::abs(coords - center_);
+    return centered_ && d.x <= radius_ && d.y <= radius_;
+}
+
+void ChunkRenderer::markDirty(glm::ivec2 coords) {
+    if (!inWindow(coords)) return;
+    Slot& slot = slotFor(coords);
+    if (!slot.assigned || slot.coords != coords) return;
+    slot.dirty = slot.edited = true;
+    if (!edit_pending_) {
+        edit_pending_ = true;
+        edit_frame_ = frame_;
+        edit_time_ = Clock::now();
+    }
+}
+
+void ChunkRenderer::update(BlockWorld& world, glm::ivec2 center,
+                           TaskScheduler& tasks) {
+    TRACE_SCOPE("ChunkRenderer::update");
+    frame_++;
+    uploads_ = 0;
+
+    if (!centered_ || center != center_) {
+        center_ = center;
+        centered_ = true;
+        // One more ring than is drawn, so border blocks know their
+        // neighbours.
+        int reach = radius_ + 1;
+        for (auto it = pending_columns_.begin();
+             it != pending_columns_.end();) {
+            glm::ivec2 d = glm::abs(it->first - center);
+            if (d.x > reach || d.y > reach) {
+                it->second.control->cancel();
+                it = pending_columns_.erase(it);
+            } else {
+                it->second.control->setPriority(priority(it->first));
+                ++it;
+            }
+        }
+        for (int z = -reach; z <= reach; z++)
+            for (int x = -reach; x <= reach; x++)
+                column(world, center + glm::ivec2(x, z), tasks);
+
+        for (int z = -radius_; z <= radius_; z++) {
+            for (int x = -radius_; x <= radius_; x++) {
+                glm::ivec2 coords = center + glm::ivec2(x, z);
+                Slot& slot = slotFor(coords);
+                if (slot.assigned && slot.coords == coords) {
+                    if (slot.meshing)
+                        slot.mesh_control->setPriority(priority(coords));
+                    continue;
+                }
+                // The chunk that left keeps being drawn until this one's
+                // mesh replaces it, so nothing pops out meanwhile; its own
+                // mesh, if unfinished, is no longer wanted.
+                if (slot.meshing) {
+                    slot.mesh_control->cancel();
+                    slot.meshing = slot.meshing_edit = false;
+                }
+                slot.coords = coords;
+                slot.assigned = slot.dirty = true;
+                slot.edited = false;
+            }
+        }
+    }
+
+    for (auto it = pending_columns_.begin(); it != pending_columns_.end();) {
+        if (!it->second.column.done()) {
+            ++it;
+            continue;
+        }
+        if (it->second.column.result())
+            world.insert(it->first, *it->second.column.result());
+        it = pending_columns_.erase(it);
+    }
+
+    for (size_t i = 0; i < slots_.size(); i++) {
+        Slot& slot = slots_[i];
+        if (slot.meshing && slot.mesh.done()) {
+            std::optional<Geometry> geometry = slot.mesh.take();
+            slot.meshing = false;
+            // Stale if the window moved on while it was being built.
+            if (geometry && slot.meshing_coords == slot.coords) {
+                if (stage(i, &*geometry)) {
+                    slot.staging_edit |= slot.meshing_edit;
+                } else {
+                    install(i, std::move(*geometry));
+                    upload(i);
+                    slot.staging_edit = false;
+                }
+            }
+            slot.meshing_edit = false;
+        }
+        if (slot.assigned && slot.dirty && !slot.meshing) {
+            std::array<TaskHandle<BlockWorld::ColumnPtr>, 5> columns = {
+                column(world, slot.coords, tasks),
+                column(world, slot.coords + glm::ivec2(-1, 0), tasks),
+                column(world, slot.coords + glm::ivec2(1, 0), tasks),
+                column(world, slot.coords + glm::ivec2(0, -1), tasks),
+                column(world, slot.coords + glm::ivec2(0, 1), tasks)};
+            slot.mesh_control =
+                std::make_shared<TaskControl>(priority(slot.coords));
+            slot.mesh = tasks.spawn(mesh(slot.coords, columns),
+                                    slot.mesh_control);
+            slot.meshing = true;
+            slot.meshing_coords = slot.coords;
+            slot.meshing_edit = slot.edited;
+            slot.dirty = slot.edited = false;
+        }
+    }
+
+    ChunkUploader::Staged staged;
+    while (uploader_ && uploader_->poll(&staged)) {
+        copyStaged(staged);
+        uploader_->recycle(staged.buffer);
+    }
+
+    if (edit_pending_ &&
+        std::none_of(slots_.begin(), slots_.end(), [](const Slot& slot) {
+            return slot.edited || slot.meshing_edit || slot.staging_edit;
+        })) {
+        edit_pending_ = false;
+        edit_done_ = true;
+        edit_frames_ = frame_ - edit_frame_;
+        edit_ms_ = std::chrono::duration<double, std::milli>(Clock::now() -
+                                                             edit_time_)
+                       .count();
+    }
+}
+
+// The chunk's column: the world's if it is loaded, otherwise the task
+// generating it, which is started if there is none yet.
+TaskHandle<BlockWorld::ColumnPtr> ChunkRenderer::column(
+    const BlockWorld& world, glm::ivec2 coords, TaskScheduler& tasks) {
+    if (BlockWorld::ColumnPtr loaded = world.column(coords))
+        return TaskHandle<BlockWorld::ColumnPtr>::ready(loaded);
+    auto it = pending_columns_.find(coords);
+    if (it != pending_columns_.end()) return it->second.column;
+    PendingColumn& pending = pending_columns_[coords];
+    pending.control = std::make_shared<TaskControl>(priority(coords));
+    pending.column = tasks.spawn(generateColumn(world, coords),
+                                 pending.control);
+    return pending.column;
+}
+
+// Nearest the window's centre first.
+int ChunkRenderer::priority(glm::ivec2 coords) const {
+    glm::ivec2 d = coords - center_;
+    return -(d.x * d.x + d.y * d.y);
+}
+
+Task<BlockWorld::ColumnPtr> ChunkRenderer::generateColumn(
+    const BlockWorld& world, glm::ivec2 coords) {
+    co_return world.generate(coords);
+}
+
+Task<ChunkRenderer::Geometry> ChunkRenderer::mesh(
+    glm::ivec2 coords,
+    std::array<TaskHandle<BlockWorld::ColumnPtr>, 5> columns) {
+    BlockWorld::Snapshot snapshot;
+    snapshot.coords = coords;
+    // Columns of cancelled tasks are missing, as if unloaded; only chunks
+    // that have left the window lose theirs, and their meshes are dropped.
+    snapshot.center = (co_await columns[0]).value_or(nullptr);
+    for (int i = 0; i < 4; i++)
+        snapshot.sides[i] = (co_await columns[i + 1]).value_or(nullptr);
+    co_return build(snapshot);
+}
+
+ChunkRenderer::Geometry ChunkRenderer::build(
+    const BlockWorld::Snapshot& snapshot) {
+    TRACE_SCOPE("ChunkRenderer::build");
+    const int cells_per_row = BlockWorld::kChunkSize / kCellSize;
+    glm::ivec2 origin = snapshot.coords * BlockWorld::kChunkSize;
+    auto cellOf = [&](const glm::vec3& block) {
+        return (int(block.x) - origin.x) / kCellSize +
+               (int(block.z) - origin.y) / kCellSize * cells_per_row;
+    };
+
+    Geometry geometry;
+    geometry.occluders = BlockWorld::occluders(snapshot);
+    std::vector<glm::vec3> blocks = BlockWorld::exposedBlocks(snapshot);
+
+    // Counting sort by cell, with bounds for each cell and the chunk.
+    const float kMax = std::numeric_limits<float>::max();
+    OcclusionCuller::Box empty = {glm::vec3(kMax), glm::vec3(-kMax)};
+    geometry.bounds = empty;
+    for (auto& cell : geometry.cells) cell.bounds = empty;
+    for (const auto& block : blocks) {
+        Cell& cell = geometry.cells[cellOf(block)];
+        cell.count++;
+        cell.bounds.lo = glm::min(cell.bounds.lo, block);
+        cell.bounds.hi = glm::max(cell.bounds.hi, block + glm::vec3(1.0f));
+    }
+    size_t first = 0;
+    for (auto& cell : geometry.cells) {
+        cell.first = first;
+        first += cell.count;
+        if (cell.count == 0) continue;
+        geometry.bounds.lo = glm::min(geometry.bounds.lo, cell.bounds.lo);
+        geometry.bounds.hi = glm::max(geometry.bounds.hi, cell.bounds.hi);
+    }
+    geometry.instances.resize(blocks.size());
+    size_t next[kCells];
+    for (int i = 0; i < kCells; i++) next[i] = geometry.cells[i].first;
+    for (const auto& block : blocks)
+        geometry.instances[next[cellOf(block)]++] = block;
+    return geometry;
+}
+
+// Makes geometry the slot's, dropping any upload of an older mesh.
+void ChunkRenderer::install(int index, Geometry geometry) {
+    Slot& slot = slots_[index];
+    slot.geometry = std::move(geometry);
+    slot.staging.reset();
+    slot.generation++;
+}
+
+// Hands geometry to the uploader, unless there is none, it would not fit
+// the slot or the uploader is full; then it is left as it was.
+bool ChunkRenderer::stage(int index, Geometry* geometry) {
+    if (!uploader_ || geometry->instances.empty() ||
+        geometry->instances.size() > capacity_)
+        return false;
+    Slot& slot = slots_[index];
+    auto staging = std::make_shared<Geometry>(std::move(*geometry));
+    // Shares ownership of the whole geometry, so the uploader's reference
+    // alone keeps the instances alive.
+    ChunkUploader::Instances instances(staging, &staging->instances);
+    if (!uploader_->push(index, slot.generation + 1, std::move(instances))) {
+        *geometry = std::move(*staging);
+        return false;
+    }
+    slot.staging = staging;
+    slot.generation++;
+    return true;
+}
+
+// Moves a completed upload into the slot's range of the instance buffer,
+// on the GPU, unless a newer mesh has replaced it meanwhile.
+void ChunkRenderer::copyStaged(const ChunkUploader::Staged& staged) {
+    Slot& slot = slots_[staged.slot];
+    if (!slot.staging || staged.generation != slot.generation) return;
+    slot.geometry = std::move(*slot.staging);
+    slot.staging.reset();
+    slot.staging_edit = false;
+    uploads_++;
+    // Slots only ever grow, so it still fits.
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_READ_BUFFER, staged.buffer));
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_WRITE_BUFFER, instance_buffer_));
+    CHECK_GL_ERROR(glCopyBufferSubData(
+        GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+        sizeof(glm::vec3) * capacity_ * staged.slot,
+        sizeof(glm::vec3) * staged.count));
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+}
+
+void ChunkRenderer::upload(int index) {
+    const auto& instances = slots_[index].geometry.instances;
+    uploads_++;
+    if (instances.size() > capacity_) {
+        size_t capacity = capacity_;
+        while (capacity < instances.size()) capacity *= 2;
+        grow(capacity);
+        return;
+    }
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_));
+    CHECK_GL_ERROR(glBufferSubData(
+        GL_ARRAY_BUFFER, sizeof(glm::vec3) * capacity_ * index,
+        sizeof(glm::vec3) * instances.size(), instances.data()));
+}
+
+// Reallocates the instance buffer with the given capacity per slot and
+// uploads every slot again. Only happens when a chunk outgrows its slot.
+void ChunkRenderer::grow(size_t capacity) {
+    capacity_ = capacity;
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_));
+    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
+                                sizeof(glm::vec3) * capacity_ * slots_.size(),
+                                nullptr, GL_DYNAMIC_DRAW));
+    instance_bytes_.set(sizeof(glm::vec3) * capacity_ * slots_.size());
+    for (size_t i = 0; i < slots_.size(); i++) {
+        const auto& instances = slots_[i].geometry.instances;
+        if (instances.empty()) continue;
+        CHECK_GL_ERROR(glBufferSubData(
+            GL_ARRAY_BUFFER, sizeof(glm::vec3) * capacity_ * i,
+            sizeof(glm::vec3) * instances.size(), instances.data()));
+    }
+    if (cull_program_ != 0) allocateVisibleBuffer();
+}
+
+// The survivors of GPU culling, laid out like the instance buffer.
+void ChunkRenderer::allocateVisibleBuffer() {
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, visible_buffer_));
+    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
+                                sizeof(glm::vec3) * capacity_ * slots_.size(),
+                                nullptr, GL_DYNAMIC_COPY));
+    // Counted with the instance buffer, which it always matches.
+    instance_bytes_.set(2 * sizeof(glm::vec3) * capacity_ * slots_.size());
+}
+
+void ChunkRenderer::cull(const glm::mat4& view_projection,
+                         const glm::vec3& eye, OcclusionCuller* occlusion,
+                         ThreadPool* pool) {
+    TRACE_SCOPE("ChunkRenderer::cull");
+    if (gpuCulling()) {
+        cullOnGpu(view_projection, eye, occlusion, pool);
+        return;
+    }
+    Frustum frustum(view_projection);
+    frustum_culled_ = occlusion_culled_ = 0;
+    occluders_.clear();
+    tested_.clear();
+    tested_cells_.clear();
+    for (size_t i = 0; i < slots_.size(); i++) {
+        Slot& slot = slots_[i];
+        const Geometry& geometry = slot.geometry;
+        if (geometry.instances.empty()) continue;
+        // Chunks outside the frustum cannot hide anything on screen.
+        if (frustum.intersects(geometry.bounds.lo, geometry.bounds.hi))
+            occluders_.insert(occluders_.end(), geometry.occluders.begin(),
+                              geometry.occluders.end());
+        for (int c = 0; c < kCells; c++) {
+            const Cell& cell = geometry.cells[c];
+            if (cell.count == 0) continue;
+            slot.culled[c] = !frustum.intersects(cell.bounds.lo,
+                                                 cell.bounds.hi);
+            if (slot.culled[c]) {
+                frustum_culled_++;
+                continue;
+            }
+            tested_.push_back(cell.bounds);
+            tested_cells_.push_back(i * kCells + c);
+        }
+    }
+    if (occlusion) {
+        occlusion->render(view_projection, occluders_, pool);
+        occlusion->test(tested_, &tested_visible_);
+        for (size_t i = 0; i < tested_cells_.size(); i++) {
+            if (tested_visible_[i]) continue;
+            int index = tested_cells_[i];
+            slots_[index / kCells].culled[index % kCells] = true;
+            occlusion_culled_++;
+        }
+    }
+
+    // Nearest cells first, so the depth test rejects most of what they
+    // hide before it is shaded.
+    order_.clear();
+    for (int index : tested_cells_) {
+        const Slot& slot = slots_[index / kCells];
+        if (slot.culled[index % kCells]) continue;
+        order_.emplace_back(
+            distanceKey(slot.geometry.cells[index % kCells].bounds, eye),
+            index);
+    }
+    radixSort(&order_, &order_scratch_);
+}
+
+void ChunkRenderer::cullOnGpu(const glm::mat4& view_projection,
+                              const glm::vec3& eye,
+                              OcclusionCuller* occlusion, ThreadPool* pool) {
+    // Counts of earlier frames that the GPU has finished with.
+    collectReadbacks();
+    buffered_ = (buffered_ + 1) % kBuffered;
+    GLuint command_buffer = command_buffers_[buffered_];
+    GLuint stats_buffer = stats_buffers_[buffered_];
+
+    // Whole chunks outside the frustum are skipped here; the rest get a
+    // draw command each, nearest first. Occluders still rasterise on the
+    // CPU; that work grows with the chunks in view, not with their blocks.
+    Frustum frustum(view_projection);
+    order_.clear();
+    occluders_.clear();
+    skipped_ = 0;
+    for (size_t i = 0; i < slots_.size(); i++) {
+        const Geometry& geometry = slots_[i].geometry;
+        if (geometry.instances.empty()) continue;
+        if (!frustum.intersects(geometry.bounds.lo, geometry.bounds.hi)) {
+            skipped_ += geometry.instances.size();
+            continue;
+        }
+        order_.emplace_back(distanceKey(geometry.bounds, eye), i);
+        occluders_.insert(occluders_.end(), geometry.occluders.begin(),
+                          geometry.occluders.end());
+    }
+    radixSort(&order_, &order_scratch_);
+
+    std::vector<glm::uvec2> slot_info(slots_.size(), glm::uvec2(0));
+    commands_.resize(order_.size());
+    size_t most = 0;
+    for (size_t k = 0; k < order_.size(); k++) {
+        int i = order_[k].second;
+        size_t count = slots_[i].geometry.instances.size();
+        slot_info[i] = glm::uvec2(count, k);
+        commands_[k] = {GLuint(index_count_), 0, 0, 0, GLuint(capacity_ * i)};
+        most = std::max(most, count);
+    }
+    CullStats stats = {0, 0};
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, slots_buffer_));
+    CHECK_GL_ERROR(glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                                   sizeof(glm::uvec2) * slot_info.size(),
+                                   slot_info.data()));
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, command_buffer));
+    CHECK_GL_ERROR(glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                                   sizeof(DrawCommand) * commands_.size(),
+                                   commands_.data()));
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, stats_buffer));
+    CHECK_GL_ERROR(glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(stats),
+                                   &stats));
+
+    int levels = 0;
+    if (occlusion) {
+        occlusion->render(view_projection, occluders_, pool);
+        occlusion->farthestDepthPyramid(&depth_texels_, &depth_levels_);
+        levels = std::min<int>(depth_levels_.size(), kMaxDepthLevels);
+        CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, depth_buffer_));
+        CHECK_GL_ERROR(glBufferData(GL_SHADER_STORAGE_BUFFER,
+                                    sizeof(float) * depth_texels_.size(),
+                                    depth_texels_.data(), GL_STREAM_DRAW));
+        depth_bytes_.set(sizeof(float) * depth_texels_.size());
+    }
+
+    GLint program = 0;
+    CHECK_GL_ERROR(glGetIntegerv(GL_CURRENT_PROGRAM, &program));
+    CHECK_GL_ERROR(glUseProgram(cull_program_));
+    glm::vec4 planes[6];
+    for (int i = 0; i < 6; i++) planes[i] = frustum.plane(i);
+    CHECK_GL_ERROR(glUniform1ui(capacity_location_, capacity_));
+    CHECK_GL_ERROR(glUniform4fv(planes_location_, 6, &planes[0][0]));
+    CHECK_GL_ERROR(glUniformMatrix4fv(view_projection_location_, 1, GL_FALSE,
+                                      &view_projection[0][0]));
+    CHECK_GL_ERROR(glUniform1i(depth_levels_location_, levels));
+    static_assert(sizeof(OcclusionCuller::Level) == 3 * sizeof(GLint),
+                  "levels are uploaded as ivec3s");
+    if (levels > 0)
+        CHECK_GL_ERROR(glUniform3iv(depth_level_location_, levels,
+                                    &depth_levels_[0].offset));
+    GLuint buffers[] = {instance_buffer_, slots_buffer_, visible_buffer_,
+                        command_buffer,   depth_buffer_, stats_buffer};
+    for (int i = 0; i < 6; i++)
+        CHECK_GL_ERROR(
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, buffers[i]));
+    if (most > 0)
+        CHECK_GL_ERROR(glDispatchCompute((most + 63) / 64, slots_.size(), 1));
+    CHECK_GL_ERROR(glMemoryBarrier(GL_COMMAND_BARRIER_BIT |
+                                   GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+                                   GL_BUFFER_UPDATE_BARRIER_BIT));
+    CHECK_GL_ERROR(glUseProgram(program));
+    dispatched_ = true;
+    readBack();
+}
+
+// Copies this frame's counts and draw commands into the next readback
+// buffer and fences the copy. Dropped when every buffer is still waiting.
+void ChunkRenderer::readBack() {
+    if (pending_readbacks_ == kReadbacks) return;
+    Readback& readback = readbacks_[next_readback_];
+    size_t commands = sizeof(DrawCommand) * commands_.size();
+    size_t bytes = sizeof(CullStats) + commands;
+    if (readback.buffer == 0)
+        CHECK_GL_ERROR(glGenBuffers(1, &readback.buffer));
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_WRITE_BUFFER, readback.buffer));
+    if (readback.capacity < bytes) {
+        CHECK_GL_ERROR(glBufferData(GL_COPY_WRITE_BUFFER, bytes, nullptr,
+                                    GL_STREAM_READ));
+        readback_bytes_.set(readback_bytes_.bytes() - readback.capacity +
+                            bytes);
+        readback.capacity = bytes;
+    }
+    CHECK_GL_ERROR(
+        glBindBuffer(GL_COPY_READ_BUFFER, stats_buffers_[buffered_]));
+    CHECK_GL_ERROR(glCopyBufferSubData(GL_COPY_READ_BUFFER,
+                                       GL_COPY_WRITE_BUFFER, 0, 0,
+                                       sizeof(CullStats)));
+    if (commands > 0) {
+        CHECK_GL_ERROR(
+            glBindBuffer(GL_COPY_READ_BUFFER, command_buffers_[buffered_]));
+        CHECK_GL_ERROR(glCopyBufferSubData(GL_COPY_READ_BUFFER,
+                                           GL_COPY_WRITE_BUFFER, 0,
+                                           sizeof(CullStats), commands));
+    }
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    CHECK_GL_ERROR(readback.fence =
+                       glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+    readback.commands = commands_.size();
+    readback.skipped = skipped_;
+    next_readback_ = (next_readback_ + 1) % kReadbacks;
+    pending_readbacks_++;
+}
+
+// Reads the readbacks whose fences have signalled, oldest first, without
+// waiting for the others; the statistics keep their values until then.
+void ChunkRenderer::collectReadbacks() {
+    while (pending_readbacks_ > 0) {
+        Readback& readback =
+            readbacks_[(next_readback_ - pending_readbacks_ + kReadbacks) %
+                       kReadbacks];
+        GLenum status = glClientWaitSync(readback.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        glDeleteSync(readback.fence);
+        readback.fence = nullptr;
+        pending_readbacks_--;
+
+        CullStats stats;
+        std::vector<DrawCommand> commands(readback.commands);
+        CHECK_GL_ERROR(glBindBuffer(GL_COPY_READ_BUFFER, readback.buffer));
+        CHECK_GL_ERROR(glGetBufferSubData(GL_COPY_READ_BUFFER, 0,
+                                          sizeof(stats), &stats));
+        if (!commands.empty())
+            CHECK_GL_ERROR(glGetBufferSubData(
+                GL_COPY_READ_BUFFER, sizeof(stats),
+                sizeof(DrawCommand) * commands.size(), commands.data()));
+        CHECK_GL_ERROR(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+        instances_ = 0;
+        for (const auto& command : commands)
+            instances_ += command.instance_count;
+        frustum_culled_ = readback.skipped + stats.frustum_culled;
+        occlusion_culled_ = stats.occlusion_culled;
+    }
+}
+
+void ChunkRenderer::draw() {
+    TRACE_SCOPE("ChunkRenderer::draw");
+    if (gpuCulling() && dispatched_) {
+        draw_calls_ = commands_.size();
+        if (commands_.empty()) return;
+        CHECK_GL_ERROR(glBindVertexArray(visible_vao_));
+        CHECK_GL_ERROR(glBindBuffer(GL_DRAW_INDIRECT_BUFFER,
+                                    command_buffers_[buffered_]));
+        CHECK_GL_ERROR(glMultiDrawElementsIndirect(
+            GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, commands_.size(), 0));
+        CHECK_GL_ERROR(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+        CHECK_GL_ERROR(glBindVertexArray(0));
+        return;
+    }
+    instances_ = draw_calls_ = 0;
+    CHECK_GL_ERROR(glBindVertexArray(vao_));
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_));
+    for (const auto& item : order_) {
+        int i = item.second / kCells;
+        const Cell& cell = slots_[i].geometry.cells[item.second % kCells];
+        size_t offset = sizeof(glm::vec3) * (capacity_ * i + cell.first);
+        CHECK_GL_ERROR(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0,
+                                             (void*)offset));
+        CHECK_GL_ERROR(glDrawElementsInstanced(
+            GL_TRIANGLES, index_count_, GL_UNSIGNED_INT, 0, cell.count));
+        instances_ += cell.count;
+        draw_calls_++;
+    }
+    CHECK_GL_ERROR(glBindVertexArray(0));
+}
+
+bool ChunkRenderer::takeEditLatency(int* frames, double* ms) {
+    if (!edit_done_) return false;
+    edit_done_ = false;
+    *frames = edit_frames_;
+    *ms = edit_ms_;
+    return true;
+}
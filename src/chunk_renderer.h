@@ -0,0 +1,288 @@
+#ifndef CHUNK_RENDERER_H
+#define CHUNK_RENDERER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "block_world.h"
+#include "chunk_uploader.h"
+#include "memory_tracker.h"
+#include "occlusion_culler.h"
+#include "shader_cache.h"
+#include "task_scheduler.h"
+#include "thread_pool.h"
+
+// Draws the exposed blocks of the chunks within a square window around the
+// player as cube instances, keeping each chunk's instances in its own
+// range of one GPU buffer.
+//
+// Chunk (x, z) always maps to slot (x mod w, z mod w) of the w x w window,
+// so when the window moves only the chunks that enter it are meshed, into
+// the slots of the ones that left. Chunks marked dirty by an edit are
+// remeshed from a BlockWorld::Snapshot, and only their slot is
+// re-uploaded, so an edit shows up a frame or two later whatever the view
+// distance.
+//
+// Chunks are built by tasks on a TaskScheduler: one generates each
+// missing column of the world around the window, and one meshes each
+// chunk once its own column and its four neighbours' are there. Tasks
+// nearer the centre run first, and tasks for chunks the window has left
+// are cancelled, so a fast-moving player never waits behind chunks that
+// are already out of range.
+//
+// Each chunk's instances are grouped into kCells cells of 8 x 8 columns,
+// which are culled and drawn separately: cull() skips cells outside the
+// view frustum and, given an OcclusionCuller, cells hidden behind the
+// ground of nearer chunks. What is left is drawn nearest first, so the
+// depth test discards most hidden fragments before they are shaded.
+//
+// Where the context has compute shaders (GL 4.3), culling can instead run
+// on the GPU, per instance: a compute shader reads every resident
+// instance straight from the instance buffer, tests it against the
+// frustum and the occlusion culler's depth pyramid, appends the survivors
+// to a buffer of their own and counts them into its chunk's indirect draw
+// command, so draw() is a single glMultiDrawElementsIndirect, still
+// ordered nearest first, and the CPU no longer touches anything that
+// grows with the number of blocks.
+//
+// Given a ChunkUploader, finished meshes go to the GPU on its thread
+// instead, and update() only copies those whose upload has completed into
+// their slot, so a burst of new chunks never stalls a frame. Meshes that
+// do not fit their slot, or that arrive while the uploader is full, are
+// still uploaded directly.
+class ChunkRenderer {
+   public:
+    static const int kCellSize = 8;  // columns
+    static const int kCells = (BlockWorld::kChunkSize / kCellSize) *
+                              (BlockWorld::kChunkSize / kCellSize);
+
+    // radius chunks on each side of the centre chunk; slots start with
+    // room for slot_capacity instances and grow as needed.
+    explicit ChunkRenderer(int radius = 4, size_t slot_capacity = 2048);
+
+    // Uploads the cube mesh and allocates the instance buffer. Requires
+    // the GL context.
+    void setup(const std::vector<glm::vec4>& vertices,
+               const std::vector<glm::uvec3>& faces);
+    void release();
+    // Builds the culling compute shader. Fails, leaving culling on the
+    // CPU, if the context lacks compute shaders or storage buffers.
+    bool setupGpuCulling(ShaderCache& shader_cache);
+    bool gpuCullingAvailable() const { return cull_program_ != 0; }
+    // Chooses between the two paths when both are available.
+    void useGpuCulling(bool enable) { use_gpu_ = enable; }
+    bool gpuCulling() const { return use_gpu_ && cull_program_ != 0; }
+
+    // Sends meshes through uploader from now on; null uploads them on the
+    // render thread. The uploader must outlive its use here.
+    void setUploader(ChunkUploader* uploader) { uploader_ = uploader; }
+
+    // Queues a chunk for remeshing, e.g. after BlockWorld::set. Chunks
+    // outside the window are ignored.
+    void markDirty(glm::ivec2 coords);
+    // Moves the window to center, starts generating the world around it
+    // and meshing dirty chunks, adds finished columns to world and
+    // uploads finished meshes. Call once per frame before draw(); world
+    // must outlive the tasks.
+    void update(BlockWorld& world, glm::ivec2 center, TaskScheduler& tasks);
+    // Decides which cells draw() submits, and in what order: by distance
+    // from eye, which is sorted on every frame. Without an occlusion
+    // culler only the frustum is used; the pool may be null.
+    void cull(const glm::mat4& view_projection, const glm::vec3& eye,
+              OcclusionCuller* occlusion, ThreadPool* pool);
+    // Draws what the last cull() kept with the currently bound program;
+    // the instance attribute (location 1) is the block's minimum corner.
+    // Can be called more than once per cull(), e.g. for a depth pre-pass.
+    void draw();
+
+    // Statistics for the last update(), cull() and draw(). When culling
+    // on the GPU they count instances rather than cells, and are read
+    // back once the GPU has finished with them, a frame or more late, so
+    // as not to wait for it.
+    size_t instances() const { return instances_; }
+    size_t draw_calls() const { return draw_calls_; }
+    size_t uploads() const { return uploads_; }
+    // Non-empty cells skipped by each test.
+    size_t frustumCulled() const { return frustum_culled_; }
+    size_t occlusionCulled() const { return occlusion_culled_; }
+    // Once per completed edit: the frames and milliseconds from the first
+    // markDirty() to the upload of the last chunk it dirtied.
+    bool takeEditLatency(int* frames, double* ms);
+
+   private:
+    typedef std::chrono::steady_clock Clock;
+
+    // A run of a chunk's instances, all in one cell.
+    struct Cell {
+        size_t first = 0;
+        size_t count = 0;
+        OcclusionCuller::Box bounds;
+    };
+
+    // What the workers build for a chunk.
+    struct Geometry {
+        // Sorted by cell.
+        TrackedVector<glm::vec3, MemoryTag::kMeshes> instances;
+        Cell cells[kCells];
+        std::vector<OcclusionCuller::Box> occluders;
+        OcclusionCuller::Box bounds;  // of all the instances
+    };
+
+    // As glMultiDrawElementsIndirect reads it.
+    struct DrawCommand {
+        GLuint index_count;
+        GLuint instance_count;
+        GLuint first_index;
+        GLint base_vertex;
+        GLuint base_instance;
+    };
+
+    struct Slot {
+        glm::ivec2 coords;
+        bool assigned = false;
+        bool dirty = false;
+        bool edited = false;  // dirty because of markDirty()
+        TaskHandle<Geometry> mesh;
+        TaskControlPtr mesh_control;
+        bool meshing = false;
+        glm::ivec2 meshing_coords;
+        bool meshing_edit = false;
+        Geometry geometry;  // as uploaded
+        // A mesh on its way through the uploader, and the number its
+        // upload must carry to be copied: every mesh installed bumps it,
+        // so late uploads of older meshes are dropped.
+        std::shared_ptr<Geometry> staging;
+        bool staging_edit = false;
+        uint64_t generation = 0;
+        bool culled[kCells] = {};
+    };
+
+    // A column being generated.
+    struct PendingColumn {
+        TaskHandle<BlockWorld::ColumnPtr> column;
+        TaskControlPtr control;
+    };
+
+    static Geometry build(const BlockWorld::Snapshot& snapshot);
+    static Task<BlockWorld::ColumnPtr> generateColumn(const BlockWorld& world,
+                                                      glm::ivec2 coords);
+    // columns are the chunk's own and then its -x, +x, -z, +z
+    // neighbours', as in BlockWorld::Snapshot.
+    static Task<Geometry> mesh(
+        glm::ivec2 coords,
+        std::array<TaskHandle<BlockWorld::ColumnPtr>, 5> columns);
+    TaskHandle<BlockWorld::ColumnPtr> column(const BlockWorld& world,
+                                             glm::ivec2 coords,
+                                             TaskScheduler& tasks);
+    int priority(glm::ivec2 coords) const;
+
+    Slot& slotFor(glm::ivec2 coords);
+    bool inWindow(glm::ivec2 coords) const;
+    void install(int index, Geometry geometry);
+    bool stage(int index, Geometry* geometry);
+    void copyStaged(const ChunkUploader::Staged& staged);
+    void upload(int index);
+    void grow(size_t capacity);
+    void allocateVisibleBuffer();
+    void cullOnGpu(const glm::mat4& view_projection, const glm::vec3& eye,
+                   OcclusionCuller* occlusion, ThreadPool* pool);
+    void readBack();
+    void collectReadbacks();
+
+    int radius_;
+    int width_;
+    size_t capacity_;
+    glm::ivec2 center_;
+    bool centered_ = false;
+    std::vector<Slot> slots_;
+    std::unordered_map<glm::ivec2, PendingColumn> pending_columns_;
+    ChunkUploader* uploader_ = nullptr;
+
+    GLuint vao_ = 0;
+    GLuint mesh_buffer_ = 0;
+    GLuint index_buffer_ = 0;
+    GLuint instance_buffer_ = 0;
+    GLsizei index_count_ = 0;
+    // Storage of the GL buffers, for MemoryTracker: the mesh and index
+    // buffers, the instance and visible buffers, GPU culling's per-slot
+    // buffers and its depth pyramid.
+    TrackedBytes mesh_bytes_{MemoryTag::kGpuBuffers};
+    TrackedBytes instance_bytes_{MemoryTag::kGpuBuffers};
+    TrackedBytes culling_bytes_{MemoryTag::kGpuBuffers};
+    TrackedBytes depth_bytes_{MemoryTag::kGpuBuffers};
+    TrackedBytes readback_bytes_{MemoryTag::kGpuBuffers};
+
+    // A copy of a frame's culling counts and draw commands, for reading
+    // once its fence has signalled.
+    struct Readback {
+        GLuint buffer = 0;
+        size_t capacity = 0;  // bytes
+        GLsync fence = nullptr;
+        size_t commands = 0;
+        size_t skipped = 0;
+    };
+    // Frames whose command and stats buffers may be in flight at once,
+    // and copies of their counts waiting to be read.
+    static const int kBuffered = 2;
+    static const int kReadbacks = 3;
+
+    // GPU culling.
+    bool use_gpu_ = true;
+    GLuint cull_program_ = 0;
+    GLuint visible_vao_ = 0;
+    GLuint slots_buffer_ = 0;    // instances to test, draw command
+    GLuint visible_buffer_ = 0;  // the survivors, by slot
+    GLuint depth_buffer_ = 0;    // OcclusionCuller::farthestDepthPyramid
+    // One DrawCommand per chunk drawn, and the culling counters; frames
+    // alternate between them, so resetting one never waits on the draw
+    // of the frame before.
+    GLuint command_buffers_[kBuffered] = {};
+    GLuint stats_buffers_[kBuffered] = {};
+    int buffered_ = 0;  // the pair the last cull() used
+    Readback readbacks_[kReadbacks];
+    int next_readback_ = 0;
+    int pending_readbacks_ = 0;
+    GLint capacity_location_ = -1;
+    GLint planes_location_ = -1;
+    GLint view_projection_location_ = -1;
+    GLint depth_levels_location_ = -1;
+    GLint depth_level_location_ = -1;
+    bool dispatched_ = false;
+    std::vector<DrawCommand> commands_;
+    size_t skipped_ = 0;  // instances of chunks outside the frustum
+    std::vector<float> depth_texels_;
+    std::vector<OcclusionCuller::Level> depth_levels_;
+
+    // Edit latency bookkeeping.
+    int frame_ = 0;
+    bool edit_pending_ = false;
+    int edit_frame_ = 0;
+    Clock::time_point edit_time_;
+    bool edit_done_ = false;
+    int edit_frames_ = 0;
+    double edit_ms_ = 0.0;
+
+    size_t instances_ = 0;
+    size_t draw_calls_ = 0;
+    size_t uploads_ = 0;
+    size_t frustum_culled_ = 0;
+    size_t occlusion_culled_ = 0;
+    std::vector<OcclusionCuller::Box> occluders_;
+    std::vector<OcclusionCuller::Box> tested_;
+    std::vector<int> tested_cells_;  // slot * kCells + cell
+    std::vector<bool> tested_visible_;
+    // (distance key, slot * kCells + cell) on the CPU, (key, slot) on the
+    // GPU; sorted nearest first.
+    std::vector<std::pair<uint32_t, int>> order_;
+    std::vector<std::pair<uint32_t, int>> order_scratch_;
+};
+
+#endif
@@ -0,0 +1,253 @@
+#include "chunk_section.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "terrain.h"
+#include "trace.h"
+
+namespace {
+// Smallest power-of-two index width that can address the palette.
+int bitsFor(size_t palette_size) {
+    if (palette_size <= 1) return 0;
+    if (palette_size <= 2) return 1;
+    if (palette_size <= 4) return 2;
+    if (palette_size <= 16) return 4;
+    if (palette_size <= 256) return 8;
+    return 16;
+}
+
+void append(std::vector<char>* out, const void* data, size_t bytes) {
+    const char* p = static_cast<const char*>(data);
+    out->insert(out->end(), p, p + bytes);
+}
+
+// Copies the next bytes of [*in, end) to data and moves *in past them.
+bool take(const char** in, const char* end, void* data, size_t bytes) {
+    if (size_t(end - *in) < bytes) return false;
+    if (bytes != 0) std::memcpy(data, *in, bytes);
+    *in += bytes;
+    return true;
+}
+
+int log2Int(int x) {
+    int n = 0;
+    while (x > 1) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+}
+};  // namespace
+
+ChunkSection::ChunkSection(BlockId fill) : palette_(1, fill) {}
+
+unsigned ChunkSection::paletteIndex(BlockId block) {
+    // Palettes hold at most one entry per block type, so this is short.
+    for (size_t i = 0; i < palette_.size(); i++)
+        if (palette_[i] == block) return i;
+    palette_.push_back(block);
+    return palette_.size() - 1;
+}
+
+void ChunkSection::set(int x, int y, int z, BlockId block) {
+    if (bits_ == 0 && palette_[0] == block) return;
+    unsigned value = paletteIndex(block);
+    int needed = bitsFor(palette_.size());
+    if (needed > bits_) {
+        std::vector<unsigned> identity(palette_.size());
+        for (size_t i = 0; i < identity.size(); i++) identity[i] = i;
+        repack(needed, identity);
+    }
+    int i = index(x, y, z);
+    int offset = (i & mask_) * bits_;
+    uint64_t& word = data_[i >> shift_];
+    word = (word & ~(value_mask_ << offset)) | (uint64_t(value) << offset);
+}
+
+// Rewrites the indices at a new width, mapping old palette index v to
+// remap[v].
+void ChunkSection::repack(int bits, const std::vector<unsigned>& remap) {
+    std::vector<unsigned> values(kVolume, remap[0]);
+    if (bits_ != 0) {
+        for (int i = 0; i < kVolume; i++)
+            values[i] = remap[(data_[i >> shift_] >> ((i & mask_) * bits_)) &
+                              value_mask_];
+    }
+
+    setBits(bits);
+    if (bits_ == 0) {
+        Words().swap(data_);
+        return;
+    }
+    Words(kVolume / (mask_ + 1), 0).swap(data_);
+    for (int i = 0; i < kVolume; i++)
+        data_[i >> shift_] |= uint64_t(values[i]) << ((i & mask_) * bits_);
+}
+
+// Sets bits_ and the fields derived from it.
+void ChunkSection::setBits(int bits) {
+    bits_ = bits;
+    if (bits_ == 0) {
+        shift_ = mask_ = 0;
+        value_mask_ = 0;
+        return;
+    }
+    int per_word = 64 / bits_;
+    shift_ = log2Int(per_word);
+    mask_ = per_word - 1;
+    value_mask_ = (1ull << bits_) - 1;
+}
+
+void ChunkSection::compact() {
+    if (bits_ == 0) return;
+    std::vector<int> counts(palette_.size(), 0);
+    for (int i = 0; i < kVolume; i++)
+        counts[(data_[i >> shift_] >> ((i & mask_) * bits_)) & value_mask_]++;
+
+    Palette palette;
+    std::vector<unsigned> remap(palette_.size(), 0);
+    for (size_t i = 0; i < palette_.size(); i++) {
+        if (counts[i] == 0) continue;
+        remap[i] = palette.size();
+        palette.push_back(palette_[i]);
+    }
+    int bits = bitsFor(palette.size());
+    if (palette.size() == palette_.size() && bits == bits_) return;
+    repack(bits, remap);
+    palette_.swap(palette);
+}
+
+size_t ChunkSection::memoryUsage() const {
+    return sizeof(*this) + palette_.capacity() * sizeof(BlockId) +
+           data_.capacity() * sizeof(uint64_t);
+}
+
+void ChunkSection::serialize(std::vector<char>* out) const {
+    uint16_t entries = palette_.size();
+    uint8_t bits = bits_;
+    append(out, &entries, sizeof(entries));
+    append(out, palette_.data(), sizeof(BlockId) * palette_.size());
+    append(out, &bits, sizeof(bits));
+    append(out, data_.data(), sizeof(uint64_t) * data_.size());
+}
+
+bool ChunkSection::deserialize(const char** in, const char* end) {
+    const char* p = *in;
+    uint16_t entries = 0;
+    uint8_t bits = 0;
+    if (!take(&p, end, &entries, sizeof(entries)) || entries == 0)
+        return false;
+    Palette palette(entries);
+    if (!take(&p, end, palette.data(), sizeof(BlockId) * entries) ||
+        !take(&p, end, &bits, sizeof(bits)))
+        return false;
+    // Any width set() can leave behind, as long as it reaches the whole
+    // palette.
+    if (bits != 0 && bits != 1 && bits != 2 && bits != 4 && bits != 8 &&
+        bits != 16)
+        return false;
+    if (bits < bitsFor(entries)) return false;
+    Words data(bits == 0 ? 0 : kVolume * bits / 64);
+    if (!take(&p, end, data.data(), sizeof(uint64_t) * data.size()))
+        return false;
+
+    ChunkSection section;
+    section.palette_.swap(palette);
+    section.data_.swap(data);
+    section.setBits(bits);
+    // Indices past the palette would make get() read out of bounds.
+    if (bits != 0) {
+        for (int i = 0; i < kVolume; i++) {
+            uint64_t value = (section.data_[i >> section.shift_] >>
+                              ((i & section.mask_) * bits)) &
+                             section.value_mask_;
+            if (value >= entries) return false;
+        }
+    }
+    *this = std::move(section);
+    *in = p;
+    return true;
+}
+
+ChunkColumn::ChunkColumn() : sections_(kSections) {}
+
+void ChunkColumn::set(int x, int y, int z, BlockId block) {
+    int sy = y - kMinY;
+    if (sy < 0 || sy >= kHeight) return;
+    sections_[sy / ChunkSection::kSize].set(x, sy % ChunkSection::kSize, z,
+                                            block);
+}
+
+void ChunkColumn::generate(Chunk& chunk, int smoothing) {
+    TRACE_SCOPE("ChunkColumn::generate");
+    const int size = ChunkSection::kSize;
+    std::vector<float> heights =
+        chunk.regionHeights(0, 0, size, size, smoothing);
+    std::vector<int> tops(heights.size());
+    for (size_t i = 0; i < heights.size(); i++)
+        tops[i] = std::min(std::max(int(std::round(heights[i])), kMinY),
+                           kMinY + kHeight - 1);
+
+    // Sections wholly below the deepest dirt are uniform stone from the
+    // start, so they never get an index array.
+    int lowest_dirt = *std::min_element(tops.begin(), tops.end()) - 3;
+    int solid_sections = floorDiv(lowest_dirt - kMinY, size);
+    sections_.assign(kSections, ChunkSection(kAir));
+    for (int s = 0; s < solid_sections && s < kSections; s++)
+        sections_[s] = ChunkSection(kStone);
+    int first_y = kMinY + std::max(solid_sections, 0) * size;
+
+    for (int z = 0; z < size; z++) {
+        for (int x = 0; x < size; x++) {
+            int top = tops[x + z * size];
+            // The colour bands of the terrain fragment shader.
+            BlockId surface = top < 0 ? kDirt : top < 10 ? kGrass : kStone;
+            for (int y = first_y; y < top - 3; y++) set(x, y, z, kStone);
+            for (int y = std::max(first_y, top - 3); y < top; y++)
+                set(x, y, z, kDirt);
+            set(x, top, z, surface);
+            for (int y = top + 1; y < kSeaLevel; y++) set(x, y, z, kWater);
+        }
+    }
+    compact();
+}
+
+int ChunkColumn::top() const {
+    const int size = ChunkSection::kSize;
+    for (int i = kSections - 1; i >= 0; i--) {
+        const ChunkSection& section = sections_[i];
+        if (section.uniform() && section.uniformBlock() == kAir) continue;
+        for (int y = size - 1; y >= 0; y--)
+            for (int z = 0; z < size; z++)
+                for (int x = 0; x < size; x++)
+                    if (section.get(x, y, z) != kAir)
+                        return kMinY + i * size + y + 1;
+    }
+    return kMinY;
+}
+
+void ChunkColumn::compact() {
+    for (auto& section : sections_) section.compact();
+}
+
+void ChunkColumn::serialize(std::vector<char>* out) const {
+    for (const auto& section : sections_) section.serialize(out);
+}
+
+bool ChunkColumn::deserialize(const char** in, const char* end) {
+    const char* p = *in;
+    TrackedVector<ChunkSection, MemoryTag::kWorld> sections(kSections);
+    for (auto& section : sections)
+        if (!section.deserialize(&p, end)) return false;
+    sections_.swap(sections);
+    *in = p;
+    return true;
+}
+
+size_t ChunkColumn::memoryUsage() const {
+    size_t bytes = sizeof(*this);
+    for (const auto& section : sections_) bytes += section.memoryUsage();
+    return bytes;
+}
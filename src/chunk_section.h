@@ -0,0 +1,129 @@
+#ifndef CHUNK_SECTION_H
+#define CHUNK_SECTION_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "memory_tracker.h"
+
+class Chunk;
+
+typedef uint16_t BlockId;
+
+enum Block : BlockId {
+    kAir = 0,
+    kWater,
+    kGrass,
+    kDirt,
+    kStone,
+};
+
+// A 16 x 16 x 16 cube of blocks stored as a palette plus bit-packed
+// indices into it.
+//
+// Indices take 0, 1, 2, 4, 8 or 16 bits, the smallest that fits the
+// palette. A power of two never straddles a 64-bit word, so get() and
+// set() are a shift and a mask. A section holding one block type has
+// no index array at all. set() only grows the palette; compact() drops
+// entries that are no longer used and shrinks the indices, and collapses
+// the section when it has become uniform.
+class ChunkSection {
+   public:
+    static const int kSize = 16;
+    static const int kVolume = kSize * kSize * kSize;
+
+    explicit ChunkSection(BlockId fill = kAir);
+
+    BlockId get(int x, int y, int z) const {
+        if (bits_ == 0) return palette_[0];
+        int i = index(x, y, z);
+        return palette_[(data_[i >> shift_] >> ((i & mask_) * bits_)) &
+                        value_mask_];
+    }
+    void set(int x, int y, int z, BlockId block);
+
+    bool uniform() const { return bits_ == 0; }
+    // The only block in a uniform section.
+    BlockId uniformBlock() const { return palette_[0]; }
+    int bitsPerBlock() const { return bits_; }
+    size_t paletteSize() const { return palette_.size(); }
+
+    void compact();
+    // Heap and inline bytes held by this section.
+    size_t memoryUsage() const;
+
+    // Appends the section to out: the palette size, the palette, the
+    // index width and the packed indices, in host byte order.
+    void serialize(std::vector<char>* out) const;
+    // Reads a section written by serialize() from [*in, end) and moves
+    // *in past it. Fails, leaving the section as it was, on bytes that
+    // are not a valid section.
+    bool deserialize(const char** in, const char* end);
+
+   private:
+    typedef TrackedVector<BlockId, MemoryTag::kWorld> Palette;
+    typedef TrackedVector<uint64_t, MemoryTag::kWorld> Words;
+
+    static int index(int x, int y, int z) {
+        return (y * kSize + z) * kSize + x;
+    }
+    unsigned paletteIndex(BlockId block);
+    void repack(int bits, const std::vector<unsigned>& remap);
+    void setBits(int bits);
+
+    Palette palette_;
+    Words data_;
+    int bits_ = 0;
+    // Derived from bits_: log2(entries per word), entries per word - 1,
+    // and (1 << bits_) - 1.
+    int shift_ = 0;
+    int mask_ = 0;
+    uint64_t value_mask_ = 0;
+};
+
+// The block contents of one terrain chunk: a vertical stack of sections
+// from kMinY up to kMinY + kHeight. Above and below that is air.
+class ChunkColumn {
+   public:
+    static const int kMinY = -64;
+    static const int kHeight = 256;
+    static const int kSections = kHeight / ChunkSection::kSize;
+    // Everything below this height that is not ground is water.
+    static const int kSeaLevel = 0;
+    // Bumped whenever generate(), or the terrain it reads, changes its
+    // output, so columns stored by an older one are not taken as current.
+    static const int kGeneratorVersion = 1;
+
+    ChunkColumn();
+
+    // Fills the column from the chunk's height field: stone, three layers
+    // of dirt, then a surface block matching the renderer's colour bands,
+    // with water up to the sea level. Compacts every section afterwards.
+    void generate(Chunk& chunk, int smoothing = 0);
+
+    // x and z are local to the chunk, y is a world height.
+    BlockId get(int x, int y, int z) const {
+        int sy = y - kMinY;
+        if (sy < 0 || sy >= kHeight) return kAir;
+        return sections_[sy / ChunkSection::kSize].get(
+            x, sy % ChunkSection::kSize, z);
+    }
+    void set(int x, int y, int z, BlockId block);
+
+    const ChunkSection& section(int i) const { return sections_[i]; }
+    // One above the highest non-air block; kMinY if there is none.
+    int top() const;
+    void compact();
+    size_t memoryUsage() const;
+    // The sections from the bottom up, as ChunkSection::serialize().
+    void serialize(std::vector<char>* out) const;
+    bool deserialize(const char** in, const char* end);
+
+   private:
+    TrackedVector<ChunkSection, MemoryTag::kWorld> sections_;
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include "chunk_store.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "terrain.h"
+#include "trace.h"
+
+namespace {
+const uint32_t kMagic = 0x67724343;  // "CCrg"
+const uint32_t kVersion = 2;
+const size_t kEntries = ChunkStore::kRegionSize * ChunkStore::kRegionSize;
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t region_size;
+    uint32_t seed;
+    uint32_t smoothing;
+    uint32_t generator;  // ChunkColumn::kGeneratorVersion
+};
+
+uint32_t checksum(const char* data, size_t size) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 0x100000001b3ULL;
+    }
+    return uint32_t(hash ^ (hash >> 32));
+}
+
+glm::ivec2 regionOf(glm::ivec2 coords) {
+    return glm::ivec2(floorDiv(coords.x, ChunkStore::kRegionSize),
+                      floorDiv(coords.y, ChunkStore::kRegionSize));
+}
+
+size_t entryOf(glm::ivec2 coords) {
+    return floorMod(coords.x, ChunkStore::kRegionSize) +
+           floorMod(coords.y, ChunkStore::kRegionSize) *
+               ChunkStore::kRegionSize;
+}
+};  // namespace
+
+ChunkStore::ChunkStore(const std::string& directory, int seed,
+                       int smoothing)
+    : directory_(directory), seed_(seed), smoothing_(smoothing) {
+    std::error_code error;
+    std::filesystem::create_directories(directory_, error);
+    if (error)
+        std::cerr << "Could not create chunk store " << directory_ << ": "
+                  << error.message() << std::endl;
+}
+
+std::string ChunkStore::regionPath(glm::ivec2 region) const {
+    return directory_ + "/r." + std::to_string(region.x) + "." +
+           std::to_string(region.y);
+}
+
+ChunkStore::Table& ChunkStore::table(glm::ivec2 region) {
+    auto it = tables_.find(region);
+    if (it != tables_.end()) return it->second;
+    Table& entries = tables_[region];
+
+    std::ifstream in(regionPath(region), std::ios::in | std::ios::binary);
+    if (!in.is_open()) {
+        entries.assign(kEntries, Entry{0, 0, 0});
+        return entries;
+    }
+    Header header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || header.magic != kMagic || header.version != kVersion ||
+        header.region_size != uint32_t(kRegionSize)) {
+        std::cerr << regionPath(region) << " is not a region file"
+                  << std::endl;
+        return entries;
+    }
+    if (header.seed != seed_ || header.smoothing != smoothing_) {
+        std::cerr << regionPath(region) << " belongs to another world"
+                  << std::endl;
+        return entries;
+    }
+    if (header.generator != uint32_t(ChunkColumn::kGeneratorVersion)) {
+        std::cerr << regionPath(region) << " was generated by generator "
+                  << header.generator << ", not "
+                  << ChunkColumn::kGeneratorVersion << std::endl;
+        return entries;
+    }
+    entries.resize(kEntries);
+    in.read(reinterpret_cast<char*>(entries.data()),
+            sizeof(Entry) * entries.size());
+    if (!in) {
+        std::cerr << regionPath(region) << " is truncated" << std::endl;
+        entries.clear();
+    }
+    return entries;
+}
+
+bool ChunkStore::contains(glm::ivec2 coords) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Table& entries = table(regionOf(coords));
+    return !entries.empty() && entries[entryOf(coords)].size != 0;
+}
+
+bool ChunkStore::read(glm::ivec2 coords, ChunkColumn* column) {
+    TRACE_SCOPE("ChunkStore::read");
+    Entry entry;
+    std::vector<char> record;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const Table& entries = table(regionOf(coords));
+        if (entries.empty()) return false;
+        entry = entries[entryOf(coords)];
+        if (entry.size == 0) return false;
+        std::ifstream in(regionPath(regionOf(coords)),
+                         std::ios::in | std::ios::binary);
+        record.resize(entry.size);
+        in.seekg(entry.offset);
+        in.read(record.data(), record.size());
+        if (!in) return false;
+    }
+    const char* p = record.data();
+    const char* end = p + record.size();
+    if (checksum(record.data(), record.size()) != entry.checksum ||
+        !column->deserialize(&p, end) || p != end) {
+        std::cerr << "Chunk " << coords.x << ", " << coords.y << " in "
+                  << directory_ << " is damaged" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool ChunkStore::write(glm::ivec2 coords, const ChunkColumn& column) {
+    TRACE_SCOPE("ChunkStore::write");
+    std::vector<char> record;
+    column.serialize(&record);
+    Entry entry = {0, uint32_t(record.size()),
+                   checksum(record.data(), record.size())};
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    glm::ivec2 region = regionOf(coords);
+    Table& entries = table(region);
+    if (entries.empty()) return false;
+    std::string path = regionPath(region);
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!file.is_open()) {
+        // A new region: the header and an empty table.
+        Header header = {kMagic, kVersion, uint32_t(kRegionSize), seed_,
+                         smoothing_, uint32_t(ChunkColumn::kGeneratorVersion)};
+        std::ofstream out(path, std::ios::out | std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()),
+                  sizeof(Entry) * entries.size());
+        out.close();
+        file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+    }
+
+    // The record first, so the table never points at missing bytes.
+    file.seekp(0, std::ios::end);
+    entry.offset = file.tellp();
+    file.write(record.data(), record.size());
+    file.seekp(sizeof(Header) + sizeof(Entry) * entryOf(coords));
+    file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+    file.close();
+    if (!file) {
+        std::cerr << "Could not write chunk " << coords.x << ", " << coords.y
+                  << " to " << path << std::endl;
+        return false;
+    }
+    entries[entryOf(coords)] = entry;
+    bytes_written_ += record.size();
+    return true;
+}
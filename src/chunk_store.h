@@ -0,0 +1,73 @@
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtx/hash.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk_section.h"
+
+// Chunk columns kept on disk between sessions, so a world area generated
+// once (by tools/pregenerate, say) never has to be generated again.
+//
+// The store is a directory of region files, r.<x>.<z>, each holding up to
+// kRegionSize x kRegionSize chunks. A region file starts with a header,
+// which names the world's seed and smoothing and the
+// ChunkColumn::kGeneratorVersion the chunks were generated with, and a
+// table with the offset, size and
+// checksum of each chunk's record, or zeros for chunks not stored;
+// records are ChunkColumn::serialize() bytes appended after the table. A
+// record is written before its table entry, so an interrupted write loses
+// at most that chunk. Rewriting a chunk appends a new record and leaves
+// the old one behind as dead space.
+//
+// All methods may be called from any thread. Files are only touched under
+// one lock, but serialisation happens outside it.
+class ChunkStore {
+   public:
+    static const int kRegionSize = 16;
+
+    // Creates the directory if it does not exist. seed and smoothing are
+    // the world's, as given to BlockWorld; region files of other worlds or
+    // generator versions are not used, so their chunks are generated
+    // afresh and not stored.
+    ChunkStore(const std::string& directory, int seed, int smoothing = 0);
+
+    bool contains(glm::ivec2 coords);
+    // False if the chunk is not stored or its record is damaged.
+    bool read(glm::ivec2 coords, ChunkColumn* column);
+    bool write(glm::ivec2 coords, const ChunkColumn& column);
+
+    const std::string& directory() const { return directory_; }
+    // Record bytes written by this store so far.
+    uint64_t bytesWritten() const { return bytes_written_.load(); }
+
+   private:
+    struct Entry {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t checksum;
+    };
+    typedef std::vector<Entry> Table;
+
+    std::string regionPath(glm::ivec2 region) const;
+    // The region's table, read on first use: all zeros for a region not
+    // on disk yet, empty for a file that is not a region file of this
+    // world. Needs mutex_.
+    Table& table(glm::ivec2 region);
+
+    std::string directory_;
+    uint32_t seed_;
+    uint32_t smoothing_;
+    std::mutex mutex_;
+    std::unordered_map<glm::ivec2, Table> tables_;
+    std::atomic<uint64_t> bytes_written_{0};
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include "chunk_uploader.h"
+
+#include <cstdlib>
+#include <iostream>
+
+#include <debuggl.h>
+
+#include "trace.h"
+
+ChunkUploader::ChunkUploader(std::function<void()> attach,
+                             std::function<void()> detach, size_t queue_size)
+    : attach_(std::move(attach)),
+      detach_(std::move(detach)),
+      requests_(queue_size),
+      results_(queue_size),
+      recycled_(queue_size),
+      max_buffers_(queue_size),
+      thread_([this]() { run(); }) {}
+
+ChunkUploader::~ChunkUploader() { stop(); }
+
+bool ChunkUploader::push(int slot, uint64_t generation, Instances instances) {
+    Request request;
+    request.slot = slot;
+    request.generation = generation;
+    request.instances = std::move(instances);
+    if (!requests_.push(std::move(request))) return false;
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        work_ = true;
+    }
+    wake_.notify_one();
+    return true;
+}
+
+bool ChunkUploader::poll(Staged* staged) {
+    Staged next;
+    while (results_.pop(&next)) arrived_.push_back(next);
+    if (arrived_.empty()) return false;
+    // Uploads finish in order, so only the oldest needs checking.
+    GLenum status =
+        glClientWaitSync(arrived_.front().fence, 0, /* timeout */ 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return false;
+    *staged = arrived_.front();
+    arrived_.pop_front();
+    glDeleteSync(staged->fence);
+    staged->fence = 0;
+    return true;
+}
+
+void ChunkUploader::recycle(GLuint buffer) {
+    Recycled recycled;
+    recycled.buffer = buffer;
+    recycled.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // The upload thread waits for the fence, so it must reach the GPU.
+    glFlush();
+    recycled_.push(std::move(recycled));
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        work_ = true;
+    }
+    wake_.notify_one();
+}
+
+void ChunkUploader::stop() {
+    if (!thread_.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+
+    Staged staged;
+    while (results_.pop(&staged)) arrived_.push_back(staged);
+    for (const Staged& pending : arrived_) glDeleteSync(pending.fence);
+    arrived_.clear();
+    Recycled recycled;
+    while (recycled_.pop(&recycled)) free_.push_back(recycled);
+    for (const Recycled& spare : free_) glDeleteSync(spare.fence);
+    free_.clear();
+    // Shared objects can be deleted from either context.
+    if (!owned_.empty()) glDeleteBuffers(owned_.size(), owned_.data());
+    owned_.clear();
+    sizes_.clear();
+    staging_bytes_.set(0);
+}
+
+void ChunkUploader::run() {
+    TRACE_THREAD("upload");
+    attach_();
+    Request request;
+    while (true) {
+        Recycled recycled;
+        while (recycled_.pop(&recycled)) free_.push_back(recycled);
+        // With every buffer in flight, wait for one to come back.
+        bool busy = false;
+        while ((!free_.empty() || owned_.size() < max_buffers_) &&
+               requests_.pop(&request)) {
+            upload(request);
+            busy = true;
+        }
+        if (busy) continue;
+
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        wake_.wait(lock, [this]() { return work_ || stop_; });
+        work_ = false;
+        if (stop_) break;
+    }
+    detach_();
+}
+
+void ChunkUploader::upload(Request& request) {
+    TRACE_SCOPE("ChunkUploader::upload");
+    GLuint buffer;
+    if (free_.empty()) {
+        CHECK_GL_ERROR(glGenBuffers(1, &buffer));
+        owned_.push_back(buffer);
+    } else {
+        // Makes the GPU, not this thread, wait for the last copy out of
+        // the buffer; it has usually finished long ago.
+        buffer = free_.back().buffer;
+        CHECK_GL_ERROR(glWaitSync(free_.back().fence, 0, GL_TIMEOUT_IGNORED));
+        glDeleteSync(free_.back().fence);
+        free_.pop_back();
+    }
+    const auto& instances = *request.instances;
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_WRITE_BUFFER, buffer));
+    CHECK_GL_ERROR(glBufferData(GL_COPY_WRITE_BUFFER,
+                                sizeof(glm::vec3) * instances.size(),
+                                instances.data(), GL_STREAM_COPY));
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    size_t& size = sizes_[buffer];
+    staging_bytes_.set(staging_bytes_.bytes() - size +
+                       sizeof(glm::vec3) * instances.size());
+    size = sizeof(glm::vec3) * instances.size();
+
+    Staged staged;
+    staged.slot = request.slot;
+    staged.generation = request.generation;
+    staged.buffer = buffer;
+    staged.count = instances.size();
+    staged.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Without a flush the fence might never reach the GPU, and the render
+    // thread would wait for it forever.
+    glFlush();
+    request.instances.reset();
+    results_.push(std::move(staged));
+}
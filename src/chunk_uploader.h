@@ -0,0 +1,111 @@
+#ifndef CHUNK_UPLOADER_H
+#define CHUNK_UPLOADER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "memory_tracker.h"
+#include "spsc_queue.h"
+
+// Copies chunk instances to the GPU on a thread of its own, so the render
+// thread never waits while the driver takes in a chunk's data.
+//
+// The upload thread owns a GL context that shares objects with the render
+// context. It writes each chunk into a staging buffer of its own, places
+// a fence behind the write and hands the buffer back; the render thread
+// only takes buffers whose fence has signalled, copies them into place
+// with glCopyBufferSubData, which stays on the GPU, and recycles them.
+// Work and results travel through lock-free single-producer,
+// single-consumer queues in both directions; a condition variable only
+// wakes the upload thread when there is work.
+class ChunkUploader {
+   public:
+    typedef std::shared_ptr<
+        const TrackedVector<glm::vec3, MemoryTag::kMeshes>>
+        Instances;
+
+    // An upload that is complete on the GPU.
+    struct Staged {
+        int slot = 0;
+        uint64_t generation = 0;
+        GLuint buffer = 0;  // count vec3s, for recycle() once copied
+        size_t count = 0;
+        GLsync fence = 0;
+    };
+
+    // attach makes the shared context current on the calling thread and
+    // detach releases it; both run on the upload thread. queue_size bounds
+    // the uploads in flight.
+    ChunkUploader(std::function<void()> attach, std::function<void()> detach,
+                  size_t queue_size = 256);
+    // Stops the thread; see stop().
+    ~ChunkUploader();
+
+    ChunkUploader(const ChunkUploader&) = delete;
+    ChunkUploader& operator=(const ChunkUploader&) = delete;
+
+    // The rest is for the render thread, with its context current.
+
+    // Queues a slot's instances; the tag (slot, generation) comes back
+    // with the upload. False if the queue is full.
+    bool push(int slot, uint64_t generation, Instances instances);
+    // The next upload, in order, once its fence has signalled.
+    bool poll(Staged* staged);
+    // Returns a staging buffer once its copy has been issued. A fence
+    // behind the copy keeps the upload thread from reusing the buffer
+    // before the GPU has read it.
+    void recycle(GLuint buffer);
+    // Joins the upload thread and frees every staging buffer and fence.
+    void stop();
+
+   private:
+    struct Request {
+        int slot = 0;
+        uint64_t generation = 0;
+        Instances instances;
+    };
+
+    struct Recycled {
+        GLuint buffer = 0;
+        GLsync fence = 0;  // behind the render thread's copy
+    };
+
+    void run();
+    void upload(Request& request);
+
+    std::function<void()> attach_;
+    std::function<void()> detach_;
+
+    SpscQueue<Request> requests_;
+    SpscQueue<Staged> results_;
+    SpscQueue<Recycled> recycled_;
+    std::deque<Staged> arrived_;  // popped but not signalled yet
+
+    // Only for sleeping and waking; the queues need no lock.
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    bool work_ = false;
+    std::atomic<bool> stop_{false};
+
+    // Staging buffers, upload thread only until stop(). There are never
+    // more than the queue size, so results_ and recycled_ cannot fill up.
+    size_t max_buffers_;
+    std::vector<Recycled> free_;
+    std::vector<GLuint> owned_;  // every staging buffer ever made
+    std::unordered_map<GLuint, size_t> sizes_;  // bytes, by buffer
+    TrackedBytes staging_bytes_{MemoryTag::kGpuBuffers};
+    std::thread thread_;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "dynamic_resolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include <debuggl.h>
+
+namespace {
+// The scale aims for this share of the target, leaving room for spikes.
+const double kHeadroom = 0.9;
+// Weight of the newest frame in the averaged GPU time.
+const double kSmoothing = 0.2;
+// How far each measurement moves the scale towards the one it asks for.
+const float kRate = 0.25f;
+// Smaller changes of scale are not worth a reallocation, except to reach
+// a limit.
+const float kMinStep = 0.05f;
+};  // namespace
+
+DynamicResolution::DynamicResolution() : DynamicResolution(Options()) {}
+
+DynamicResolution::DynamicResolution(const Options& options)
+    : options_(options),
+      scale_(options.max_scale),
+      timer_(GL_TIME_ELAPSED) {}
+
+void DynamicResolution::setup() {
+    GLint max_samples = 1;
+    CHECK_GL_ERROR(glGetIntegerv(GL_MAX_SAMPLES, &max_samples));
+    samples_ = std::max(1, std::min(options_.samples, int(max_samples)));
+    CHECK_GL_ERROR(glGenFramebuffers(1, &scene_framebuffer_));
+    CHECK_GL_ERROR(glGenFramebuffers(1, &resolve_framebuffer_));
+    CHECK_GL_ERROR(glGenRenderbuffers(3, renderbuffers_));
+    timer_.setup();
+}
+
+void DynamicResolution::release() {
+    GLuint framebuffers[] = {scene_framebuffer_, resolve_framebuffer_};
+    glDeleteFramebuffers(2, framebuffers);
+    glDeleteRenderbuffers(3, renderbuffers_);
+    scene_framebuffer_ = resolve_framebuffer_ = 0;
+    std::fill(renderbuffers_, renderbuffers_ + 3, 0);
+    width_ = height_ = 0;
+    renderbuffer_bytes_.set(0);
+    timer_.release();
+}
+
+void DynamicResolution::begin(int window_width, int window_height) {
+    window_width_ = std::max(window_width, 1);
+    window_height_ = std::max(window_height, 1);
+    if (!enabled_) scale_ = options_.max_scale;
+    int width = std::max(1, int(std::lround(window_width_ * scale_)));
+    int height = std::max(1, int(std::lround(window_height_ * scale_)));
+    if (width != width_ || height != height_) allocate(width, height);
+
+    timer_.begin();
+    CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer_));
+    glViewport(0, 0, width_, height_);
+}
+
+void DynamicResolution::allocate(int width, int height) {
+    width_ = width;
+    height_ = height;
+    CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers_[0]));
+    CHECK_GL_ERROR(glRenderbufferStorageMultisample(
+        GL_RENDERBUFFER, samples_ > 1 ? samples_ : 0, GL_RGBA8, width_,
+        height_));
+    CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers_[1]));
+    CHECK_GL_ERROR(glRenderbufferStorageMultisample(
+        GL_RENDERBUFFER, samples_ > 1 ? samples_ : 0, GL_DEPTH_COMPONENT24,
+        width_, height_));
+    CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer_));
+    CHECK_GL_ERROR(glFramebufferRenderbuffer(GL_FRAMEBUFFER,
+                                             GL_COLOR_ATTACHMENT0,
+                                             GL_RENDERBUFFER,
+                                             renderbuffers_[0]));
+    CHECK_GL_ERROR(glFramebufferRenderbuffer(GL_FRAMEBUFFER,
+                                             GL_DEPTH_ATTACHMENT,
+                                             GL_RENDERBUFFER,
+                                             renderbuffers_[1]));
+    CHECK_SUCCESS(glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+                  GL_FRAMEBUFFER_COMPLETE);
+
+    // Multisampled pixels cannot be scaled in the blit that resolves
+    // them, so they are resolved at their own size first.
+    CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers_[2]));
+    CHECK_GL_ERROR(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width_,
+                                         height_));
+    CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, resolve_framebuffer_));
+    CHECK_GL_ERROR(glFramebufferRenderbuffer(GL_FRAMEBUFFER,
+                                             GL_COLOR_ATTACHMENT0,
+                                             GL_RENDERBUFFER,
+                                             renderbuffers_[2]));
+    CHECK_SUCCESS(glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+                  GL_FRAMEBUFFER_COMPLETE);
+    CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, 0));
+    // Four bytes a sample for colour and for depth, four a resolved pixel.
+    renderbuffer_bytes_.set(size_t(width_) * height_ *
+                            (8 * std::max(samples_, 1) + 4));
+}
+
+void DynamicResolution::end() {
+    GLuint source = scene_framebuffer_;
+    bool scaled = width_ != window_width_ || height_ != window_height_;
+    if (samples_ > 1 && scaled) {
+        CHECK_GL_ERROR(glBindFramebuffer(GL_READ_FRAMEBUFFER, source));
+        CHECK_GL_ERROR(
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolve_framebuffer_));
+        CHECK_GL_ERROR(glBlitFramebuffer(0, 0, width_, height_, 0, 0, width_,
+                                         height_, GL_COLOR_BUFFER_BIT,
+                                         GL_NEAREST));
+        source = resolve_framebuffer_;
+    }
+    CHECK_GL_ERROR(glBindFramebuffer(GL_READ_FRAMEBUFFER, source));
+    CHECK_GL_ERROR(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0));
+    CHECK_GL_ERROR(glBlitFramebuffer(0, 0, width_, height_, 0, 0,
+                                     window_width_, window_height_,
+                                     GL_COLOR_BUFFER_BIT,
+                                     scaled ? GL_LINEAR : GL_NEAREST));
+    CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    glViewport(0, 0, window_width_, window_height_);
+
+    if (timer_.end()) adjust();
+}
+
+void DynamicResolution::adjust() {
+    // Averaged over a few frames, as single frames can be far off.
+    double ms = timer_.result() * 1e-6;
+    gpu_ms_ = gpu_ms_ > 0.0 ? gpu_ms_ + (ms - gpu_ms_) * kSmoothing : ms;
+    if (!enabled_ || gpu_ms_ <= 0.0) return;
+    // The cost is taken to follow the pixel count, the square of the
+    // scale.
+    float wanted = scale_ * std::sqrt(options_.target_ms * kHeadroom /
+                                      gpu_ms_);
+    wanted = std::min(options_.max_scale, std::max(options_.min_scale, wanted));
+    float error = wanted - scale_;
+    if (std::fabs(error) < kMinStep && wanted != options_.min_scale &&
+        wanted != options_.max_scale)
+        return;
+    // Part of the way, but never a step too small to be worth it.
+    float step = error * kRate;
+    if (std::fabs(step) < kMinStep)
+        step = std::fabs(error) < kMinStep ? error
+                                           : std::copysign(kMinStep, error);
+    scale_ += step;
+}
@@ -0,0 +1,74 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <GL/glew.h>
+
+#include "gpu_counter.h"
+#include "memory_tracker.h"
+
+// Renders the scene into an offscreen target whose resolution follows the
+// GPU's frame time, so slow machines trade sharpness for a steady frame
+// rate instead of dropping frames.
+//
+// The target is multisampled; end() resolves it and scales it up into the
+// window with linear filtering (in one blit when no scaling is needed).
+// Each frame's GPU time comes back a frame or two later from a timer
+// query; against their running average, the scale moves part of the way
+// towards the one that would meet the target, assuming the cost follows
+// the pixel count. Small changes are ignored, since each one reallocates
+// the target.
+class DynamicResolution {
+   public:
+    struct Options {
+        double target_ms = 16.6;  // GPU time per frame to hold
+        float min_scale = 0.5f;   // of the window's width and height
+        float max_scale = 1.0f;
+        int samples = 4;  // per pixel; clamped to GL_MAX_SAMPLES
+    };
+
+    DynamicResolution();
+    explicit DynamicResolution(const Options& options);
+
+    // Requires the GL context.
+    void setup();
+    void release();
+
+    // Binds the target, sized for this frame, and sets the viewport to
+    // it. Call before clearing.
+    void begin(int window_width, int window_height);
+    // Resolves and upscales into the default framebuffer, which is left
+    // bound for both reading and drawing.
+    void end();
+
+    // Fixed at max_scale while disabled.
+    void setEnabled(bool enabled) { enabled_ = enabled; }
+    bool enabled() const { return enabled_; }
+
+    float scale() const { return scale_; }
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int samples() const { return samples_; }
+    // The GPU frame time, averaged over the last few measurements.
+    double gpuMs() const { return gpu_ms_; }
+
+   private:
+    void adjust();
+    void allocate(int width, int height);
+
+    Options options_;
+    bool enabled_ = true;
+    float scale_;
+    int samples_ = 1;
+    int width_ = 0, height_ = 0;
+    int window_width_ = 0, window_height_ = 0;
+    double gpu_ms_ = 0.0;
+
+    GLuint scene_framebuffer_ = 0;  // multisampled colour and depth
+    GLuint resolve_framebuffer_ = 0;
+    GLuint renderbuffers_[3] = {};  // scene colour, scene depth, resolved
+    // Estimated: drivers may pad or compress.
+    TrackedBytes renderbuffer_bytes_{MemoryTag::kGpuBuffers};
+    GpuCounter timer_;
+};
+
+#endif
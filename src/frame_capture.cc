@@ -0,0 +1,231 @@
+#include "frame_capture.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include <debuggl.h>
+
+namespace {
+std::string timestamp() {
+    char buffer[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(buffer, sizeof(buffer), "%Y%m%d-%H%M%S",
+                  std::localtime(&now));
+    return buffer;
+}
+};  // namespace
+
+FrameCapture::FrameCapture() : FrameCapture(Options()) {}
+
+FrameCapture::FrameCapture(const Options& options)
+    : options_(options),
+      ring_(std::max(options.ring_size, 1)),
+      encoders_(std::max<size_t>(options.encoder_threads, 1)) {}
+
+FrameCapture::~FrameCapture() {
+    // GL objects are released explicitly while the context is alive; here we
+    // only let the encoders drain whatever is already queued.
+    encoders_.wait();
+}
+
+void FrameCapture::screenshot() { screenshot_pending_ = true; }
+
+void FrameCapture::startRecording() {
+    if (recording_) return;
+    sequence_prefix_ = options_.directory + "/capture-" + timestamp() + "-";
+    sequence_frame_ = 0;
+    captured_ = 0;
+    dropped_ = 0;
+    encoded_ = 0;
+    recording_ = true;
+    std::cout << "Recording to " << sequence_prefix_ << "%06d.jpg"
+              << std::endl;
+}
+
+void FrameCapture::stopRecording() {
+    if (!recording_) return;
+    recording_ = false;
+    std::cout << "Recording stopped: " << captured_ << " frames captured, "
+              << dropped_ << " dropped" << std::endl;
+}
+
+void FrameCapture::endFrame(int width, int height) {
+    if (ring_[0].pbo == 0) {
+        for (auto& slot : ring_) CHECK_GL_ERROR(glGenBuffers(1, &slot.pbo));
+    }
+
+    // Hand every readback that has completed to the encoders.
+    collect(false);
+
+    if (!screenshot_pending_ && !recording_) return;
+    if (width <= 0 || height <= 0) return;
+
+    Slot& slot = ring_[next_slot_];
+    if (slot.busy) {
+        // Every PBO is still waiting on the GPU.
+        if (options_.drop_policy == DropPolicy::kBlock) collect(true);
+        // Still busy if even that wait gave up. A pending screenshot simply
+        // retries next frame.
+        if (slot.busy) {
+            if (recording_) dropped_++;
+            return;
+        }
+    }
+
+    std::string filename;
+    if (screenshot_pending_) {
+        filename = options_.directory + "/screenshot-" + timestamp() + "-" +
+                   std::to_string(screenshot_count_++) + ".jpg";
+        screenshot_pending_ = false;
+    } else {
+        char index[16];
+        std::snprintf(index, sizeof(index), "%06zu", sequence_frame_++);
+        filename = sequence_prefix_ + index + ".jpg";
+    }
+
+    size_t bytes = size_t(width) * size_t(height) * 3;
+    CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo));
+    if (slot.capacity < bytes) {
+        CHECK_GL_ERROR(glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr,
+                                    GL_STREAM_READ));
+        pbo_bytes_.set(pbo_bytes_.bytes() - slot.capacity + bytes);
+        slot.capacity = bytes;
+    }
+    CHECK_GL_ERROR(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+    CHECK_GL_ERROR(
+        glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, 0));
+    CHECK_GL_ERROR(slot.fence =
+                       glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+    CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+    slot.width = width;
+    slot.height = height;
+    slot.filename = std::move(filename);
+    slot.busy = true;
+    next_slot_ = (next_slot_ + 1) % ring_.size();
+    captured_++;
+}
+
+void FrameCapture::collect(bool wait_all) {
+    while (ring_[oldest_slot_].busy) {
+        Slot& slot = ring_[oldest_slot_];
+        GLenum status = glClientWaitSync(
+            slot.fence, wait_all ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+            wait_all ? GLuint64(1000000000) : GLuint64(0));
+        // Slots complete in submission order, so stop at the first one that
+        // is still in flight, or whose wait failed.
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        resolve(slot);
+        oldest_slot_ = (oldest_slot_ + 1) % ring_.size();
+    }
+}
+
+void FrameCapture::resolve(Slot& slot) {
+    size_t bytes = size_t(slot.width) * size_t(slot.height) * 3;
+    CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo));
+    const void* data = nullptr;
+    CHECK_GL_ERROR(data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes,
+                                           GL_MAP_READ_BIT));
+    if (data != nullptr) {
+        Frame frame;
+        frame.width = slot.width;
+        frame.height = slot.height;
+        frame.filename = std::move(slot.filename);
+        frame.pixels = takeBuffer(bytes);
+        std::memcpy(frame.pixels.data(), data, bytes);
+        CHECK_GL_ERROR(glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+        enqueue(std::move(frame));
+    } else {
+        std::cerr << "FrameCapture: could not map " << slot.filename
+                  << std::endl;
+    }
+    CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    slot.busy = false;
+}
+
+void FrameCapture::enqueue(Frame&& frame) {
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        if (queue_.size() >= options_.max_queued) {
+            switch (options_.drop_policy) {
+                case DropPolicy::kDropNewest:
+                    dropped_++;
+                    spare_buffers_.push_back(std::move(frame.pixels));
+                    return;
+                case DropPolicy::kDropOldest:
+                    dropped_++;
+                    spare_buffers_.push_back(
+                        std::move(queue_.front().pixels));
+                    queue_.pop_front();
+                    break;
+                case DropPolicy::kBlock:
+                    queue_space_.wait(lock, [this]() {
+                        return queue_.size() < options_.max_queued;
+                    });
+                    break;
+            }
+        }
+        queue_.push_back(std::move(frame));
+    }
+    // One job per queued frame; a job whose frame was dropped finds the
+    // queue empty and returns.
+    encoders_.submit([this]() { encodeNext(); });
+}
+
+void FrameCapture::encodeNext() {
+    Frame frame;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (queue_.empty()) return;
+        frame = std::move(queue_.front());
+        queue_.pop_front();
+    }
+    queue_space_.notify_one();
+
+    if (SaveJPEG(frame.filename, frame.width, frame.height,
+                 frame.pixels.data(), options_.jpeg)) {
+        encoded_++;
+    } else {
+        std::cerr << "FrameCapture: could not write " << frame.filename
+                  << std::endl;
+    }
+
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    if (spare_buffers_.size() < options_.max_queued)
+        spare_buffers_.push_back(std::move(frame.pixels));
+}
+
+FrameCapture::Pixels FrameCapture::takeBuffer(size_t bytes) {
+    Pixels buffer;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (!spare_buffers_.empty()) {
+            buffer = std::move(spare_buffers_.back());
+            spare_buffers_.pop_back();
+        }
+    }
+    buffer.resize(bytes);
+    return buffer;
+}
+
+void FrameCapture::flush() {
+    collect(true);
+    encoders_.wait();
+}
+
+void FrameCapture::release() {
+    for (auto& slot : ring_) {
+        if (slot.fence != nullptr) glDeleteSync(slot.fence);
+        if (slot.pbo != 0) glDeleteBuffers(1, &slot.pbo);
+        slot = Slot();
+    }
+    next_slot_ = 0;
+    oldest_slot_ = 0;
+    pbo_bytes_.set(0);
+}
@@ -0,0 +1,120 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <GL/glew.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <jpegio.h>
+
+#include "memory_tracker.h"
+#include "thread_pool.h"
+
+// Asynchronous screenshot / frame sequence capture.
+//
+// Frames are read back into a ring of pixel buffer objects so glReadPixels
+// returns immediately; a PBO is only mapped once its fence has signalled
+// (normally one or two frames later). The mapped pixels are copied out and
+// handed to a small pool of encoder threads that write JPEGs, so neither the
+// readback nor the encode ever blocks the render loop.
+class FrameCapture {
+   public:
+    // What to do when the encoders fall behind and the queue is full.
+    enum class DropPolicy {
+        kDropNewest,  // discard the frame that was just read back
+        kDropOldest,  // discard the oldest frame still waiting to be encoded
+        kBlock,       // stall the render thread until there is room
+    };
+
+    struct Options {
+        int ring_size = 3;        // PBOs in flight
+        size_t max_queued = 8;    // frames waiting for an encoder
+        size_t encoder_threads = 2;
+        DropPolicy drop_policy = DropPolicy::kDropOldest;
+        std::string directory = ".";
+        JPEGOptions jpeg;
+
+        Options() { jpeg.quality = 90; }
+    };
+
+    FrameCapture();
+    explicit FrameCapture(const Options& options);
+    ~FrameCapture();
+
+    // Capture the next frame to a single screenshot file.
+    void screenshot();
+    // Capture every frame as a numbered image sequence (e.g. for ffmpeg).
+    void startRecording();
+    void stopRecording();
+    bool recording() const { return recording_; }
+
+    // Call once per frame after the scene has been drawn and before the
+    // buffers are swapped. Requires the GL context to be current.
+    void endFrame(int width, int height);
+
+    // Reads back every outstanding PBO and waits for the encoders to finish.
+    void flush();
+    // Frees the GL objects. Must be called while the context is current.
+    void release();
+
+    size_t captured() const { return captured_; }
+    size_t dropped() const { return dropped_; }
+    size_t encoded() const { return encoded_; }
+
+   private:
+    typedef TrackedVector<unsigned char, MemoryTag::kImages> Pixels;
+
+    struct Slot {
+        GLuint pbo = 0;
+        GLsync fence = nullptr;
+        size_t capacity = 0;
+        int width = 0;
+        int height = 0;
+        std::string filename;
+        bool busy = false;
+    };
+
+    struct Frame {
+        int width;
+        int height;
+        std::string filename;
+        Pixels pixels;
+    };
+
+    void collect(bool wait_all);
+    void resolve(Slot& slot);
+    void enqueue(Frame&& frame);
+    void encodeNext();
+    Pixels takeBuffer(size_t bytes);
+
+    Options options_;
+    std::vector<Slot> ring_;
+    size_t next_slot_ = 0;   // slot the next readback goes into
+    size_t oldest_slot_ = 0;  // oldest slot still waiting on its fence
+    TrackedBytes pbo_bytes_{MemoryTag::kGpuBuffers};  // of the whole ring
+
+    bool screenshot_pending_ = false;
+    bool recording_ = false;
+    std::string sequence_prefix_;
+    size_t sequence_frame_ = 0;
+    size_t screenshot_count_ = 0;
+
+    std::mutex queue_mutex_;
+    std::condition_variable queue_space_;
+    std::deque<Frame> queue_;
+    std::vector<Pixels> spare_buffers_;
+
+    std::atomic<size_t> captured_{0};
+    std::atomic<size_t> dropped_{0};
+    std::atomic<size_t> encoded_{0};
+
+    // Declared last so the encoders are joined before the queue goes away.
+    ThreadPool encoders_;
+};
+
+#endif
@@ -0,0 +1,26 @@
+#include "frustum.h"
+
+Frustum::Frustum(const glm::mat4& m) {
+    // Gribb & Hartmann: each plane is the fourth row of the matrix plus or
+    // minus one of the other rows.
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; i++)
+        row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    planes_[0] = row[3] + row[0];  // left
+    planes_[1] = row[3] - row[0];  // right
+    planes_[2] = row[3] + row[1];  // bottom
+    planes_[3] = row[3] - row[1];  // top
+    planes_[4] = row[3] + row[2];  // near
+    planes_[5] = row[3] - row[2];  // far
+    for (auto& plane : planes_) plane /= glm::length(glm::vec3(plane));
+}
+
+bool Frustum::intersects(const glm::vec3& lo, const glm::vec3& hi) const {
+    for (const auto& plane : planes_) {
+        // The box corner furthest along the plane normal.
+        glm::vec3 p(plane.x >= 0 ? hi.x : lo.x, plane.y >= 0 ? hi.y : lo.y,
+                    plane.z >= 0 ? hi.z : lo.z);
+        if (glm::dot(glm::vec3(plane), p) + plane.w < 0) return false;
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+// View frustum planes extracted from a projection * view matrix, for
+// conservative box culling on the CPU.
+class Frustum {
+   public:
+    Frustum() {}
+    explicit Frustum(const glm::mat4& view_projection);
+
+    // False only if the box is entirely outside one of the planes.
+    bool intersects(const glm::vec3& lo, const glm::vec3& hi) const;
+
+    // Planes as (normal, distance) with normals pointing inwards.
+    const glm::vec4& plane(int i) const { return planes_[i]; }
+
+   private:
+    glm::vec4 planes_[6];
+};
+
+#endif
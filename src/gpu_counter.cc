@@ -0,0 +1,48 @@
+#include "gpu_counter.h"
+
+#include <cstdlib>
+#include <iostream>
+
+#include <debuggl.h>
+
+void GpuCounter::setup() {
+    CHECK_GL_ERROR(glGenQueries(kQueries, queries_));
+}
+
+void GpuCounter::release() {
+    glDeleteQueries(kQueries, queries_);
+    next_ = pending_ = 0;
+}
+
+void GpuCounter::begin() {
+    // Only if the GPU is a whole ring of frames behind.
+    if (pending_ == kQueries) collect(true);
+    CHECK_GL_ERROR(glBeginQuery(target_, queries_[next_]));
+}
+
+bool GpuCounter::end() {
+    CHECK_GL_ERROR(glEndQuery(target_));
+    next_ = (next_ + 1) % kQueries;
+    pending_++;
+    return collect(false);
+}
+
+// Reads the answered queries, oldest first; with wait, at least the
+// oldest one. Returns whether any was read.
+bool GpuCounter::collect(bool wait) {
+    bool read = false;
+    while (pending_ > 0) {
+        GLuint query = queries_[(next_ - pending_ + kQueries) % kQueries];
+        GLuint available = GL_FALSE;
+        CHECK_GL_ERROR(glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE,
+                                           &available));
+        if (!available && !wait) break;
+        GLuint64 result = 0;
+        CHECK_GL_ERROR(glGetQueryObjectui64v(query, GL_QUERY_RESULT, &result));
+        result_ = result;
+        pending_--;
+        wait = false;
+        read = true;
+    }
+    return read;
+}
@@ -0,0 +1,42 @@
+#ifndef GPU_COUNTER_H
+#define GPU_COUNTER_H
+
+#include <GL/glew.h>
+
+#include <cstdint>
+
+// Measures what the GPU does between begin() and end() with one kind of
+// query: GL_SAMPLES_PASSED counts the samples that pass the depth test,
+// which with early depth testing are the fragments a pass shades, and
+// GL_TIME_ELAPSED the nanoseconds the GPU spends on it.
+//
+// Queries rotate through a small ring and are only read once the GPU has
+// answered them, so measuring never stalls the frame; results lag a frame
+// or two behind.
+class GpuCounter {
+   public:
+    explicit GpuCounter(GLenum target) : target_(target) {}
+
+    // Requires the GL context.
+    void setup();
+    void release();
+
+    void begin();
+    // Returns whether result() has changed, i.e. an earlier query has
+    // been answered.
+    bool end();
+    // The latest answer; 0 until there is one.
+    uint64_t result() const { return result_; }
+
+   private:
+    bool collect(bool wait);
+
+    static const int kQueries = 4;
+    GLenum target_;
+    GLuint queries_[kQueries] = {};
+    int next_ = 0;     // the query begin() starts
+    int pending_ = 0;  // ended but not read yet
+    uint64_t result_ = 0;
+};
+
+#endif
@@ -1,8 +1,11 @@
 #include <algorithm>
-#include <fstream>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
 #include <iostream>
 #include <memory>
 #include <random>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -14,41 +17,53 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <debuggl.h>
+#include "block_textures.h"
+#include "block_world.h"
 #include "camera.h"
+#include "chunk_mesher.h"
+#include "chunk_renderer.h"
+#include "chunk_store.h"
+#include "chunk_uploader.h"
 #include "cube.cc"
+#include "dynamic_resolution.h"
+#include "frame_capture.h"
+#include "gpu_counter.h"
+#include "menger.h"
+#include "memory_tracker.h"
+#include "menger_renderer.h"
+#include "mesh_export.h"
+#include "occlusion_culler.h"
+#include "region_export.h"
+#include "shader_cache.h"
+#include "simulation.h"
+#include "task_scheduler.h"
 // #include "perlin.h"
 #include "terrain.h"
+#include "trace.h"
 
 int window_width = 800, window_height = 600;
 
-constexpr unsigned int cubes = 50000;
-
-// VBO and VAO descriptors.
-enum { kVertexBuffer, kIndexBuffer, kNumVbos };
-
-// These are our VAOs.
-enum { kGeometryVao, kNumVaos };
-
-GLuint g_array_objects[kNumVaos];  // This will store the VAO descriptors.
-GLuint g_buffer_objects[kNumVaos]
-                       [kNumVbos];  // These will store VBO descriptors.
-
 // C++ 11 String Literal
 // See http://en.cppreference.com/w/cpp/language/string_literal
 const char* vertex_shader =
     R"zzz(#version 330 core
 layout(location = 0) in vec4 vertex_position;
-layout(location = 1) in vec3 cube_offset;
+layout(location = 1) in vec4 cube_offset;
 uniform mat4 view;
 uniform vec4 light_position;
 
 out vec4 vs_light_direction;
 out vec4 vs_world_pos;
 out vec4 pos;
+// The depth pre-pass and the colour pass link this into separate
+// programs; both must compute bit-identical depth for GL_LEQUAL to pass.
+invariant gl_Position;
 
 void main()
 {
-    pos = vertex_position + vec4(cube_offset, 0.0);
+    // xyz translates the instance and w scales it; the terrain's vec3
+    // offsets leave w at its default of 1.
+    pos = vec4(vertex_position.xyz * cube_offset.w + cube_offset.xyz, 1.0);
     vs_world_pos = vertex_position;
 	gl_Position = view * pos;
 	vs_light_direction = view * (vertex_position - light_position);
@@ -73,6 +88,7 @@ in vec4 vs_world_pos[];
 
 out vec4 light_direction;
 out vec4 world_position;
+invariant gl_Position;  // as in the vertex shader
 void main()
 {
 
@@ -99,6 +115,8 @@ flat in vec4 world_norm;
 in vec4 world_position;
 in vec4 light_direction;
 uniform mat4 view;
+uniform sampler2DArray block_textures;
+uniform int textures_ready;
 
 out vec4 fragment_color;
 
@@ -148,20 +166,31 @@ void main()
     // int smooth = 1;
 
     vec4 baseCol;
+    int layer;
     if(world_position.y < .125){
         baseCol = vec4(0.1,0.4,0.8,1.0);
+        layer = 0;
         pixely = 2;
         smooths = 16;
     }
     else if(world_position.y < 10.025){
         baseCol = vec4(0.3,0.8,0.15,1.0);
+        layer = 1;
     }else{
         baseCol = vec4(0.7,0.7,0.7,1.0);
+        layer = 2;
     }
-  
-    float col = noise(floor(world_position.xyz * pixely)/smooths);
 
-    fragment_color = 0.4 * (col * baseCol) + 0.6 * (baseCol); 
+    if((textures_ready & (1 << layer)) != 0){
+        // Project the texture along the dominant axis of the face.
+        vec3 n = abs(normal.xyz);
+        vec2 uv = n.y > 0.5 ? world_position.xz
+                : (n.x > 0.5 ? world_position.zy : world_position.xy);
+        fragment_color = texture(block_textures, vec3(uv, layer));
+    }else{
+        float col = noise(floor(world_position.xyz * pixely)/smooths);
+        fragment_color = 0.4 * (col * baseCol) + 0.6 * (baseCol);
+    }
     fragment_color += vec4(0.15,0.15,0.15, 0.0);
 
     float dot_nl = dot(normalize(light_direction), view * normalize(normal));
@@ -171,6 +200,25 @@ void main()
 }
 )zzz";
 
+// Terrain passes without the shading: depth only for the pre-pass, and a
+// fixed colour that blending adds up per shaded fragment, so brightness
+// shows overdraw (full red is eight layers).
+const char* depth_fragment_shader =
+    R"zzz(#version 330 core
+void main()
+{
+}
+)zzz";
+
+const char* overdraw_fragment_shader =
+    R"zzz(#version 330 core
+out vec4 fragment_color;
+void main()
+{
+    fragment_color = vec4(0.125, 0.05, 0.02, 1.0);
+}
+)zzz";
+
 void CreateTriangle(std::vector<glm::vec4>& vertices,
                     std::vector<glm::uvec3>& indices) {
     vertices.push_back(glm::vec4(-0.5f, -0.5f, -0.5f, 1.0f));
@@ -179,44 +227,76 @@ void CreateTriangle(std::vector<glm::vec4>& vertices,
     indices.push_back(glm::uvec3(0, 1, 2));
 }
 
-std::string readFile(const char* filePath) {
-    std::string content;
-    std::ifstream fileStream(filePath, std::ios::in);
-
-    if (!fileStream.is_open()) {
-        std::cerr << "Could not read file " << filePath
-                  << ". File does not exist." << std::endl;
-        return "";
-    }
-
-    std::string line = "";
-    while (!fileStream.eof()) {
-        std::getline(fileStream, line);
-        content.append(line + "\n");
-    }
-
-    fileStream.close();
-    return content;
-}
-
-void SaveObj(const std::string& file, const std::vector<glm::vec4>& vertices,
-             const std::vector<glm::uvec3>& indices) {
-    std::ofstream ofs(file);
-    for (const auto& vert : vertices)
-        ofs << "v " << vert[0] << " " << vert[1] << " " << vert[2] << std::endl;
-    for (const auto& index : indices)
-        ofs << "f " << index[0] + 1 << " " << index[1] + 1 << " "
-            << index[2] + 1 << std::endl;
-}
-
 void ErrorCallback(int error, const char* description) {
     std::cerr << "GLFW Error: " << description << "\n";
 }
 
-// std::shared_ptr<Menger> g_menger;
+std::shared_ptr<Menger> g_menger;
+MengerRenderer g_menger_renderer;
+bool g_show_menger = false;
+// The camera as the current frame is drawn; g_simulation moves it.
 Camera g_camera;
+std::unique_ptr<Simulation> g_simulation;
 bool g_save_geo = false;
 bool g_gravity = false;
+std::unique_ptr<FrameCapture> g_capture;
+std::unique_ptr<ThreadPool> g_workers;
+std::unique_ptr<BlockTextures> g_block_textures;
+std::unique_ptr<BlockWorld> g_world;
+// Pregenerated columns, when the world has a seed (see main).
+std::unique_ptr<ChunkStore> g_chunk_store;
+// Chunk generation and meshing, on g_workers.
+std::unique_ptr<TaskScheduler> g_tasks;
+ChunkRenderer g_chunk_renderer;
+std::unique_ptr<ChunkUploader> g_uploader;
+OcclusionCuller g_occlusion;
+bool g_occlusion_culling = true;
+bool g_depth_prepass = false;
+bool g_show_overdraw = false;
+// Fragments the terrain's colour pass shades.
+GpuCounter g_terrain_samples(GL_SAMPLES_PASSED);
+std::unique_ptr<DynamicResolution> g_resolution;
+
+// How often the player is moved, whatever the frame rate.
+const double kTicksPerSecond = 60.0;
+
+// GPU time per frame that the render resolution scales to hold.
+const double kFrameTimeTargetMs = 16.6;
+
+// Linked program binaries are cached here between runs.
+const char* kShaderCacheDir = ".";
+
+// tools/pregenerate stores the chunks of a seed's world here, after the
+// seed.
+const char* kChunkStorePrefix = "world-";
+
+// Texture array layers, in the order the fragment shader indexes them.
+const char* kBlockTextureDir = "../assets/blocks";
+const std::vector<std::string> kBlockTextureFiles = {"water.jpg", "grass.jpg",
+                                                     "stone.jpg"};
+
+// Where the sponge floats above the terrain, and its edge length.
+const glm::vec3 kMengerCenter = glm::vec3(0.0f, 60.0f, 0.0f);
+const float kMengerSize = 81.0f;
+
+// Ctrl+S writes the sponge, or the terrain around the player when the
+// sponge is hidden; .ply and .glb select binary formats.
+const char* kMengerExportPath = "menger.obj";
+const char* kTerrainExportPath = "terrain.obj";
+// F4 starts and stops a trace, written here (see trace.h).
+const char* kTracePath = "trace.json";
+// Memory per subsystem is printed this often, and on F5.
+const double kMemoryReportSeconds = 60.0;
+const int kTerrainExportRadius = 4;  // chunks, as rendered
+// Deeper sponges only exist as instances and are too large to export.
+const int kMaxExportLevel = 5;
+
+// How far away blocks can be broken or placed, and what is placed.
+const float kReach = 8.0f;
+const BlockId kPlacedBlock = kStone;
+// A left press and release closer than this, in pixels, is a click that
+// breaks a block rather than a drag that turns the camera.
+const double kClickSlop = 4.0;
 std::random_device rd;
 std::mt19937 gen(rd());
 Terrain terrain(gen);
@@ -224,13 +304,12 @@ Terrain terrain(gen);
 // Point cube intersect
 bool intersect(glm::vec2 point, glm::vec2 cube) {
     // xmin<=x<=xmax && ymin<=y<=ymax && zmin<=z<=zmax
+    // Blocks occupy [x, x + 1) x [z, z + 1), as in Camera::collide.
     float xmin = cube.x;
     float xmax = cube.x + 1;
-    float zmin = cube.y - 1;
-    float zmax = cube.y;
+    float zmin = cube.y;
+    float zmax = cube.y + 1;
 
-    std::cout << "point " << point[0] << " " << point[1] << std::endl;
-    std::cout << "cube " << cube[0] << " " << cube[1] << std::endl;
     return xmin <= point.x && point.x <= xmax && zmin <= point.y &&
            point.y <= zmax;
 }
@@ -240,33 +319,21 @@ bool CollisionDetection() {
     glm::ivec2 chunk_coords = terrain.toChunkCoords(player_pos);
     std::vector<glm::vec3> cubes = terrain.genChunkSurface(chunk_coords);
 
-    for (auto c : cubes) {
-        auto x = c + glm::vec3(chunk_coords.x * terrain.size, 0,
-                               chunk_coords.y * terrain.size);
-
+    for (const auto& x : cubes) {
         // PLayer should be at same height as the intersecting cube
         if (x.y >= player_pos.y - 2 && x.y <= player_pos.y + 2) {
             if ((x.x - player_pos.x) * (x.x - player_pos.x) +
                     (x.z - player_pos.z) * (x.z - player_pos.z) <=
                 16) {
-                std::cout << "potential intersection at " << x[0] << " " << x[1]
-                          << " " << x[2] << std::endl;
                 if (intersect(glm::vec2(player_pos.x, player_pos.z),
-                              glm::vec2(x.x, x.z))) {
-                    std::cout << "intersected" << std::endl;
-                    std::cout << x[0] << " " << x[1] << " " << x[2]
-                              << std::endl;
+                              glm::vec2(x.x, x.z)))
                     return true;
-                }
             }
         }
     }
     return false;
 }
 
-int walk = 0;
-int strafe = 0;
-
 void KeyCallback(GLFWwindow* window, int key, int scancode, int action,
                  int mods) {
     // Note:
@@ -284,39 +351,87 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action,
         else
             std::cout << "Gravity turned off" << std::endl;
         g_gravity = !g_gravity;
+        g_simulation->setGravity(g_gravity);
+    } else if (key == GLFW_KEY_R && mods == GLFW_MOD_CONTROL &&
+               action == GLFW_RELEASE) {
+        if (g_capture->recording())
+            g_capture->stopRecording();
+        else
+            g_capture->startRecording();
+    } else if (key == GLFW_KEY_F2 && action == GLFW_RELEASE) {
+        g_capture->screenshot();
+    } else if (key == GLFW_KEY_M && action == GLFW_RELEASE) {
+        g_show_menger = !g_show_menger;
+    } else if (key == GLFW_KEY_O && action == GLFW_RELEASE) {
+        g_occlusion_culling = !g_occlusion_culling;
+        std::cout << "Occlusion culling "
+                  << (g_occlusion_culling ? "on" : "off") << std::endl;
+    } else if (key == GLFW_KEY_P && action == GLFW_RELEASE) {
+        g_depth_prepass = !g_depth_prepass;
+        std::cout << "Depth pre-pass " << (g_depth_prepass ? "on" : "off")
+                  << std::endl;
+    } else if (key == GLFW_KEY_V && action == GLFW_RELEASE) {
+        g_show_overdraw = !g_show_overdraw;
+    } else if (key == GLFW_KEY_F4 && action == GLFW_RELEASE) {
+        if (!Trace::compiled()) {
+            std::cout << "Tracing needs a build with CRAFT_TRACE" << std::endl;
+        } else if (!Trace::recording()) {
+            Trace::start();
+            std::cout << "Tracing" << std::endl;
+        } else if (Trace::stop(kTracePath)) {
+            std::cout << "Saved " << kTracePath << std::endl;
+        }
+    } else if (key == GLFW_KEY_F5 && action == GLFW_RELEASE) {
+        MemoryTracker::report(std::cout);
+    } else if (key == GLFW_KEY_F3 && action == GLFW_RELEASE) {
+        g_resolution->setEnabled(!g_resolution->enabled());
+        std::cout << "Dynamic resolution "
+                  << (g_resolution->enabled() ? "on" : "off") << std::endl;
+    } else if (key == GLFW_KEY_G && action == GLFW_RELEASE) {
+        if (!g_chunk_renderer.gpuCullingAvailable()) {
+            std::cout << "GPU culling needs OpenGL 4.3" << std::endl;
+        } else {
+            g_chunk_renderer.useGpuCulling(!g_chunk_renderer.gpuCulling());
+            std::cout << "Culling on the "
+                      << (g_chunk_renderer.gpuCulling() ? "GPU" : "CPU")
+                      << std::endl;
+        }
+    } else if (key >= GLFW_KEY_0 && key <= GLFW_KEY_9 &&
+               action == GLFW_RELEASE) {
+        g_menger->set_nesting_level(key - GLFW_KEY_0);
     } else if (key == GLFW_KEY_W) {
         // FIXME: WASD
         if (g_gravity) {
-            if (action == GLFW_PRESS) walk = 1;
-            if (action == GLFW_RELEASE) walk = 0;
+            if (action == GLFW_PRESS) g_simulation->walk(1);
+            if (action == GLFW_RELEASE) g_simulation->walk(0);
             ;
         } else {
-            g_camera.move(Camera::Direction::FORWARD);
+            g_simulation->move(Camera::Direction::FORWARD);
         }
     } else if (key == GLFW_KEY_S) {
         if (g_gravity) {
-            if (action == GLFW_PRESS) walk = -1;
-            if (action == GLFW_RELEASE) walk = 0;
+            if (action == GLFW_PRESS) g_simulation->walk(-1);
+            if (action == GLFW_RELEASE) g_simulation->walk(0);
         } else {
-            g_camera.move(Camera::Direction::BACKWARD);
+            g_simulation->move(Camera::Direction::BACKWARD);
         }
 
     } else if (key == GLFW_KEY_A) {
         if (g_gravity) {
-            if (action == GLFW_PRESS) strafe = -1;
-            if (action == GLFW_RELEASE) strafe = 0;
+            if (action == GLFW_PRESS) g_simulation->strafe(-1);
+            if (action == GLFW_RELEASE) g_simulation->strafe(0);
         } else {
-            g_camera.move(Camera::Direction::LEFT);
+            g_simulation->move(Camera::Direction::LEFT);
         }
 
     } else if (key == GLFW_KEY_SPACE && action == GLFW_PRESS) {
-        g_camera.jump();
+        g_simulation->jump();
     } else if (key == GLFW_KEY_D) {
         if (g_gravity) {
-            if (action == GLFW_PRESS) strafe = 1;
-            if (action == GLFW_RELEASE) strafe = 0;
+            if (action == GLFW_PRESS) g_simulation->strafe(1);
+            if (action == GLFW_RELEASE) g_simulation->strafe(0);
         } else {
-            g_camera.move(Camera::Direction::RIGHT);
+            g_simulation->move(Camera::Direction::RIGHT);
         }
     } else if (key == GLFW_KEY_Q && action != GLFW_RELEASE) {
         exit(1);
@@ -324,9 +439,9 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action,
         // FIXME: Left Right Up and Down
     } else if (key == GLFW_KEY_RIGHT && action != GLFW_RELEASE) {
     } else if (key == GLFW_KEY_DOWN && action != GLFW_RELEASE) {
-        g_camera.move(Camera::Direction::DOWN);
+        g_simulation->move(Camera::Direction::DOWN);
     } else if (key == GLFW_KEY_UP && action != GLFW_RELEASE) {
-        g_camera.move(Camera::Direction::UP);
+        g_simulation->move(Camera::Direction::UP);
     } else if (key == GLFW_KEY_C && action != GLFW_RELEASE) {
         // FIXME: FPS mode on/off
     }
@@ -344,7 +459,7 @@ void MousePosCallback(GLFWwindow* window, double mouse_x, double mouse_y) {
     double deltaY = mouse_y - g_mouse_y;
 
     if (g_current_button == GLFW_MOUSE_BUTTON_LEFT) {
-        g_camera.rotate(deltaX, deltaY);
+        g_simulation->rotate(deltaX, deltaY);
     } else if (g_current_button == GLFW_MOUSE_BUTTON_RIGHT) {
         // FIXME: middle drag
     } else if (g_current_button == GLFW_MOUSE_BUTTON_MIDDLE) {
@@ -355,15 +470,66 @@ void MousePosCallback(GLFWwindow* window, double mouse_x, double mouse_y) {
     g_mouse_y = mouse_y;
 }
 
+double g_press_x;
+double g_press_y;
+
+// Breaks the block under the crosshair, or places one against the face the
+// crosshair is on, and queues the chunks it changes for remeshing.
+void EditBlock(bool place) {
+    RayHit hit = g_world->raycast(g_camera.getPos(), g_camera.getLook(),
+                                  kReach);
+    if (!hit.hit) return;
+    glm::ivec3 block = place ? hit.block + hit.face : hit.block;
+    if (place) {
+        // Keep out of Camera::collide's box around the player.
+        glm::vec3 pos = g_camera.getPos();
+        glm::vec3 lo = pos - glm::vec3(0.5f, 1.75f, 0.5f);
+        glm::vec3 hi = pos + glm::vec3(0.5f, 0.0f, 0.5f);
+        bool overlaps = true;
+        for (int i = 0; i < 3; i++)
+            overlaps = overlaps && lo[i] < block[i] + 1 && block[i] < hi[i];
+        if (block == hit.block || overlaps) return;
+    }
+    std::vector<glm::ivec2> dirty;
+    BlockId id = place ? kPlacedBlock : BlockId(kAir);
+    if (!g_world->set(block, id, &dirty)) return;
+    for (const auto& coords : dirty) g_chunk_renderer.markDirty(coords);
+}
+
 void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
     g_mouse_pressed = (action == GLFW_PRESS);
     g_current_button = button;
+    double x, y;
+    glfwGetCursorPos(window, &x, &y);
+    if (action == GLFW_PRESS) {
+        g_mouse_x = g_press_x = x;
+        g_mouse_y = g_press_y = y;
+    } else if (action == GLFW_RELEASE) {
+        if (button == GLFW_MOUSE_BUTTON_LEFT &&
+            std::abs(x - g_press_x) + std::abs(y - g_press_y) < kClickSlop)
+            EditBlock(false);
+        else if (button == GLFW_MOUSE_BUTTON_RIGHT)
+            EditBlock(true);
+    }
 }
 
+// usage: minecraft [seed]
+//
+// A seed gives the same world every time, as the tools build it from
+// std::mt19937(seed), and chunks that tools/pregenerate stored for it are
+// read instead of generated. Without one the world is random.
 int main(int argc, char* argv[]) {
     std::string window_title = "Minecraft";
+    if (argc > 1) {
+        unsigned seed = std::strtoul(argv[1], nullptr, 10);
+        gen.seed(seed);
+        terrain = Terrain(gen);
+        g_chunk_store = std::make_unique<ChunkStore>(
+            kChunkStorePrefix + std::to_string(seed), terrain.seed(),
+            terrain.getSmoothingRadius());
+    }
     if (!glfwInit()) exit(EXIT_FAILURE);
-    // g_menger = std::make_shared<Menger>();
+    g_menger = std::make_shared<Menger>();
     glfwSetErrorCallback(ErrorCallback);
     // std::random_device rd;
     // std::mt19937 gen(rd());
@@ -375,12 +541,20 @@ int main(int argc, char* argv[]) {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    // The scene is multisampled offscreen (see DynamicResolution); the
+    // window only receives the resolved image.
+    glfwWindowHint(GLFW_SAMPLES, 0);
     GLFWwindow* window = glfwCreateWindow(window_width, window_height,
                                           &window_title[0], nullptr, nullptr);
     CHECK_SUCCESS(window != nullptr);
+    // An invisible window whose context shares the main one's objects,
+    // for the chunk upload thread.
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* upload_window = glfwCreateWindow(1, 1, "", nullptr, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    CHECK_SUCCESS(upload_window != nullptr);
     glfwMakeContextCurrent(window);
     glewExperimental = GL_TRUE;
-    glfwWindowHint(GLFW_SAMPLES, 16);
     glEnable(GL_MULTISAMPLE);
 
     CHECK_SUCCESS(glewInit() == GLEW_OK);
@@ -393,11 +567,19 @@ int main(int argc, char* argv[]) {
     const GLubyte* version = glGetString(GL_VERSION);    // version as a string
     std::cout << "Renderer: " << renderer << "\n";
     std::cout << "OpenGL version supported:" << version << "\n";
+    g_capture = std::make_unique<FrameCapture>();
+    g_workers = std::make_unique<ThreadPool>();
+
+    // Textures decode in the background; blocks use procedural colours
+    // until their layer is resident.
+    g_block_textures = std::make_unique<BlockTextures>(*g_workers);
+    g_block_textures->load(kBlockTextureDir, kBlockTextureFiles);
+
+    g_menger_renderer.setup();
+    g_menger_renderer.set_placement(kMengerCenter, kMengerSize);
 
     std::vector<glm::vec4> obj_vertices = Cube::vertices;
     std::vector<glm::uvec3> obj_faces = Cube::faces;
-    std::vector<glm::vec3> offsets;
-    offsets.resize(cubes);
 
     glm::vec4 min_bounds = glm::vec4(std::numeric_limits<float>::max());
     glm::vec4 max_bounds = glm::vec4(-std::numeric_limits<float>::max());
@@ -408,90 +590,61 @@ int main(int argc, char* argv[]) {
     std::cout << "min_bounds = " << glm::to_string(min_bounds) << "\n";
     std::cout << "max_bounds = " << glm::to_string(max_bounds) << "\n";
 
-    // Setup our VAO array.
-    CHECK_GL_ERROR(glGenVertexArrays(kNumVaos, &g_array_objects[0]));
-
-    // Switch to the VAO for Geometry.
-    CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kGeometryVao]));
-
-    // Generate buffer objects
-    CHECK_GL_ERROR(glGenBuffers(kNumVbos, &g_buffer_objects[kGeometryVao][0]));
-
-    // Setup vertex data in a VBO.
-    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER,
-                                g_buffer_objects[kGeometryVao][kVertexBuffer]));
-
-    // NOTE: We do not send anything right now, we just describe it to OpenGL.
-
-    int numVertices = sizeof(float) * obj_vertices.size() * 4;
-    int numOffsets = sizeof(float) * offsets.size() * 3;
-    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, numVertices + numOffsets, 0,
-                                GL_STATIC_DRAW));
-    CHECK_GL_ERROR(
-        glBufferSubData(GL_ARRAY_BUFFER, 0, numVertices, obj_vertices.data()));
-    CHECK_GL_ERROR(glBufferSubData(GL_ARRAY_BUFFER, numVertices, numOffsets,
-                                   offsets.data()));
-
-    // Enable vertex positions to be passed in under location 0
-    CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0));
-    CHECK_GL_ERROR(glEnableVertexAttribArray(0));
-
-    // Enable vertex offsets to be passed in under location 1, instanced
-    CHECK_GL_ERROR(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0,
-                                         (void*)((uint64_t)numVertices)));
-    CHECK_GL_ERROR(glEnableVertexAttribArray(1));
-    CHECK_GL_ERROR(glVertexAttribDivisor(1, 1));  // Per-instance locations
-
-    // Setup element array buffer.
-    CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
-                                g_buffer_objects[kGeometryVao][kIndexBuffer]));
-    CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                                sizeof(uint32_t) * obj_faces.size() * 3,
-                                obj_faces.data(), GL_STATIC_DRAW));
-
-    // Setup vertex shader.
-    GLuint vertex_shader_id = 0;
-    // std::string triangle_vert = readFile("../src/triangle.vert");
-    // const char* vertex_source_pointer = triangle_vert.c_str();
-    const char* vertex_source_pointer = vertex_shader;
-    CHECK_GL_ERROR(vertex_shader_id = glCreateShader(GL_VERTEX_SHADER));
-    CHECK_GL_ERROR(
-        glShaderSource(vertex_shader_id, 1, &vertex_source_pointer, nullptr));
-    glCompileShader(vertex_shader_id);
-    CHECK_GL_SHADER_ERROR(vertex_shader_id);
-
-    // Setup geometry shader.
-    GLuint geometry_shader_id = 0;
-    // std::string triangle_geom = readFile("../src/triangle.geom");
-    const char* geometry_source_pointer = geometry_shader;
-    CHECK_GL_ERROR(geometry_shader_id = glCreateShader(GL_GEOMETRY_SHADER));
-    CHECK_GL_ERROR(glShaderSource(geometry_shader_id, 1,
-                                  &geometry_source_pointer, nullptr));
-    glCompileShader(geometry_shader_id);
-    CHECK_GL_SHADER_ERROR(geometry_shader_id);
-
-    // Setup fragment shader.
-    GLuint fragment_shader_id = 0;
-    // std::string triangle_frag = readFile("../src/triangle.frag");
-    const char* fragment_source_pointer = fragment_shader;
-    CHECK_GL_ERROR(fragment_shader_id = glCreateShader(GL_FRAGMENT_SHADER));
-    CHECK_GL_ERROR(glShaderSource(fragment_shader_id, 1,
-                                  &fragment_source_pointer, nullptr));
-    glCompileShader(fragment_shader_id);
-    CHECK_GL_SHADER_ERROR(fragment_shader_id);
-
-    // Let's create our program.
-    GLuint program_id = 0;
-    CHECK_GL_ERROR(program_id = glCreateProgram());
-    CHECK_GL_ERROR(glAttachShader(program_id, vertex_shader_id));
-    CHECK_GL_ERROR(glAttachShader(program_id, fragment_shader_id));
-    CHECK_GL_ERROR(glAttachShader(program_id, geometry_shader_id));
-
-    // Bind attributes.
-    CHECK_GL_ERROR(glBindAttribLocation(program_id, 0, "vertex_position"));
-    CHECK_GL_ERROR(glBindFragDataLocation(program_id, 0, "fragment_color"));
-    glLinkProgram(program_id);
-    CHECK_GL_PROGRAM_ERROR(program_id);
+    // Terrain blocks are instances of the cube, one buffer range per chunk.
+    g_world = std::make_unique<BlockWorld>(terrain.seed(),
+                                           terrain.getSmoothingRadius());
+    g_world->setStore(g_chunk_store.get());
+    g_tasks = std::make_unique<TaskScheduler>(*g_workers);
+    g_chunk_renderer.setup(obj_vertices, obj_faces);
+    g_uploader = std::make_unique<ChunkUploader>(
+        [upload_window]() { glfwMakeContextCurrent(upload_window); },
+        []() { glfwMakeContextCurrent(nullptr); });
+    g_chunk_renderer.setUploader(g_uploader.get());
+
+    // Build the program, reusing the driver's binary from a previous run
+    // when the sources and driver are unchanged.
+    ShaderCache shader_cache(kShaderCacheDir);
+    GLuint program_id = shader_cache.build(
+        "terrain",
+        {{GL_VERTEX_SHADER, vertex_shader},
+         {GL_GEOMETRY_SHADER, geometry_shader},
+         {GL_FRAGMENT_SHADER, fragment_shader}},
+        [](GLuint program) {
+            // Bind attributes.
+            CHECK_GL_ERROR(
+                glBindAttribLocation(program, 0, "vertex_position"));
+            CHECK_GL_ERROR(
+                glBindFragDataLocation(program, 0, "fragment_color"));
+        });
+    // Culls in a compute shader where the driver has them (Mesa and most
+    // desktop drivers hand out 4.3 or later for the 4.1 asked for above);
+    // elsewhere culling stays on the CPU.
+    g_chunk_renderer.setupGpuCulling(shader_cache);
+    GLuint depth_program_id = shader_cache.build(
+        "terrain_depth",
+        {{GL_VERTEX_SHADER, vertex_shader},
+         {GL_GEOMETRY_SHADER, geometry_shader},
+         {GL_FRAGMENT_SHADER, depth_fragment_shader}},
+        [](GLuint program) {
+            CHECK_GL_ERROR(
+                glBindAttribLocation(program, 0, "vertex_position"));
+        });
+    GLuint overdraw_program_id = shader_cache.build(
+        "terrain_overdraw",
+        {{GL_VERTEX_SHADER, vertex_shader},
+         {GL_GEOMETRY_SHADER, geometry_shader},
+         {GL_FRAGMENT_SHADER, overdraw_fragment_shader}},
+        [](GLuint program) {
+            CHECK_GL_ERROR(
+                glBindAttribLocation(program, 0, "vertex_position"));
+            CHECK_GL_ERROR(
+                glBindFragDataLocation(program, 0, "fragment_color"));
+        });
+    g_terrain_samples.setup();
+    DynamicResolution::Options resolution_options;
+    resolution_options.target_ms = kFrameTimeTargetMs;
+    g_resolution = std::make_unique<DynamicResolution>(resolution_options);
+    g_resolution->setup();
 
     // Get the uniform locations.
     GLint projection_matrix_location = 0;
@@ -503,6 +656,24 @@ int main(int argc, char* argv[]) {
     GLint light_position_location = 0;
     CHECK_GL_ERROR(light_position_location =
                        glGetUniformLocation(program_id, "light_position"));
+    GLint block_textures_location = 0;
+    CHECK_GL_ERROR(block_textures_location =
+                       glGetUniformLocation(program_id, "block_textures"));
+    GLint textures_ready_location = 0;
+    CHECK_GL_ERROR(textures_ready_location =
+                       glGetUniformLocation(program_id, "textures_ready"));
+    GLint depth_projection_location = 0;
+    CHECK_GL_ERROR(depth_projection_location =
+                       glGetUniformLocation(depth_program_id, "projection"));
+    GLint depth_view_location = 0;
+    CHECK_GL_ERROR(depth_view_location =
+                       glGetUniformLocation(depth_program_id, "view"));
+    GLint overdraw_projection_location = 0;
+    CHECK_GL_ERROR(overdraw_projection_location = glGetUniformLocation(
+                       overdraw_program_id, "projection"));
+    GLint overdraw_view_location = 0;
+    CHECK_GL_ERROR(overdraw_view_location =
+                       glGetUniformLocation(overdraw_program_id, "view"));
 
     // ▄▄▄▄▄▄▄▄▄▄▄  ▄    ▄  ▄         ▄
     // ▐░░░░░░░░░░░▌▐░▌  ▐░▌▐░▌       ▐░▌
@@ -519,43 +690,67 @@ int main(int argc, char* argv[]) {
     glm::vec4 light_position = glm::vec4(10.0f, 10.0f, 10.0f, 1.0f);
     float aspect = 0.0f;
     float theta = 0.0f;
+    double startup_time = glfwGetTime();
+    bool first_frame = true;
+    double next_title_update = 0.0;
+    double next_memory_report = kMemoryReportSeconds;
     glfwSetTime(0.0);
-    float time = glfwGetTime();
-    glm::ivec2 prevChunk(-500, -500);
+    g_simulation = std::make_unique<Simulation>(g_camera, kTicksPerSecond);
+    TRACE_THREAD("render");
     while (!glfwWindowShouldClose(window)) {
+        TRACE_SCOPE("frame");
+        // Where the player is, between the simulation's last two ticks.
+        g_camera = g_simulation->camera();
         glm::ivec2 curChunk = terrain.toChunkCoords(g_camera.getPos());
 
-        if (curChunk != prevChunk) {
-            prevChunk = curChunk;
-            offsets = terrain.getSurfaceForRender(g_camera.getPos());
-
-            CHECK_GL_ERROR(
-                glBindBuffer(GL_ARRAY_BUFFER,
-                             g_buffer_objects[kGeometryVao][kVertexBuffer]));
-
-            CHECK_GL_ERROR(glBufferSubData(
-                GL_ARRAY_BUFFER, sizeof(float) * obj_vertices.size() * 4,
-                sizeof(float) * cubes * 3, offsets.data()));
-        }
+        // Generates and meshes chunks entering the view and chunks that
+        // were edited, and uploads the ones that are ready.
+        g_chunk_renderer.update(*g_world, curChunk, *g_tasks);
+        // The blocks the player collides with, edits included.
+        g_simulation->setWorld(g_world->neighbourhood(curChunk));
+        int edit_frames;
+        double edit_ms;
+        if (g_chunk_renderer.takeEditLatency(&edit_frames, &edit_ms))
+            std::cout << "Edit visible after " << edit_frames << " frames ("
+                      << edit_ms << " ms)" << std::endl;
 
         glfwGetFramebufferSize(window, &window_width, &window_height);
-        glViewport(0, 0, window_width, window_height);
+        g_resolution->begin(window_width, window_height);
         glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
         glEnable(GL_DEPTH_TEST);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glDepthFunc(GL_LESS);
 
-        // Switch to the Geometry VAO.
-        CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kGeometryVao]));
-
         // Compute the projection matrix.
         aspect = static_cast<float>(window_width) / window_height;
         glm::mat4 projection_matrix =
             glm::perspective(glm::radians(45.0f), aspect, 0.0001f, 1000.0f);
 
-        g_camera.update();
         glm::mat4 view_matrix = g_camera.get_view_matrix();
 
+        // Culls the terrain and orders what is left front to back.
+        g_chunk_renderer.cull(projection_matrix * view_matrix,
+                              g_camera.getPos(),
+                              g_occlusion_culling ? &g_occlusion : nullptr,
+                              g_workers.get());
+
+        // The pre-pass lays down the terrain's depth without shading it,
+        // so the colour pass below shades each visible pixel once. Both
+        // share the invariant vertex and geometry shaders, so GL_LEQUAL
+        // passes exactly the fragments the pre-pass kept.
+        if (g_depth_prepass) {
+            CHECK_GL_ERROR(glUseProgram(depth_program_id));
+            CHECK_GL_ERROR(glUniformMatrix4fv(depth_projection_location, 1,
+                                              GL_FALSE,
+                                              &projection_matrix[0][0]));
+            CHECK_GL_ERROR(glUniformMatrix4fv(depth_view_location, 1,
+                                              GL_FALSE, &view_matrix[0][0]));
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            g_chunk_renderer.draw();
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthFunc(GL_LEQUAL);
+        }
+
         // Use our program.
         CHECK_GL_ERROR(glUseProgram(program_id));
 
@@ -567,19 +762,145 @@ int main(int argc, char* argv[]) {
         CHECK_GL_ERROR(
             glUniform4fv(light_position_location, 1, &light_position[0]));
 
+        g_block_textures->update();
+        g_block_textures->bind(0);
+        CHECK_GL_ERROR(glUniform1i(block_textures_location, 0));
+        CHECK_GL_ERROR(glUniform1i(textures_ready_location,
+                                   g_block_textures->readyMask()));
+
         // Draw our triangles.
-        CHECK_GL_ERROR(glDrawElementsInstanced(
-            GL_TRIANGLES, obj_faces.size() * 3, GL_UNSIGNED_INT, 0, cubes));
-
-        float newTime = glfwGetTime();
-        if (g_gravity) g_camera.physics(newTime - time, offsets);
-        if (g_gravity) g_camera.walk(walk);
-        if (g_gravity) g_camera.strafe(strafe);
-        time = newTime;
+        if (g_show_overdraw) {
+            CHECK_GL_ERROR(glUseProgram(overdraw_program_id));
+            CHECK_GL_ERROR(glUniformMatrix4fv(overdraw_projection_location, 1,
+                                              GL_FALSE,
+                                              &projection_matrix[0][0]));
+            CHECK_GL_ERROR(glUniformMatrix4fv(overdraw_view_location, 1,
+                                              GL_FALSE, &view_matrix[0][0]));
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE);
+        }
+        g_terrain_samples.begin();
+        g_chunk_renderer.draw();
+        g_terrain_samples.end();
+        if (g_show_overdraw) {
+            glDisable(GL_BLEND);
+            CHECK_GL_ERROR(glUseProgram(program_id));
+        }
+        glDepthFunc(GL_LESS);
+
+        // What was drawn and what culling cost, twice a second.
+        if (glfwGetTime() >= next_title_update) {
+            next_title_update = glfwGetTime() + 0.5;
+            const OcclusionCuller::Stats& cull = g_occlusion.stats();
+            std::ostringstream title;
+            // The GPU counts instances, the CPU cells.
+            const char* unit =
+                g_chunk_renderer.gpuCulling() ? " cubes" : " cells";
+            title << window_title << " - " << g_chunk_renderer.instances()
+                  << " cubes in " << g_chunk_renderer.draw_calls()
+                  << " draws, " << g_chunk_renderer.frustumCulled() << unit
+                  << " outside the view";
+            if (g_occlusion_culling)
+                title << ", " << g_chunk_renderer.occlusionCulled() << unit
+                      << " occluded in " << std::fixed
+                      << std::setprecision(2)
+                      << cull.raster_ms + cull.test_ms << " ms";
+            // Shaded terrain fragments per rendered pixel.
+            double pixels = double(g_resolution->width()) *
+                            g_resolution->height() * g_resolution->samples();
+            title << ", " << std::fixed << std::setprecision(2)
+                  << g_terrain_samples.result() / pixels
+                  << " fragments per pixel, " << std::setprecision(0)
+                  << g_resolution->scale() * 100.0f << "% scale ("
+                  << g_resolution->width() << "x" << g_resolution->height()
+                  << "), GPU " << std::setprecision(1)
+                  << g_resolution->gpuMs() << " ms";
+            glfwSetWindowTitle(window, title.str().c_str());
+        }
+
+        if (g_show_menger) {
+            TRACE_SCOPE("menger");
+            if (g_menger->is_dirty()) {
+                g_menger_renderer.set_nesting_level(
+                    g_menger->nesting_level());
+                g_menger->set_clean();
+            }
+            // One pixel's share of the vertical field of view.
+            float pixel_angle =
+                glm::radians(45.0f) / g_resolution->height();
+            g_menger_renderer.draw(projection_matrix * view_matrix,
+                                   g_camera.getPos(), pixel_angle);
+        }
+
+        if (g_save_geo && !g_show_menger) {
+            g_save_geo = false;
+            ChunkMesher mesher(terrain.seed(), terrain.size,
+                               terrain.getSmoothingRadius());
+            glm::ivec2 radius(kTerrainExportRadius);
+            MeshExporter::Options options;
+            options.format = MeshFormatFromPath(kTerrainExportPath);
+            RegionExportStats stats;
+            if (ExportRegion(mesher, curChunk - radius,
+                             curChunk + radius + glm::ivec2(1),
+                             kTerrainExportPath, options, *g_workers, 0,
+                             &stats))
+                std::cout << "Saved " << stats.chunks << " chunks to "
+                          << kTerrainExportPath << " in " << stats.ms
+                          << " ms" << std::endl;
+        } else if (g_save_geo) {
+            g_save_geo = false;
+            if (g_menger->nesting_level() > kMaxExportLevel) {
+                std::cout << "Menger level " << g_menger->nesting_level()
+                          << " is too deep to export" << std::endl;
+            } else {
+                std::vector<glm::vec4> menger_vertices;
+                std::vector<glm::uvec3> menger_faces;
+                g_menger->generate_geometry(menger_vertices, menger_faces,
+                                            g_workers.get());
+                if (SaveMesh(kMengerExportPath, menger_vertices, menger_faces))
+                    std::cout << "Saved " << kMengerExportPath << std::endl;
+            }
+        }
+
+        // Resolve and upscale into the window.
+        {
+            TRACE_SCOPE("DynamicResolution::end");
+            g_resolution->end();
+        }
+
+        // Queue an asynchronous readback if a screenshot/recording is active.
+        g_capture->endFrame(window_width, window_height);
+
         // Poll and swap.
         glfwPollEvents();
-        glfwSwapBuffers(window);
+        {
+            TRACE_SCOPE("glfwSwapBuffers");
+            glfwSwapBuffers(window);
+        }
+        MemoryTracker::endFrame();
+        if (glfwGetTime() >= next_memory_report) {
+            MemoryTracker::report(std::cout);
+            next_memory_report = glfwGetTime() + kMemoryReportSeconds;
+        }
+        if (first_frame) {
+            first_frame = false;
+            std::cout << "First frame after "
+                      << (startup_time + glfwGetTime()) * 1000.0 << " ms"
+                      << std::endl;
+        }
     }
+    g_simulation.reset();
+    g_tasks.reset();
+    g_capture->stopRecording();
+    g_capture->flush();
+    g_capture->release();
+    g_block_textures->release();
+    g_menger_renderer.release();
+    g_uploader->stop();
+    g_chunk_renderer.release();
+    g_terrain_samples.release();
+    g_resolution->release();
+    glfwDestroyWindow(upload_window);
     glfwDestroyWindow(window);
     glfwTerminate();
     exit(EXIT_SUCCESS);
@@ -0,0 +1,99 @@
+#include "memory_tracker.h"
+
+#include <iomanip>
+
+namespace {
+const size_t kTags = size_t(MemoryTag::kCount);
+
+struct TagCounters {
+    std::atomic<size_t> live{0};
+    std::atomic<size_t> peak{0};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> frame{0};  // since the last endFrame()
+    std::atomic<uint64_t> last_frame{0};
+};
+
+TagCounters g_counters[kTags];
+
+double mebibytes(size_t bytes) { return bytes / (1024.0 * 1024.0); }
+};  // namespace
+
+void MemoryTracker::allocate(MemoryTag tag, size_t bytes) {
+    TagCounters& counters = g_counters[size_t(tag)];
+    size_t live =
+        counters.live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t peak = counters.peak.load(std::memory_order_relaxed);
+    while (live > peak &&
+           !counters.peak.compare_exchange_weak(peak, live,
+                                                std::memory_order_relaxed)) {
+    }
+    counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    counters.frame.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MemoryTracker::free(MemoryTag tag, size_t bytes) {
+    g_counters[size_t(tag)].live.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+const char* MemoryTracker::name(MemoryTag tag) {
+    switch (tag) {
+        case MemoryTag::kTerrain:
+            return "terrain";
+        case MemoryTag::kNoise:
+            return "noise";
+        case MemoryTag::kWorld:
+            return "world";
+        case MemoryTag::kMeshes:
+            return "meshes";
+        case MemoryTag::kGpuBuffers:
+            return "gpu buffers";
+        case MemoryTag::kImages:
+            return "images";
+        default:
+            return "?";
+    }
+}
+
+MemoryTracker::Counters MemoryTracker::counters(MemoryTag tag) {
+    const TagCounters& counters = g_counters[size_t(tag)];
+    Counters result;
+    result.live = counters.live.load(std::memory_order_relaxed);
+    result.peak = counters.peak.load(std::memory_order_relaxed);
+    result.allocations = counters.allocations.load(std::memory_order_relaxed);
+    result.last_frame = counters.last_frame.load(std::memory_order_relaxed);
+    return result;
+}
+
+void MemoryTracker::endFrame() {
+    for (TagCounters& counters : g_counters)
+        counters.last_frame.store(
+            counters.frame.exchange(0, std::memory_order_relaxed),
+            std::memory_order_relaxed);
+}
+
+void MemoryTracker::report(std::ostream& out) {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(2);
+    out << "Memory           live MiB   peak MiB   allocations  last frame\n";
+    Counters total;
+    for (size_t i = 0; i < kTags; i++) {
+        Counters counters = MemoryTracker::counters(MemoryTag(i));
+        out << "  " << std::left << std::setw(13) << name(MemoryTag(i))
+            << std::right << std::setw(11) << mebibytes(counters.live)
+            << std::setw(11) << mebibytes(counters.peak) << std::setw(14)
+            << counters.allocations << std::setw(12) << counters.last_frame
+            << "\n";
+        total.live += counters.live;
+        // Each tag peaked at its own time, so this bounds the true peak.
+        total.peak += counters.peak;
+        total.allocations += counters.allocations;
+        total.last_frame += counters.last_frame;
+    }
+    out << "  " << std::left << std::setw(13) << "total" << std::right
+        << std::setw(11) << mebibytes(total.live) << std::setw(11)
+        << mebibytes(total.peak) << std::setw(14) << total.allocations
+        << std::setw(12) << total.last_frame << std::endl;
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,113 @@
+#ifndef MEMORY_TRACKER_H
+#define MEMORY_TRACKER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <ostream>
+#include <vector>
+
+// What a tracked allocation is for.
+enum class MemoryTag {
+    kTerrain,     // Terrain's chunks and their height fields
+    kNoise,       // permutation tables
+    kWorld,       // BlockWorld's chunk sections
+    kMeshes,      // chunk instances on their way to the GPU
+    kGpuBuffers,  // buffer, texture and renderbuffer storage
+    kImages,      // decoded and captured pixels
+    kCount,
+};
+
+// Live and peak bytes and allocation counts per MemoryTag, to see which
+// subsystem memory goes to and which one allocates every frame.
+//
+// Heap memory is counted by TrackingAllocator, which containers of a
+// subsystem take as their allocator; GPU memory, which never passes
+// through an allocator, by a TrackedBytes next to the GL object. Counters
+// are relaxed atomics, so any thread may allocate and free.
+class MemoryTracker {
+   public:
+    struct Counters {
+        size_t live = 0;
+        size_t peak = 0;
+        uint64_t allocations = 0;  // since startup
+        uint64_t last_frame = 0;   // during the last endFrame() interval
+    };
+
+    static void allocate(MemoryTag tag, size_t bytes);
+    static void free(MemoryTag tag, size_t bytes);
+
+    static const char* name(MemoryTag tag);
+    static Counters counters(MemoryTag tag);
+    // Closes the allocation counts of the frame. For the render thread.
+    static void endFrame();
+    // One line per tag, then the totals.
+    static void report(std::ostream& out);
+};
+
+// A std::allocator that counts its memory under Tag. Stateless, so
+// containers with it still move and swap in constant time.
+template <class T, MemoryTag Tag>
+class TrackingAllocator {
+   public:
+    typedef T value_type;
+
+    template <class U>
+    struct rebind {
+        typedef TrackingAllocator<U, Tag> other;
+    };
+
+    TrackingAllocator() = default;
+    template <class U>
+    TrackingAllocator(const TrackingAllocator<U, Tag>&) {}
+
+    T* allocate(size_t n) {
+        T* p = static_cast<T*>(::operator new(n * sizeof(T)));
+        MemoryTracker::allocate(Tag, n * sizeof(T));
+        return p;
+    }
+    void deallocate(T* p, size_t n) {
+        MemoryTracker::free(Tag, n * sizeof(T));
+        ::operator delete(p);
+    }
+
+    template <class U>
+    bool operator==(const TrackingAllocator<U, Tag>&) const {
+        return true;
+    }
+    template <class U>
+    bool operator!=(const TrackingAllocator<U, Tag>&) const {
+        return false;
+    }
+};
+
+template <class T, MemoryTag Tag>
+using TrackedVector = std::vector<T, TrackingAllocator<T, Tag>>;
+
+// Bytes held outside the heap, such as a GL buffer's storage, counted
+// under a tag: set() whenever the storage is reallocated, and the count
+// drops back to zero on destruction.
+class TrackedBytes {
+   public:
+    explicit TrackedBytes(MemoryTag tag) : tag_(tag) {}
+    ~TrackedBytes() { set(0); }
+
+    TrackedBytes(const TrackedBytes&) = delete;
+    TrackedBytes& operator=(const TrackedBytes&) = delete;
+
+    void set(size_t bytes) {
+        if (bytes > bytes_)
+            MemoryTracker::allocate(tag_, bytes - bytes_);
+        else if (bytes < bytes_)
+            MemoryTracker::free(tag_, bytes_ - bytes);
+        bytes_ = bytes;
+    }
+    size_t bytes() const { return bytes_; }
+
+   private:
+    MemoryTag tag_;
+    size_t bytes_ = 0;
+};
+
+#endif
@@ -1,10 +1,139 @@
 #include "menger.h"
+#include <algorithm>
+#include <functional>
+#include <future>
 #include <iostream>
+#include "thread_pool.h"
 using namespace std;
 
 namespace {
 const int kMinLevel = 0;
 const int kMaxLevel = 4;
+
+// Corner index bits are (x << 2) | (y << 1) | z. Each face is a quad
+// (a, b, c, d) split into triangles (a, b, c) and (c, d, a), keeping the
+// winding the sponge has always used.
+struct FaceDesc {
+    glm::ivec3 normal;
+    unsigned corners[4];
+};
+const FaceDesc kFaces[6] = {
+    {glm::ivec3(0, 0, -1), {0, 4, 6, 2}},  // Back
+    {glm::ivec3(0, 0, 1), {5, 1, 3, 7}},   // Front
+    {glm::ivec3(1, 0, 0), {6, 4, 5, 7}},   // Right
+    {glm::ivec3(-1, 0, 0), {0, 2, 3, 1}},  // Left
+    {glm::ivec3(0, 1, 0), {3, 2, 6, 7}},   // Top
+    {glm::ivec3(0, -1, 0), {4, 0, 1, 5}},  // Bottom
+};
+
+// For every coordinate of the 3^level grid, a bit per base-3 digit that is
+// 1. A cell is solid iff no digit position is 1 on two or more axes, which
+// turns the neighbour test into three lookups.
+class Grid {
+   public:
+    explicit Grid(int level) : size_(1) {
+        for (int i = 0; i < level; i++) size_ *= 3;
+        ones_.resize(size_);
+        for (int c = 0; c < size_; c++) {
+            uint32_t mask = 0;
+            for (int d = 0, v = c; d < level; d++, v /= 3)
+                if (v % 3 == 1) mask |= 1u << d;
+            ones_[c] = mask;
+        }
+    }
+
+    int size() const { return size_; }
+
+    bool filled(int x, int y, int z) const {
+        if (x < 0 || y < 0 || z < 0 || x >= size_ || y >= size_ || z >= size_)
+            return false;
+        uint32_t a = ones_[x], b = ones_[y], c = ones_[z];
+        return ((a & b) | (b & c) | (a & c)) == 0;
+    }
+
+    // Bit i set when face kFaces[i] of the cell is exposed.
+    unsigned exposed(int x, int y, int z) const {
+        unsigned faces = 0;
+        for (int i = 0; i < 6; i++) {
+            const glm::ivec3& n = kFaces[i].normal;
+            if (!filled(x + n.x, y + n.y, z + n.z)) faces |= 1u << i;
+        }
+        return faces;
+    }
+
+   private:
+    int size_;
+    std::vector<uint32_t> ones_;
+};
+
+// Calls visit(x, y, z) for every solid cell of the span-sized block at
+// (x, y, z).
+template <typename Visit>
+void forEachCell(int x, int y, int z, int span, Visit& visit) {
+    if (span == 1) {
+        visit(x, y, z);
+        return;
+    }
+    int third = span / 3;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            for (int k = 0; k < 3; k++)
+                if (i % 2 + j % 2 + k % 2 < 2)
+                    forEachCell(x + i * third, y + j * third, z + k * third,
+                                third, visit);
+}
+
+int popcount(unsigned v) {
+    int count = 0;
+    for (; v; v &= v - 1) count++;
+    return count;
+}
+
+struct Block {
+    glm::ivec3 origin;
+    int span;
+    size_t faces = 0;   // exposed faces, from the counting pass
+    size_t offset = 0;  // first face slot in the output
+};
+
+size_t countBlock(const Grid& grid, const Block& block) {
+    size_t faces = 0;
+    auto count = [&](int x, int y, int z) {
+        faces += popcount(grid.exposed(x, y, z));
+    };
+    forEachCell(block.origin.x, block.origin.y, block.origin.z, block.span,
+                count);
+    return faces;
+}
+
+void writeBlock(const Grid& grid, const Block& block, glm::vec4* vertices,
+                glm::uvec3* triangles) {
+    float edge = 1.0f / grid.size();
+    size_t face = block.offset;
+    auto write = [&](int x, int y, int z) {
+        unsigned exposed = grid.exposed(x, y, z);
+        if (!exposed) return;
+        glm::vec3 lo = glm::vec3(x, y, z) * edge - glm::vec3(0.5f);
+        glm::vec3 hi = lo + glm::vec3(edge);
+        for (int i = 0; i < 6; i++) {
+            if (!(exposed & (1u << i))) continue;
+            glm::vec4* v = vertices + face * Menger::kVerticesPerFace;
+            for (int c = 0; c < 4; c++) {
+                unsigned corner = kFaces[i].corners[c];
+                v[c] = glm::vec4(corner & 4 ? hi.x : lo.x,
+                                 corner & 2 ? hi.y : lo.y,
+                                 corner & 1 ? hi.z : lo.z, 1.0f);
+            }
+            unsigned base = face * Menger::kVerticesPerFace;
+            glm::uvec3* t = triangles + face * Menger::kTrianglesPerFace;
+            t[0] = glm::uvec3(base, base + 1, base + 2);
+            t[1] = glm::uvec3(base + 2, base + 3, base);
+            face++;
+        }
+    };
+    forEachCell(block.origin.x, block.origin.y, block.origin.z, block.span,
+                write);
+}
 };  // namespace
 
 Menger::Menger() {
@@ -22,157 +151,60 @@ bool Menger::is_dirty() const { return dirty_; }
 
 void Menger::set_clean() { dirty_ = false; }
 
-// FIXME generate Menger sponge geometry
-void Menger::generate_geometry(std::vector<glm::vec4>& obj_vertices,
-                               std::vector<glm::uvec3>& obj_faces) const {
-    obj_vertices.clear();
-    obj_faces.clear();
-    float edge_length = 1.0;
-    float minx = -0.5f;
-    float miny = -0.5f;
-    float minz = -0.5f;
-    float maxx = -0.5f + 1.0;
-    float maxy = -0.5f + 1.0;
-    float maxz = -0.5f + 1.0;
-    int faces[1];
-    faces[0] = 0;
-    // Draw cube
-    if (nesting_level_ == 0) {
-        create_cube(obj_vertices, obj_faces, minx, miny, minz, maxx, maxy, maxz,
-                    faces);
-    } else {
-        // Recursively construct the menger sponge
-        menger_recursion(obj_vertices, obj_faces, minx, miny, minz,
-                         edge_length / 3, nesting_level_, faces);
+size_t Menger::cube_count(int level) {
+    size_t cubes = 1;
+    for (int i = 0; i < level; i++) cubes *= 20;
+    return cubes;
+}
+
+bool Menger::is_filled(int level, int x, int y, int z) {
+    for (int d = 0; d < level; d++, x /= 3, y /= 3, z /= 3) {
+        if (x % 3 == 1 && y % 3 == 1) return false;
+        if (y % 3 == 1 && z % 3 == 1) return false;
+        if (x % 3 == 1 && z % 3 == 1) return false;
     }
+    return true;
 }
 
-void Menger::menger_recursion(std::vector<glm::vec4>& obj_vertices,
-                              std::vector<glm::uvec3>& obj_faces, float minx,
-                              float miny, float minz, float edge_length,
-                              int depth, int* faces) const {
-    float x = 0.0;
-    float y = 0.0;
-    float z = 0.0;
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 3; j++) {
-            for (int k = 0; k < 3; k++) {
-                // (0,0,0) starts at (-minx, -miny, -minz),
-                // This is true when only 1 of i, j, k is the value 1. We do not
-                // draw the cube when this is false
-                if (i % 2 + j % 2 + k % 2 < 2) {
-                    x = minx + i * edge_length;
-                    y = miny + j * edge_length;
-                    z = minz + k * edge_length;
-                    if (depth > 1)
-                        menger_recursion(obj_vertices, obj_faces, x, y, z,
-                                         edge_length / 3, depth - 1, faces);
-                    else
-                        create_cube(obj_vertices, obj_faces, x, y, z,
-                                    x + edge_length, y + edge_length,
-                                    z + edge_length, faces);
-                }
-            }
+void Menger::generate_geometry(std::vector<glm::vec4>& obj_vertices,
+                               std::vector<glm::uvec3>& obj_faces,
+                               ThreadPool* pool) const {
+    Grid grid(nesting_level_);
+
+    // Split into the 20 top-level sub-cubes (or the single level-0 cube).
+    std::vector<Block> blocks;
+    int third = std::max(grid.size() / 3, 1);
+    for (int i = 0; i < grid.size(); i += third)
+        for (int j = 0; j < grid.size(); j += third)
+            for (int k = 0; k < grid.size(); k += third)
+                if (grid.filled(i, j, k))
+                    blocks.push_back({glm::ivec3(i, j, k), third});
+
+    auto forEachBlock = [&](const std::function<void(Block&)>& work) {
+        if (pool == nullptr) {
+            for (auto& block : blocks) work(block);
+            return;
         }
+        std::vector<std::future<void>> done;
+        for (auto& block : blocks)
+            done.push_back(pool->submit([&work, &block]() { work(block); }));
+        for (auto& f : done) f.get();
+    };
+
+    // Pass 1: count exposed faces per block, then lay the blocks out.
+    forEachBlock([&](Block& block) { block.faces = countBlock(grid, block); });
+    size_t total = 0;
+    for (auto& block : blocks) {
+        block.offset = total;
+        total += block.faces;
     }
-}
 
-void Menger::create_cube(std::vector<glm::vec4>& obj_vertices,
-                         std::vector<glm::uvec3>& obj_faces, float minx,
-                         float miny, float minz, float maxx, float maxy,
-                         float maxz, int* faces) const {
-    // Vertices of each triangle
-    int face = faces[0];
-	
-    // The eight vertices
-	glm::vec4 point1 = glm::vec4(minx, miny, minz, 1.0f);
-	glm::vec4 point2 = glm::vec4(minx, miny, maxz, 1.0f);
-	glm::vec4 point3 = glm::vec4(minx, maxy, minz, 1.0f);
-	glm::vec4 point4 = glm::vec4(minx, maxy, maxz, 1.0f);
-	glm::vec4 point5 = glm::vec4(maxx, miny, minz, 1.0f);
-	glm::vec4 point6 = glm::vec4(maxx, miny, maxz, 1.0f);
-	glm::vec4 point7 = glm::vec4(maxx, maxy, minz, 1.0f);
-	glm::vec4 point8 = glm::vec4(maxx, maxy, maxz, 1.0f);
-
-    // Back Face
-	// Triangle 1
-	obj_vertices.push_back(point1);
-	obj_vertices.push_back(point5);
-	obj_vertices.push_back(point7);
-
-	// Triangle 2
-	obj_vertices.push_back(point7);
-	obj_vertices.push_back(point3);
-	obj_vertices.push_back(point1);
-
-	obj_faces.push_back(glm::uvec3(face, face + 1, face + 2));
-	obj_faces.push_back(glm::uvec3(face + 3, face + 4, face + 5));
-
-    // Front Face
-    // Triangle 3
-    obj_vertices.push_back(point2);
-    obj_vertices.push_back(point4);
-    obj_vertices.push_back(point6);
-    // Triangle 4
-    obj_vertices.push_back(point4);
-    obj_vertices.push_back(point8);
-    obj_vertices.push_back(point6);
-
-	obj_faces.push_back(glm::uvec3(face + 6, face + 7, face + 8));
-	obj_faces.push_back(glm::uvec3(face + 9, face + 10, face + 11));
-
-    // Right Face
-    // Triangle 5
-    obj_vertices.push_back(point5);
-    obj_vertices.push_back(point6);
-    obj_vertices.push_back(point7);
-
-    // Triangle 6
-    obj_vertices.push_back(point8);
-    obj_vertices.push_back(point7);
-    obj_vertices.push_back(point6);
-
-	obj_faces.push_back(glm::uvec3(face + 12, face + 13, face + 14));
-	obj_faces.push_back(glm::uvec3(face + 15, face + 16, face + 17));
-
-    // Left Face
-    // Triangle 7
-    obj_vertices.push_back(point1);
-    obj_vertices.push_back(point3);
-    obj_vertices.push_back(point4);
-    // Triangle q
-    obj_vertices.push_back(point4);
-    obj_vertices.push_back(point2);
-    obj_vertices.push_back(point1);
-
-	obj_faces.push_back(glm::uvec3(face + 18, face + 19, face + 20));
-	obj_faces.push_back(glm::uvec3(face + 21, face + 22, face + 23));
- 
-    // Top Face
-    // Triangle 9
-    obj_vertices.push_back(point4);
-    obj_vertices.push_back(point3);
-    obj_vertices.push_back(point7);
-    // Triangle 10
-    obj_vertices.push_back(point8);
-    obj_vertices.push_back(point4);
-    obj_vertices.push_back(point7);
-	
-	obj_faces.push_back(glm::uvec3(face + 24, face + 25, face + 26));
-	obj_faces.push_back(glm::uvec3(face + 27, face + 28, face + 29));
-
-    // Bottom Face
-    // Triangle 11
-    obj_vertices.push_back(point5);
-    obj_vertices.push_back(point1);
-    obj_vertices.push_back(point2);
-    // Triangle 12
-    obj_vertices.push_back(point2);
-    obj_vertices.push_back(point6);
-    obj_vertices.push_back(point5);
-
-	obj_faces.push_back(glm::uvec3(face + 30, face + 31, face + 32));
-	obj_faces.push_back(glm::uvec3(face + 33, face + 34, face + 35));
-
-    faces[0] += 36;
-};
\ No newline at end of file
+    // Pass 2: every block fills its own range, no shared counters.
+    obj_vertices.resize(total * kVerticesPerFace);
+    obj_faces.resize(total * kTrianglesPerFace);
+    glm::vec4* vertices = obj_vertices.data();
+    glm::uvec3* triangles = obj_faces.data();
+    forEachBlock([&](Block& block) {
+        writeBlock(grid, block, vertices, triangles);
+    });
+}
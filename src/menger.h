@@ -2,27 +2,37 @@
 #define MENGER_H
 
 #include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
+class ThreadPool;
+
 class Menger {
 public:
 	Menger();
 	~Menger();
 	void set_nesting_level(int);
+	int nesting_level() const { return nesting_level_; }
 	bool is_dirty() const;
 	void set_clean();
+	// Emits only the faces of sub-cubes that are not covered by a filled
+	// neighbour, as 4-vertex quads (2 triangles each). With a pool, the 20
+	// top-level blocks are counted and then written in parallel into
+	// precomputed ranges of the exactly sized output.
 	void generate_geometry(std::vector<glm::vec4>& obj_vertices,
-	                       std::vector<glm::uvec3>& obj_faces) const;
+	                       std::vector<glm::uvec3>& obj_faces,
+	                       ThreadPool* pool = nullptr) const;
+
+	// Number of solid sub-cubes at a nesting level (20^level).
+	static size_t cube_count(int level);
+	// Whether cell (x, y, z) of the 3^level grid is solid.
+	static bool is_filled(int level, int x, int y, int z);
+	static const int kVerticesPerFace = 4;
+	static const int kTrianglesPerFace = 2;
 private:
 	int nesting_level_ = 0;
 	bool dirty_ = false;
-	void create_cube(std::vector<glm::vec4>& obj_vertices, std::vector<glm::uvec3>& obj_faces,
-							float minx, float miny, float minz, 
-							float maxx, float maxy, float maxz,
-							int* faces) const;		
-	void menger_recursion(std::vector<glm::vec4>& obj_vertices, std::vector<glm::uvec3>& obj_faces,
-							float minx, float miny, float minz, float edge_length, int depth, int* faces) const;
-	
 };
 
 #endif
@@ -0,0 +1,156 @@
+#include "menger_renderer.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include <debuggl.h>
+
+#include "menger.h"
+
+MengerRenderer::MengerRenderer(size_t chunk_instances)
+    : chunk_instances_(std::max<size_t>(chunk_instances, 1)) {}
+
+void MengerRenderer::setup() {
+    std::vector<glm::vec4> vertices;
+    std::vector<glm::uvec3> faces;
+    for (int level = 0; level <= kMaxMeshLevel; level++) {
+        Menger menger;
+        menger.set_nesting_level(level);
+        std::vector<glm::vec4> mesh_vertices;
+        std::vector<glm::uvec3> mesh_faces;
+        menger.generate_geometry(mesh_vertices, mesh_faces);
+
+        Mesh& mesh = meshes_[level];
+        mesh.base_vertex = vertices.size();
+        mesh.index_offset = faces.size() * sizeof(glm::uvec3);
+        mesh.index_count = mesh_faces.size() * 3;
+        vertices.insert(vertices.end(), mesh_vertices.begin(),
+                        mesh_vertices.end());
+        // The sponge is wound the other way round from the terrain cubes;
+        // flip it so the geometry shader's face normals point outwards.
+        for (const auto& face : mesh_faces)
+            faces.push_back(glm::uvec3(face.x, face.z, face.y));
+        pending_[level].reserve(chunk_instances_);
+    }
+
+    CHECK_GL_ERROR(glGenVertexArrays(1, &vao_));
+    CHECK_GL_ERROR(glBindVertexArray(vao_));
+
+    CHECK_GL_ERROR(glGenBuffers(1, &mesh_buffer_));
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, mesh_buffer_));
+    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
+                                sizeof(glm::vec4) * vertices.size(),
+                                vertices.data(), GL_STATIC_DRAW));
+    CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0));
+    CHECK_GL_ERROR(glEnableVertexAttribArray(0));
+
+    CHECK_GL_ERROR(glGenBuffers(1, &instance_buffer_));
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_));
+    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
+                                sizeof(glm::vec4) * chunk_instances_, nullptr,
+                                GL_STREAM_DRAW));
+    CHECK_GL_ERROR(glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, 0));
+    CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+    CHECK_GL_ERROR(glVertexAttribDivisor(1, 1));
+
+    CHECK_GL_ERROR(glGenBuffers(1, &index_buffer_));
+    CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_));
+    CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                                sizeof(glm::uvec3) * faces.size(),
+                                faces.data(), GL_STATIC_DRAW));
+    CHECK_GL_ERROR(glBindVertexArray(0));
+    buffer_bytes_.set(sizeof(glm::vec4) * (vertices.size() + chunk_instances_) +
+                      sizeof(glm::uvec3) * faces.size());
+}
+
+void MengerRenderer::release() {
+    if (vao_ != 0) glDeleteVertexArrays(1, &vao_);
+    GLuint buffers[] = {mesh_buffer_, index_buffer_, instance_buffer_};
+    glDeleteBuffers(3, buffers);
+    vao_ = mesh_buffer_ = index_buffer_ = instance_buffer_ = 0;
+    buffer_bytes_.set(0);
+}
+
+void MengerRenderer::set_nesting_level(int level) {
+    level_ = std::max(0, std::min(level, kMaxLevel));
+}
+
+void MengerRenderer::set_placement(const glm::vec3& center, float size) {
+    center_ = center;
+    size_ = size;
+}
+
+void MengerRenderer::draw(const glm::mat4& view_projection,
+                          const glm::vec3& eye, float pixel_angle) {
+    frustum_ = Frustum(view_projection);
+    eye_ = eye;
+    pixel_angle_ = pixel_angle;
+    instances_ = 0;
+    triangles_ = 0;
+    draw_calls_ = 0;
+
+    CHECK_GL_ERROR(glBindVertexArray(vao_));
+    visit(center_, size_, level_);
+    for (int mesh = 0; mesh <= kMaxMeshLevel; mesh++) flush(mesh);
+    CHECK_GL_ERROR(glBindVertexArray(0));
+}
+
+void MengerRenderer::visit(const glm::vec3& center, float size,
+                           int remaining) {
+    glm::vec3 half(size * 0.5f);
+    if (!frustum_.intersects(center - half, center + half)) return;
+
+    // Smallest feature that still covers a pixel at this node's distance.
+    float distance = std::max(glm::length(center - eye_) - size * 0.87f,
+                              size * 1e-3f);
+    float feature = distance * pixel_angle_;
+
+    // The coarsest mesh level whose next-finer holes would be sub-pixel.
+    int needed = 0;
+    for (float hole = size / 3; needed < remaining && hole >= feature;
+         hole /= 3)
+        needed++;
+
+    if (needed <= kMaxMeshLevel) {
+        emit(needed, glm::vec4(center, size));
+        return;
+    }
+
+    float third = size / 3;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            for (int k = 0; k < 3; k++)
+                if (i % 2 + j % 2 + k % 2 < 2)
+                    visit(center + glm::vec3(i - 1, j - 1, k - 1) * third,
+                          third, remaining - 1);
+}
+
+void MengerRenderer::emit(int mesh, const glm::vec4& instance) {
+    pending_[mesh].push_back(instance);
+    if (pending_[mesh].size() >= chunk_instances_) flush(mesh);
+}
+
+void MengerRenderer::flush(int level) {
+    auto& pending = pending_[level];
+    if (pending.empty()) return;
+
+    const Mesh& mesh = meshes_[level];
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_));
+    // Orphan the previous chunk so the driver need not wait for its draw.
+    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
+                                sizeof(glm::vec4) * chunk_instances_, nullptr,
+                                GL_STREAM_DRAW));
+    CHECK_GL_ERROR(glBufferSubData(GL_ARRAY_BUFFER, 0,
+                                   sizeof(glm::vec4) * pending.size(),
+                                   pending.data()));
+    CHECK_GL_ERROR(glDrawElementsInstancedBaseVertex(
+        GL_TRIANGLES, mesh.index_count, GL_UNSIGNED_INT,
+        reinterpret_cast<void*>(mesh.index_offset), pending.size(),
+        mesh.base_vertex));
+
+    instances_ += pending.size();
+    triangles_ += pending.size() * mesh.index_count / 3;
+    draw_calls_++;
+    pending.clear();
+}
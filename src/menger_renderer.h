@@ -0,0 +1,84 @@
+#ifndef MENGER_RENDERER_H
+#define MENGER_RENDERER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "frustum.h"
+#include "memory_tracker.h"
+
+// Draws Menger sponges of arbitrary nesting level without building their
+// geometry.
+//
+// Only four small meshes live on the GPU: the face-culled sponges of levels
+// 0 to kMaxMeshLevel. Each frame the sponge is walked as a 20-ary tree;
+// a node that is off screen is skipped, and a node whose remaining detail
+// fits in one of the cached meshes (given its distance and the size of a
+// pixel) is drawn as a single instance of that mesh, scaled and translated.
+// Only closer nodes are subdivided further, so the instance count follows
+// screen resolution rather than 20^level. Instances are streamed through
+// one fixed-size buffer in chunks, bounding memory at any level.
+class MengerRenderer {
+   public:
+    static const int kMaxMeshLevel = 3;
+    static const int kMaxLevel = 10;
+
+    explicit MengerRenderer(size_t chunk_instances = 8192);
+
+    // Builds the cached meshes and buffers. Requires the GL context.
+    void setup();
+    void release();
+
+    void set_nesting_level(int level);
+    int nesting_level() const { return level_; }
+    // World-space centre and edge length of the whole sponge.
+    void set_placement(const glm::vec3& center, float size);
+
+    // Draws with the currently bound program. The instance attribute
+    // (location 1) is vec4(offset, scale). pixel_angle is the angle one
+    // pixel subtends, used to pick the level of detail.
+    void draw(const glm::mat4& view_projection, const glm::vec3& eye,
+              float pixel_angle);
+
+    // Statistics for the last draw().
+    size_t instances() const { return instances_; }
+    size_t triangles() const { return triangles_; }
+    size_t draw_calls() const { return draw_calls_; }
+
+   private:
+    struct Mesh {
+        GLint base_vertex = 0;
+        size_t index_offset = 0;  // bytes
+        GLsizei index_count = 0;
+    };
+
+    void visit(const glm::vec3& center, float size, int remaining);
+    void emit(int mesh, const glm::vec4& instance);
+    void flush(int mesh);
+
+    size_t chunk_instances_;
+    int level_ = 0;
+    glm::vec3 center_ = glm::vec3(0.0f);
+    float size_ = 1.0f;
+
+    GLuint vao_ = 0;
+    GLuint mesh_buffer_ = 0;
+    GLuint index_buffer_ = 0;
+    GLuint instance_buffer_ = 0;
+    TrackedBytes buffer_bytes_{MemoryTag::kGpuBuffers};
+    Mesh meshes_[kMaxMeshLevel + 1];
+    TrackedVector<glm::vec4, MemoryTag::kMeshes> pending_[kMaxMeshLevel + 1];
+
+    // Per-draw traversal state.
+    Frustum frustum_;
+    glm::vec3 eye_;
+    float pixel_angle_ = 0.0f;
+
+    size_t instances_ = 0;
+    size_t triangles_ = 0;
+    size_t draw_calls_ = 0;
+};
+
+#endif
@@ -0,0 +1,420 @@
+#include "mesh_export.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+// Longest OBJ line: "v " plus three shortest round-trip floats.
+const size_t kMaxRecord = 64;
+
+// glTF's JSON chunk is written as blank space up front and filled in on
+// close(), once the counts and bounds are known.
+const size_t kGlbJsonReserve = 1024;
+const size_t kGlbHeaderSize = 12 + 8 + kGlbJsonReserve + 8;
+const uint32_t kGlbMagic = 0x46546c67;  // "glTF"
+const uint32_t kGlbJsonChunk = 0x4e4f534a;  // "JSON"
+const uint32_t kGlbBinChunk = 0x004e4942;   // "BIN\0"
+
+// Counts are zero-padded to a fixed width so the header can be
+// rewritten in place.
+std::string plyHeader(size_t vertices, size_t faces) {
+    char header[256];
+    std::snprintf(header, sizeof(header),
+                  "ply\n"
+                  "format binary_little_endian 1.0\n"
+                  "element vertex %012zu\n"
+                  "property float x\n"
+                  "property float y\n"
+                  "property float z\n"
+                  "element face %012zu\n"
+                  "property list uchar uint vertex_indices\n"
+                  "end_header\n",
+                  vertices, faces);
+    return header;
+}
+
+void appendFloat(std::string& s, float value) {
+    char buffer[32];
+    s.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+}
+
+void appendNumber(std::string& s, size_t value) {
+    char buffer[32];
+    s.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+}
+
+void appendVec3(std::string& s, const glm::vec3& v) {
+    s += '[';
+    for (int i = 0; i < 3; i++) {
+        if (i > 0) s += ',';
+        appendFloat(s, v[i]);
+    }
+    s += ']';
+}
+
+std::string glbJson(size_t vertices, size_t faces, const glm::vec3& lo,
+                    const glm::vec3& hi) {
+    size_t position_bytes = vertices * 12;
+    size_t index_bytes = faces * 12;
+    std::string json =
+        "{\"asset\":{\"version\":\"2.0\",\"generator\":\"our-craft\"},"
+        "\"scene\":0,\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}],"
+        "\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0},"
+        "\"indices\":1}]}],\"buffers\":[{\"byteLength\":";
+    appendNumber(json, position_bytes + index_bytes);
+    json += "}],\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,"
+            "\"byteLength\":";
+    appendNumber(json, position_bytes);
+    json += ",\"target\":34962},{\"buffer\":0,\"byteOffset\":";
+    appendNumber(json, position_bytes);
+    json += ",\"byteLength\":";
+    appendNumber(json, index_bytes);
+    json += ",\"target\":34963}],\"accessors\":[{\"bufferView\":0,"
+            "\"componentType\":5126,\"type\":\"VEC3\",\"count\":";
+    appendNumber(json, vertices);
+    json += ",\"min\":";
+    appendVec3(json, lo);
+    json += ",\"max\":";
+    appendVec3(json, hi);
+    json += "},{\"bufferView\":1,\"componentType\":5125,\"type\":\"SCALAR\","
+            "\"count\":";
+    appendNumber(json, faces * 3);
+    json += "}]}";
+    return json;
+}
+
+void putU32(char* p, uint32_t value) { std::memcpy(p, &value, 4); }
+};  // namespace
+
+// A FILE written through one large buffer. Multi-byte values are stored
+// in host order; every platform we ship on is little-endian, as PLY and
+// glTF require here.
+class MeshExporter::Output {
+   public:
+    Output(FILE* file, size_t capacity)
+        : file_(file), buffer_(std::max(capacity, kMaxRecord)) {}
+    ~Output() { close(); }
+
+    // Room for at least kMaxRecord bytes; hand the end back to commit().
+    char* reserve() {
+        if (size_ + kMaxRecord > buffer_.size()) flush();
+        return buffer_.data() + size_;
+    }
+    void commit(char* end) { size_ = end - buffer_.data(); }
+
+    void append(const void* data, size_t size) {
+        if (size_ + size > buffer_.size()) flush();
+        if (size > buffer_.size()) {
+            ok_ = ok_ && std::fwrite(data, 1, size, file_) == size;
+            written_ += size;
+            return;
+        }
+        std::memcpy(buffer_.data() + size_, data, size);
+        size_ += size;
+    }
+
+    void flush() {
+        if (size_ == 0) return;
+        ok_ = ok_ && std::fwrite(buffer_.data(), 1, size_, file_) == size_;
+        written_ += size_;
+        size_ = 0;
+    }
+
+    // Overwrites bytes already flushed, e.g. a header with final counts.
+    void patch(size_t offset, const void* data, size_t size) {
+        flush();
+        ok_ = ok_ && std::fseek(file_, offset, SEEK_SET) == 0 &&
+              std::fwrite(data, 1, size, file_) == size &&
+              std::fseek(file_, 0, SEEK_END) == 0;
+    }
+
+    // Appends everything written to other so far.
+    void copyFrom(Output& other) {
+        other.flush();
+        std::rewind(other.file_);
+        flush();
+        size_t read;
+        while ((read = std::fread(buffer_.data(), 1, buffer_.size(),
+                                  other.file_)) > 0) {
+            size_ = read;
+            flush();
+        }
+        ok_ = ok_ && !std::ferror(other.file_);
+    }
+
+    bool close() {
+        if (file_ == nullptr) return ok_;
+        flush();
+        ok_ = std::fclose(file_) == 0 && ok_;
+        file_ = nullptr;
+        return ok_;
+    }
+
+    bool ok() const { return ok_; }
+    size_t written() const { return written_ + size_; }
+
+   private:
+    FILE* file_;
+    std::vector<char> buffer_;
+    size_t size_ = 0;
+    size_t written_ = 0;
+    bool ok_ = true;
+};
+
+// Maps exact positions to the index they were first written at. -0 and
+// +0 are the same position.
+class MeshExporter::VertexIndex {
+   public:
+    // Returns the existing index, or records and returns next.
+    unsigned insert(const glm::vec4& v, unsigned next) {
+        Key key;
+        for (int i = 0; i < 3; i++) {
+            float f = v[i] + 0.0f;
+            std::memcpy(&key.bits[i], &f, 4);
+        }
+        return map_.emplace(key, next).first->second;
+    }
+
+   private:
+    struct Key {
+        uint32_t bits[3];
+        bool operator==(const Key& other) const {
+            return bits[0] == other.bits[0] && bits[1] == other.bits[1] &&
+                   bits[2] == other.bits[2];
+        }
+    };
+    struct Hash {
+        size_t operator()(const Key& key) const {
+            uint64_t h = key.bits[0];
+            h = h * 0x9e3779b97f4a7c15ULL ^ key.bits[1];
+            h = h * 0x9e3779b97f4a7c15ULL ^ key.bits[2];
+            return h ^ (h >> 29);
+        }
+    };
+    std::unordered_map<Key, unsigned, Hash> map_;
+};
+
+MeshFormat MeshFormatFromPath(const std::string& path) {
+    size_t dot = path.rfind('.');
+    std::string extension = dot == std::string::npos ? "" : path.substr(dot);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (extension == ".ply") return MeshFormat::kPly;
+    if (extension == ".glb") return MeshFormat::kGlb;
+    return MeshFormat::kObj;
+}
+
+MeshExporter::MeshExporter() {}
+
+MeshExporter::~MeshExporter() {
+    if (out_) close();
+}
+
+bool MeshExporter::open(const std::string& path, const Options& options) {
+    if (out_) close();
+    options_ = options;
+    stats_ = Stats();
+    failed_ = false;
+    start_ = Clock::now();
+    min_bounds_ = glm::vec3(std::numeric_limits<float>::max());
+    max_bounds_ = glm::vec3(-std::numeric_limits<float>::max());
+
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Could not open " << path << " for writing" << std::endl;
+        return false;
+    }
+    out_.reset(new Output(file, options_.buffer_size));
+
+    if (options_.format != MeshFormat::kObj) {
+        FILE* spill = std::tmpfile();
+        if (spill == nullptr) {
+            std::cerr << "Could not create a temporary file for " << path
+                      << std::endl;
+            out_.reset();
+            return false;
+        }
+        spill_.reset(new Output(spill, options_.buffer_size));
+    }
+    if (options_.deduplicate) index_.reset(new VertexIndex());
+    return writeHeader();
+}
+
+bool MeshExporter::writeHeader() {
+    switch (options_.format) {
+        case MeshFormat::kObj: {
+            static const char kHeader[] = "# our-craft mesh export\n";
+            out_->append(kHeader, sizeof(kHeader) - 1);
+            break;
+        }
+        case MeshFormat::kPly: {
+            std::string header = plyHeader(0, 0);
+            out_->append(header.data(), header.size());
+            break;
+        }
+        case MeshFormat::kGlb: {
+            std::vector<char> header(kGlbHeaderSize, ' ');
+            out_->append(header.data(), header.size());
+            break;
+        }
+    }
+    return out_->ok();
+}
+
+bool MeshExporter::write(const glm::vec4* vertices, size_t vertex_count,
+                         const glm::uvec3* faces, size_t face_count) {
+    if (!out_) return false;
+    for (size_t i = 0; i < face_count; i++) {
+        if (std::max(faces[i].x, std::max(faces[i].y, faces[i].z)) >=
+            vertex_count) {
+            std::cerr << "Mesh face " << i << " indexes past its "
+                      << vertex_count << " vertices" << std::endl;
+            failed_ = true;
+            return false;
+        }
+    }
+
+    remap_.resize(vertex_count);
+    for (size_t i = 0; i < vertex_count; i++) {
+        unsigned next = stats_.vertices;
+        remap_[i] = index_ ? index_->insert(vertices[i], next) : next;
+        if (remap_[i] != next) {
+            stats_.duplicates++;
+            continue;
+        }
+        writeVertex(vertices[i]);
+        stats_.vertices++;
+    }
+    for (size_t i = 0; i < face_count; i++) {
+        writeFace(glm::uvec3(remap_[faces[i].x], remap_[faces[i].y],
+                             remap_[faces[i].z]));
+    }
+    stats_.faces += face_count;
+    bool ok = out_->ok() && (!spill_ || spill_->ok());
+    if (!ok) failed_ = true;
+    return ok;
+}
+
+void MeshExporter::writeVertex(const glm::vec4& vertex) {
+    if (options_.format == MeshFormat::kObj) {
+        char* p = out_->reserve();
+        char* end = p + kMaxRecord;
+        *p++ = 'v';
+        for (int i = 0; i < 3; i++) {
+            *p++ = ' ';
+            p = std::to_chars(p, end, vertex[i]).ptr;
+        }
+        *p++ = '\n';
+        out_->commit(p);
+        return;
+    }
+    float xyz[3] = {vertex[0], vertex[1], vertex[2]};
+    out_->append(xyz, sizeof(xyz));
+    min_bounds_ = glm::min(min_bounds_, glm::vec3(vertex));
+    max_bounds_ = glm::max(max_bounds_, glm::vec3(vertex));
+}
+
+void MeshExporter::writeFace(const glm::uvec3& face) {
+    switch (options_.format) {
+        case MeshFormat::kObj: {
+            char* p = out_->reserve();
+            char* end = p + kMaxRecord;
+            *p++ = 'f';
+            for (int i = 0; i < 3; i++) {
+                *p++ = ' ';
+                p = std::to_chars(p, end, face[i] + 1).ptr;
+            }
+            *p++ = '\n';
+            out_->commit(p);
+            break;
+        }
+        case MeshFormat::kPly: {
+            char record[13];
+            record[0] = 3;
+            for (int i = 0; i < 3; i++) putU32(record + 1 + 4 * i, face[i]);
+            spill_->append(record, sizeof(record));
+            break;
+        }
+        case MeshFormat::kGlb: {
+            uint32_t indices[3] = {face.x, face.y, face.z};
+            spill_->append(indices, sizeof(indices));
+            break;
+        }
+    }
+}
+
+bool MeshExporter::writeFooter() {
+    switch (options_.format) {
+        case MeshFormat::kObj:
+            return true;
+        case MeshFormat::kPly: {
+            out_->copyFrom(*spill_);
+            std::string header = plyHeader(stats_.vertices, stats_.faces);
+            out_->patch(0, header.data(), header.size());
+            return true;
+        }
+        case MeshFormat::kGlb: {
+            out_->copyFrom(*spill_);
+            if (stats_.vertices == 0) min_bounds_ = max_bounds_ = glm::vec3(0);
+            std::string json = glbJson(stats_.vertices, stats_.faces,
+                                       min_bounds_, max_bounds_);
+            if (json.size() > kGlbJsonReserve) {
+                std::cerr << "glTF header does not fit its reserved space"
+                          << std::endl;
+                return false;
+            }
+            // Spaces are valid JSON chunk padding.
+            json.resize(kGlbJsonReserve, ' ');
+
+            size_t bin_bytes = (stats_.vertices + stats_.faces) * 12;
+            std::vector<char> header(kGlbHeaderSize);
+            char* p = header.data();
+            putU32(p, kGlbMagic);
+            putU32(p + 4, 2);
+            putU32(p + 8, kGlbHeaderSize + bin_bytes);
+            putU32(p + 12, kGlbJsonReserve);
+            putU32(p + 16, kGlbJsonChunk);
+            std::memcpy(p + 20, json.data(), kGlbJsonReserve);
+            putU32(p + 20 + kGlbJsonReserve, bin_bytes);
+            putU32(p + 24 + kGlbJsonReserve, kGlbBinChunk);
+            out_->patch(0, header.data(), header.size());
+            return true;
+        }
+    }
+    return true;
+}
+
+bool MeshExporter::close() {
+    if (!out_) return false;
+    bool ok = !failed_ && writeFooter();
+    stats_.bytes = out_->written();
+    ok = out_->close() && ok;
+    if (spill_) spill_->close();
+    out_.reset();
+    spill_.reset();
+    index_.reset();
+    std::vector<unsigned>().swap(remap_);
+    stats_.ms =
+        std::chrono::duration<double, std::milli>(Clock::now() - start_)
+            .count();
+    return ok;
+}
+
+bool SaveMesh(const std::string& path, const std::vector<glm::vec4>& vertices,
+              const std::vector<glm::uvec3>& faces) {
+    MeshExporter::Options options;
+    options.format = MeshFormatFromPath(path);
+    MeshExporter exporter;
+    bool ok = exporter.open(path, options) &&
+              exporter.write(vertices, faces) && exporter.close();
+    if (!ok) std::cerr << "Could not export mesh to " << path << std::endl;
+    return ok;
+}
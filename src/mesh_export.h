@@ -0,0 +1,93 @@
+#ifndef MESH_EXPORT_H
+#define MESH_EXPORT_H
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class MeshFormat {
+    kObj,  // Wavefront text
+    kPly,  // binary little-endian PLY
+    kGlb,  // binary glTF 2.0
+};
+
+// Picks the format from the file extension (.obj, .ply, .glb); anything
+// else is written as OBJ.
+MeshFormat MeshFormatFromPath(const std::string& path);
+
+// Streams triangle meshes to disk without keeping them in memory.
+//
+// Meshes are appended part by part (a chunk, a block of the Menger
+// sponge, ...), and each part's face indices refer to its own vertices.
+// Output goes through one large buffer that is written out with a single
+// fwrite whenever it fills, and numbers are formatted with std::to_chars,
+// so exporting is bound by the disk rather than by iostreams.
+//
+// PLY and glTF need every vertex before the first face, so their faces
+// are spilled to an anonymous temporary file and appended on close(),
+// which also patches the element counts into the header.
+class MeshExporter {
+   public:
+    struct Options {
+        MeshFormat format = MeshFormat::kObj;
+        // Merge vertices with identical positions across all parts. Costs
+        // one hash entry per unique vertex for the life of the export.
+        bool deduplicate = true;
+        size_t buffer_size = 4 << 20;
+    };
+
+    struct Stats {
+        size_t vertices = 0;  // written, after deduplication
+        size_t duplicates = 0;
+        size_t faces = 0;
+        size_t bytes = 0;
+        double ms = 0.0;  // from open() to the end of close()
+    };
+
+    MeshExporter();
+    ~MeshExporter();
+
+    bool open(const std::string& path, const Options& options);
+    bool write(const glm::vec4* vertices, size_t vertex_count,
+               const glm::uvec3* faces, size_t face_count);
+    bool write(const std::vector<glm::vec4>& vertices,
+               const std::vector<glm::uvec3>& faces) {
+        return write(vertices.data(), vertices.size(), faces.data(),
+                     faces.size());
+    }
+    // Finishes the file. Returns false if any write failed along the way.
+    bool close();
+
+    const Stats& stats() const { return stats_; }
+
+   private:
+    class Output;
+    class VertexIndex;
+
+    bool writeHeader();
+    bool writeFooter();
+    void writeVertex(const glm::vec4& vertex);
+    void writeFace(const glm::uvec3& face);
+
+    Options options_;
+    std::unique_ptr<Output> out_;
+    std::unique_ptr<Output> spill_;  // faces for PLY and glTF
+    std::unique_ptr<VertexIndex> index_;
+    std::vector<unsigned> remap_;
+    glm::vec3 min_bounds_;
+    glm::vec3 max_bounds_;
+    Stats stats_;
+    bool failed_ = false;  // a write() since open() returned false
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Writes a whole mesh in the format implied by path.
+bool SaveMesh(const std::string& path, const std::vector<glm::vec4>& vertices,
+              const std::vector<glm::uvec3>& faces);
+
+#endif
@@ -4,6 +4,8 @@
 #include <random>
 #include <vector>
 
+#include "memory_tracker.h"
+
 class JavaRandom;
 
 class Noise {
@@ -18,7 +20,7 @@ class Noise {
 };
 
 class OctaveNoise {
-    std::vector<Noise> noises;
+    TrackedVector<Noise, MemoryTag::kNoise> noises;
 
    public:
     OctaveNoise(){};
@@ -0,0 +1,277 @@
+#include "occlusion_culler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <limits>
+
+#include "simd.h"
+#include "trace.h"
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+// Occluders are clipped at this clip-space w (view distance) instead of at
+// the projection's near plane, which is too close for stable screen
+// coordinates. Clipping only removes occluding area, so it stays safe.
+const float kNearW = 0.05f;
+
+// Occluders must be nearer than a box by this fraction of its depth to
+// hide it, which absorbs rounding where box faces lie on occluder faces.
+const float kDepthBias = 1e-3f;
+
+// Box faces as corner indices (bit 0: x, bit 1: y, bit 2: z of hi rather
+// than lo), counter-clockwise seen from outside.
+const int kFaces[6][4] = {
+    {0, 4, 6, 2}, {1, 3, 7, 5},  // -x, +x
+    {0, 1, 5, 4}, {2, 6, 7, 3},  // -y, +y
+    {0, 2, 3, 1}, {4, 5, 7, 6},  // -z, +z
+};
+
+glm::vec3 corner(const OcclusionCuller::Box& box, int i) {
+    return glm::vec3(i & 1 ? box.hi.x : box.lo.x, i & 2 ? box.hi.y : box.lo.y,
+                     i & 4 ? box.hi.z : box.lo.z);
+}
+
+double millisSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+}
+};  // namespace
+
+OcclusionCuller::OcclusionCuller(int width, int height)
+    : width_((std::max(width, 4) + 3) & ~3),
+      height_(std::max(height, 1)),
+      depth_(width_ * height_) {}
+
+void OcclusionCuller::render(const glm::mat4& view_projection,
+                             const std::vector<Box>& occluders,
+                             ThreadPool* pool) {
+    TRACE_SCOPE("OcclusionCuller::render");
+    Clock::time_point start = Clock::now();
+    stats_ = Stats();
+    stats_.occluders = occluders.size();
+    view_projection_ = view_projection;
+    std::fill(depth_.begin(), depth_.end(),
+              std::numeric_limits<float>::infinity());
+
+    // Triangle setup over slices of the occluders, then rasterisation
+    // over bands of rows; each band only writes its own rows.
+    size_t jobs = pool ? std::max<size_t>(pool->size(), 1) : 1;
+    triangles_.resize(jobs);
+    size_t slice = (occluders.size() + jobs - 1) / jobs;
+    int bands = std::min<int>(height_, jobs * 2);
+    int rows = (height_ + bands - 1) / bands;
+    if (jobs == 1) {
+        setup(occluders.data(), occluders.size(), &triangles_[0]);
+        rasterize(0, height_);
+    } else {
+        std::vector<std::future<void>> done;
+        for (size_t i = 0; i < jobs; i++) {
+            size_t begin = std::min(i * slice, occluders.size());
+            size_t count = std::min(slice, occluders.size() - begin);
+            done.push_back(pool->submit([this, &occluders, begin, count, i]() {
+                setup(occluders.data() + begin, count, &triangles_[i]);
+            }));
+        }
+        for (auto& job : done) job.get();
+        done.clear();
+        for (int row = 0; row < height_; row += rows) {
+            int end = std::min(row + rows, height_);
+            done.push_back(
+                pool->submit([this, row, end]() { rasterize(row, end); }));
+        }
+        for (auto& job : done) job.get();
+    }
+
+    for (const auto& list : triangles_) stats_.triangles += list.size();
+    stats_.raster_ms = millisSince(start);
+}
+
+void OcclusionCuller::setup(const Box* boxes, size_t count,
+                            std::vector<Triangle>* triangles) const {
+    triangles->clear();
+    for (size_t b = 0; b < count; b++) {
+        glm::vec4 clip[8];
+        for (int i = 0; i < 8; i++)
+            clip[i] = view_projection_ * glm::vec4(corner(boxes[b], i), 1.0f);
+        for (const auto& face : kFaces) {
+            glm::vec4 polygon[4] = {clip[face[0]], clip[face[1]],
+                                    clip[face[2]], clip[face[3]]};
+            addPolygon(polygon, 4, triangles);
+        }
+    }
+}
+
+// Clips a convex polygon at kNearW, projects it to pixels and appends it
+// as a fan of triangles unless it faces away. Triangles carry 1 / w, which
+// unlike w itself is linear across the screen.
+void OcclusionCuller::addPolygon(const glm::vec4* clip, int count,
+                                 std::vector<Triangle>* triangles) const {
+    glm::vec3 screen[8];
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        const glm::vec4& a = clip[i];
+        const glm::vec4& b = clip[(i + 1) % count];
+        float da = a.w - kNearW, db = b.w - kNearW;
+        glm::vec4 kept[2];
+        int k = 0;
+        if (da >= 0.0f) kept[k++] = a;
+        if ((da >= 0.0f) != (db >= 0.0f))
+            kept[k++] = a + (b - a) * (da / (da - db));
+        for (int j = 0; j < k; j++)
+            screen[n++] = glm::vec3(
+                (kept[j].x / kept[j].w * 0.5f + 0.5f) * width_,
+                (kept[j].y / kept[j].w * 0.5f + 0.5f) * height_,
+                1.0f / kept[j].w);
+    }
+    if (n < 3) return;
+
+    for (int i = 1; i + 1 < n; i++) {
+        const glm::vec3& v0 = screen[0];
+        const glm::vec3& v1 = screen[i];
+        const glm::vec3& v2 = screen[i + 1];
+        // Counter-clockwise on screen (y up) is front facing.
+        float area =
+            (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+        if (!(area > 0.0f)) continue;
+
+        Triangle t;
+        const glm::vec3* v[3] = {&v0, &v1, &v2};
+        for (int e = 0; e < 3; e++) {
+            t.ax[e] = v[e]->x;
+            t.ay[e] = v[e]->y;
+            t.ex[e] = v[(e + 1) % 3]->x - v[e]->x;
+            t.ey[e] = v[(e + 1) % 3]->y - v[e]->y;
+        }
+        t.z0 = v0.z;
+        t.dzdx = ((v1.z - v0.z) * (v2.y - v0.y) -
+                  (v2.z - v0.z) * (v1.y - v0.y)) /
+                 area;
+        t.dzdy = ((v2.z - v0.z) * (v1.x - v0.x) -
+                  (v1.z - v0.z) * (v2.x - v0.x)) /
+                 area;
+        float lo_x = std::min(v0.x, std::min(v1.x, v2.x));
+        float hi_x = std::max(v0.x, std::max(v1.x, v2.x));
+        float lo_y = std::min(v0.y, std::min(v1.y, v2.y));
+        float hi_y = std::max(v0.y, std::max(v1.y, v2.y));
+        t.x0 = std::max(0, int(std::floor(std::max(lo_x, -1.0f))));
+        t.x1 = std::min(width_ - 1, int(std::ceil(std::min(hi_x, 1e6f))));
+        t.y0 = std::max(0, int(std::floor(std::max(lo_y, -1.0f))));
+        t.y1 = std::min(height_ - 1, int(std::ceil(std::min(hi_y, 1e6f))));
+        if (t.x0 > t.x1 || t.y0 > t.y1) continue;
+        triangles->push_back(t);
+    }
+}
+
+void OcclusionCuller::rasterize(int row_begin, int row_end) {
+    const Float4 kOffsets(0.5f, 1.5f, 2.5f, 3.5f);
+    const Float4 kZero(0.0f);
+    const Float4 kOne(1.0f);
+    for (const auto& list : triangles_) {
+        for (const Triangle& t : list) {
+            int y0 = std::max(t.y0, row_begin);
+            int y1 = std::min(t.y1, row_end - 1);
+            int x0 = t.x0 & ~3;
+            Float4 step[3], z_step(t.dzdx * 4.0f);
+            for (int e = 0; e < 3; e++) step[e] = Float4(-t.ey[e] * 4.0f);
+
+            for (int y = y0; y <= y1; y++) {
+                // Edge functions and 1 / depth at the pixel centres of
+                // the first four pixels of the row.
+                float py = y + 0.5f;
+                Float4 edge[3];
+                for (int e = 0; e < 3; e++)
+                    edge[e] = Float4(t.ex[e] * (py - t.ay[e]) -
+                                     t.ey[e] * (x0 - t.ax[e])) -
+                              Float4(t.ey[e]) * kOffsets;
+                Float4 z = Float4(t.z0 + t.dzdx * (x0 - t.ax[0]) +
+                                  t.dzdy * (py - t.ay[0])) +
+                           Float4(t.dzdx) * kOffsets;
+
+                float* row = &depth_[y * width_];
+                for (int x = x0; x <= t.x1; x += 4) {
+                    Float4 outside =
+                        (edge[0] < kZero) | (edge[1] < kZero) |
+                        (edge[2] < kZero);
+                    if (laneMask(outside) != 0xF) {
+                        Float4 d = Float4::load(row + x);
+                        select(outside, d, min(d, kOne / z)).store(row + x);
+                    }
+                    for (int e = 0; e < 3; e++) edge[e] = edge[e] + step[e];
+                    z = z + z_step;
+                }
+            }
+        }
+    }
+}
+
+void OcclusionCuller::test(const std::vector<Box>& boxes,
+                           std::vector<bool>* visible) {
+    Clock::time_point start = Clock::now();
+    visible->assign(boxes.size(), false);
+    for (size_t i = 0; i < boxes.size(); i++) {
+        (*visible)[i] = this->visible(boxes[i]);
+        if (!(*visible)[i]) stats_.occluded++;
+    }
+    stats_.tested += boxes.size();
+    stats_.test_ms += millisSince(start);
+}
+
+bool OcclusionCuller::visible(const Box& box) const {
+    float lo_x = std::numeric_limits<float>::max(), hi_x = -lo_x;
+    float lo_y = lo_x, hi_y = hi_x, near_w = lo_x;
+    for (int i = 0; i < 8; i++) {
+        glm::vec4 clip = view_projection_ * glm::vec4(corner(box, i), 1.0f);
+        // Boxes reaching behind the occluders' near plane are kept.
+        if (clip.w < kNearW) return true;
+        float x = (clip.x / clip.w * 0.5f + 0.5f) * width_;
+        float y = (clip.y / clip.w * 0.5f + 0.5f) * height_;
+        lo_x = std::min(lo_x, x);
+        hi_x = std::max(hi_x, x);
+        lo_y = std::min(lo_y, y);
+        hi_y = std::max(hi_y, y);
+        near_w = std::min(near_w, clip.w);
+    }
+    // One pixel of margin around the rectangle.
+    int x0 = std::max(0, int(std::floor(lo_x)) - 1) & ~3;
+    int x1 = std::min(width_ - 1, int(std::ceil(hi_x)) + 1);
+    int y0 = std::max(0, int(std::floor(lo_y)) - 1);
+    int y1 = std::min(height_ - 1, int(std::ceil(hi_y)) + 1);
+    if (x0 > x1 || y0 > y1) return false;  // off screen
+
+    Float4 nearest(near_w * (1.0f - kDepthBias));
+    for (int y = y0; y <= y1; y++) {
+        const float* row = &depth_[y * width_];
+        for (int x = x0; x <= x1; x += 4)
+            if (laneMask(Float4::load(row + x) > nearest)) return true;
+    }
+    return false;
+}
+
+void OcclusionCuller::farthestDepthPyramid(std::vector<float>* texels,
+                                           std::vector<Level>* levels) const {
+    *texels = depth_;
+    levels->assign(1, Level{0, width_, height_});
+    while (levels->back().width > 1 || levels->back().height > 1) {
+        Level below = levels->back();
+        Level level = {int(texels->size()), (below.width + 1) / 2,
+                       (below.height + 1) / 2};
+        texels->resize(texels->size() + level.width * level.height);
+        float* out = &(*texels)[level.offset];
+        const float* in = &(*texels)[below.offset];
+        for (int y = 0; y < level.height; y++) {
+            int y0 = 2 * y, y1 = std::min(2 * y + 1, below.height - 1);
+            for (int x = 0; x < level.width; x++) {
+                int x0 = 2 * x, x1 = std::min(2 * x + 1, below.width - 1);
+                out[x + y * level.width] = std::max(
+                    std::max(in[x0 + y0 * below.width],
+                             in[x1 + y0 * below.width]),
+                    std::max(in[x0 + y1 * below.width],
+                             in[x1 + y1 * below.width]));
+            }
+        }
+        levels->push_back(level);
+    }
+}
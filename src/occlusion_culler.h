@@ -0,0 +1,97 @@
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "thread_pool.h"
+
+// Coarse occlusion culling on the CPU.
+//
+// render() rasterises the front faces of solid boxes into a small depth
+// buffer, keeping the nearest depth per pixel; test() then reports a box as
+// hidden only if every pixel its screen rectangle touches already holds
+// something clearly nearer than the box's nearest corner. Depth is view
+// depth, clip-space w, rather than normalised device depth, which a near
+// plane as close as the game's leaves within rounding of 1 beyond a few
+// blocks. Occluders are clipped
+// against a near plane a little in front of the camera, which only ever
+// removes occluding area, and tested rectangles are grown by a pixel to
+// cover the pixels occluders only partly fill. Both passes work on four
+// pixels at a time with Float4; render() also splits the buffer into bands
+// of rows across the pool's threads, while test() runs on the calling
+// thread.
+class OcclusionCuller {
+   public:
+    struct Box {
+        glm::vec3 lo, hi;
+    };
+
+    struct Stats {
+        size_t occluders = 0;
+        size_t triangles = 0;  // after back-face culling and clipping
+        size_t tested = 0;
+        size_t occluded = 0;
+        double raster_ms = 0.0;
+        double test_ms = 0.0;
+    };
+
+    // Where one level of a depth pyramid lies in its packed texels.
+    struct Level {
+        int offset;
+        int width, height;
+    };
+
+    // The width is rounded up to a multiple of four.
+    explicit OcclusionCuller(int width = 256, int height = 128);
+
+    // Clears the depth buffer and draws the occluders into it. Every
+    // occluder must be solid throughout. The pool may be null.
+    void render(const glm::mat4& view_projection,
+                const std::vector<Box>& occluders, ThreadPool* pool);
+    // Sets visible[i] unless boxes[i] is certainly hidden behind the
+    // occluders of the last render().
+    void test(const std::vector<Box>& boxes, std::vector<bool>* visible);
+
+    // Statistics for the last render() and test().
+    const Stats& stats() const { return stats_; }
+    int width() const { return width_; }
+    int height() const { return height_; }
+    // View depth (clip-space w) per pixel, bottom row first; +infinity
+    // where nothing was drawn.
+    const std::vector<float>& depth() const { return depth_; }
+    // Hierarchical depth for testing boxes elsewhere, e.g. on the GPU.
+    // Level 0 is depth(); each further level halves the one below,
+    // rounding up, and keeps the farthest of the up to four depths each
+    // of its texels covers, so pixel (x, y) lies in texel (x >> l, y >> l)
+    // of level l. Levels are packed one after another down to 1 x 1.
+    void farthestDepthPyramid(std::vector<float>* texels,
+                              std::vector<Level>* levels) const;
+
+   private:
+    // A screen-space triangle set up for edge-function rasterisation.
+    struct Triangle {
+        float ax[3], ay[3];  // edge start points
+        float ex[3], ey[3];  // edge vectors
+        float z0, dzdx, dzdy;
+        int x0, x1, y0, y1;  // inclusive pixel bounds
+    };
+
+    void setup(const Box* boxes, size_t count,
+               std::vector<Triangle>* triangles) const;
+    void addPolygon(const glm::vec4* clip, int count,
+                    std::vector<Triangle>* triangles) const;
+    void rasterize(int row_begin, int row_end);
+    bool visible(const Box& box) const;
+
+    int width_;
+    int height_;
+    std::vector<float> depth_;
+    glm::mat4 view_projection_;
+    // One list per setup job; every band reads them all.
+    std::vector<std::vector<Triangle>> triangles_;
+    Stats stats_;
+};
+
+#endif
@@ -0,0 +1,343 @@
+#include "raymarcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+
+#include "terrain.h"
+#include "thread_pool.h"
+
+namespace {
+// Deeper iterations only add holes far below a pixel at any sane
+// resolution, and 3^10 still keeps the folded coordinates in int range.
+const int kMaxMengerIterations = 10;
+const float kFar = 1e9f;
+
+const glm::vec3 kSunDirection = glm::normalize(glm::vec3(-0.4f, 0.8f, -0.6f));
+const glm::vec3 kHorizonColor(0.75f, 0.85f, 0.95f);
+const glm::vec3 kZenithColor(0.3f, 0.5f, 0.85f);
+const float kFogDensity = 0.003f;
+
+// The same bands the terrain fragment shader uses.
+const glm::vec3 kWaterColor(0.1f, 0.4f, 0.8f);
+const glm::vec3 kGrassColor(0.3f, 0.8f, 0.15f);
+const glm::vec3 kStoneColor(0.7f, 0.7f, 0.7f);
+const glm::vec3 kMengerColor(0.75f, 0.7f, 0.6f);
+
+int bitCount(int mask) {
+    int count = 0;
+    for (; mask != 0; mask &= mask - 1) count++;
+    return count;
+}
+
+unsigned char toByte(float x) {
+    return static_cast<unsigned char>(
+        std::min(std::max(x, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+};  // namespace
+
+HeightField HeightField::fromTerrain(Terrain& terrain, glm::ivec2 center_chunk,
+                                     int radius) {
+    int size = terrain.size;
+    int chunks = 2 * radius + 1;
+
+    HeightField field;
+    field.origin_x_ = (center_chunk.x - radius) * size;
+    field.origin_z_ = (center_chunk.y - radius) * size;
+    field.width_ = chunks * size;
+    field.depth_ = chunks * size;
+    field.heights_.resize(field.width_ * field.depth_);
+
+    for (int cz = 0; cz < chunks; cz++) {
+        for (int cx = 0; cx < chunks; cx++) {
+            glm::ivec2 chunk_coords =
+                center_chunk + glm::ivec2(cx - radius, cz - radius);
+            std::vector<float> heights =
+                terrain.getChunk(chunk_coords)
+                    .regionHeights(0, 0, size, size,
+                                   terrain.getSmoothingRadius());
+            for (int z = 0; z < size; z++)
+                for (int x = 0; x < size; x++)
+                    // Surface cubes sit at round(height) and are one tall.
+                    field.heights_[(cz * size + z) * field.width_ +
+                                   cx * size + x] =
+                        std::round(heights[x + z * size]) + 1.0f;
+        }
+    }
+
+    // Bilinear interpolation never changes faster than the largest step
+    // between neighbouring columns along each axis.
+    float step = 0.0f;
+    for (int z = 0; z < field.depth_; z++) {
+        for (int x = 0; x < field.width_; x++) {
+            if (x + 1 < field.width_)
+                step = std::max(step, std::fabs(field.at(x + 1, z) -
+                                                field.at(x, z)));
+            if (z + 1 < field.depth_)
+                step = std::max(step, std::fabs(field.at(x, z + 1) -
+                                                field.at(x, z)));
+        }
+    }
+    field.max_slope_ = step * std::sqrt(2.0f);
+    field.max_height_ =
+        *std::max_element(field.heights_.begin(), field.heights_.end());
+    return field;
+}
+
+float HeightField::at(int x, int z) const {
+    x = std::min(std::max(x, 0), width_ - 1);
+    z = std::min(std::max(z, 0), depth_ - 1);
+    return heights_[z * width_ + x];
+}
+
+float HeightField::height(float x, float z) const {
+    // Column i covers [i, i + 1); interpolate between column centres.
+    float gx = x - origin_x_ - 0.5f;
+    float gz = z - origin_z_ - 0.5f;
+    float fx = std::floor(gx);
+    float fz = std::floor(gz);
+    int ix = static_cast<int>(std::max(std::min(fx, 1e8f), -1e8f));
+    int iz = static_cast<int>(std::max(std::min(fz, 1e8f), -1e8f));
+    float tx = gx - fx;
+    float tz = gz - fz;
+    float h0 = at(ix, iz) + (at(ix + 1, iz) - at(ix, iz)) * tx;
+    float h1 = at(ix, iz + 1) + (at(ix + 1, iz + 1) - at(ix, iz + 1)) * tx;
+    return h0 + (h1 - h0) * tz;
+}
+
+// Per-render camera basis, shared read-only by the tiles.
+struct RayMarcher::Frame {
+    Options options;
+    glm::vec3 eye;
+    glm::vec3 forward;
+    glm::vec3 right;  // scaled to the half-width of the image plane
+    glm::vec3 up;     // scaled to the half-height of the image plane
+    float pixel_angle;
+};
+
+RayMarcher::RayMarcher(const Scene& scene) : scene_(scene) {
+    scene_.menger_level = std::min(scene_.menger_level, kMaxMengerIterations);
+    if (scene_.terrain != nullptr && !scene_.terrain->empty()) {
+        float slope = scene_.terrain->maxSlope();
+        terrain_step_ = 1.0f / std::sqrt(1.0f + slope * slope);
+    } else {
+        scene_.terrain = nullptr;
+    }
+}
+
+RayMarcher::Stats RayMarcher::render(const View& view, const Options& options,
+                                     ThreadPool* pool,
+                                     std::vector<unsigned char>* rgb) const {
+    auto start = std::chrono::steady_clock::now();
+
+    Frame frame;
+    frame.options = options;
+    frame.eye = view.eye;
+    frame.forward = glm::normalize(view.target - view.eye);
+    float half_height = std::tan(view.fov_y * 0.5f);
+    float half_width = half_height * options.width / options.height;
+    glm::vec3 right = glm::normalize(glm::cross(frame.forward, view.up));
+    frame.right = right * half_width;
+    frame.up = glm::cross(right, frame.forward) * half_height;
+    frame.pixel_angle = view.fov_y / options.height;
+
+    rgb->resize(size_t(options.width) * options.height * 3);
+    unsigned char* pixels = rgb->data();
+
+    // Tiles are rounded up to whole packets.
+    int tile = std::max(options.tile_size, Float4::kWidth);
+    tile = (tile + Float4::kWidth - 1) / Float4::kWidth * Float4::kWidth;
+
+    Stats stats;
+    std::vector<std::future<size_t>> tiles;
+    for (int y = 0; y < options.height; y += tile) {
+        for (int x = 0; x < options.width; x += tile) {
+            int x1 = std::min(x + tile, options.width);
+            int y1 = std::min(y + tile, options.height);
+            if (pool != nullptr) {
+                tiles.push_back(pool->submit([=, this, &frame]() {
+                    return renderTile(frame, x, y, x1, y1, pixels);
+                }));
+            } else {
+                stats.steps += renderTile(frame, x, y, x1, y1, pixels);
+            }
+        }
+    }
+    for (auto& steps : tiles) stats.steps += steps.get();
+
+    stats.rays = size_t(options.width) * options.height;
+    stats.ms = std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+    return stats;
+}
+
+size_t RayMarcher::renderTile(const Frame& frame, int x0, int y0, int x1,
+                              int y1, unsigned char* rgb) const {
+    const Options& options = frame.options;
+    const float kLaneOffsets[4] = {0.5f, 1.5f, 2.5f, 3.5f};
+    const Float4 lane_offset = Float4::load(kLaneOffsets);
+    const Float4 to_ndc = Float4(2.0f / options.width);
+    size_t steps = 0;
+
+    for (int y = y0; y < y1; y++) {
+        float v = 1.0f - (y + 0.5f) * 2.0f / options.height;
+        for (int x = x0; x < x1; x += Float4::kWidth) {
+            Float4 u = (Float4(float(x)) + lane_offset) * to_ndc - Float4(1.0f);
+            Float4 dx = Float4(frame.forward.x + v * frame.up.x) +
+                        u * Float4(frame.right.x);
+            Float4 dy = Float4(frame.forward.y + v * frame.up.y) +
+                        u * Float4(frame.right.y);
+            Float4 dz = Float4(frame.forward.z + v * frame.up.z) +
+                        u * Float4(frame.right.z);
+            Float4 inverse_length =
+                Float4(1.0f) / sqrt(dx * dx + dy * dy + dz * dz);
+            dx *= inverse_length;
+            dy *= inverse_length;
+            dz *= inverse_length;
+
+            // Lanes past the right edge of the image start out finished.
+            Float4 active = Float4(float(x)) + lane_offset <
+                            Float4(float(options.width));
+            Float4 hit(0.0f);
+            Float4 t(0.0f);
+            Float4 menger(0.0f);
+            for (int step = 0; step < options.max_steps && any(active);
+                 step++) {
+                steps += bitCount(laneMask(active));
+                Float4 d = distance(Float4(frame.eye.x) + dx * t,
+                                    Float4(frame.eye.y) + dy * t,
+                                    Float4(frame.eye.z) + dz * t, &menger);
+                // Stop once the surface is within a fraction of a pixel.
+                Float4 epsilon =
+                    max(t * Float4(frame.pixel_angle * 0.5f), Float4(1e-4f));
+                Float4 arrived = active & (d < epsilon);
+                hit = hit | arrived;
+                active = andNot(active, arrived);
+                t = select(active, t + d, t);
+                active = active & (t < Float4(options.max_distance));
+            }
+
+            // Normals from the tetrahedral difference of the distance.
+            Float4 px = Float4(frame.eye.x) + dx * t;
+            Float4 py = Float4(frame.eye.y) + dy * t;
+            Float4 pz = Float4(frame.eye.z) + dz * t;
+            Float4 e = max(t * Float4(frame.pixel_angle), Float4(1e-3f));
+            Float4 unused;
+            Float4 d0 = distance(px + e, py - e, pz - e, &unused);
+            Float4 d1 = distance(px - e, py - e, pz + e, &unused);
+            Float4 d2 = distance(px - e, py + e, pz - e, &unused);
+            Float4 d3 = distance(px + e, py + e, pz + e, &unused);
+            Float4 nx = d0 - d1 - d2 + d3;
+            Float4 ny = d2 + d3 - d0 - d1;
+            Float4 nz = d1 + d3 - d0 - d2;
+            Float4 inverse_normal = Float4(1.0f) /
+                                    max(sqrt(nx * nx + ny * ny + nz * nz),
+                                        Float4(1e-20f));
+            Float4 diffuse = max(
+                (nx * Float4(kSunDirection.x) + ny * Float4(kSunDirection.y) +
+                 nz * Float4(kSunDirection.z)) *
+                    inverse_normal,
+                Float4(0.0f));
+
+            // Colour the few lanes per packet in scalar code.
+            float lane_t[4], lane_y[4], lane_dy[4], lane_diffuse[4];
+            t.store(lane_t);
+            py.store(lane_y);
+            dy.store(lane_dy);
+            diffuse.store(lane_diffuse);
+            int hit_lanes = laneMask(hit);
+            int menger_lanes = laneMask(menger);
+            for (int lane = 0; lane < Float4::kWidth && x + lane < x1;
+                 lane++) {
+                glm::vec3 sky = glm::mix(kHorizonColor, kZenithColor,
+                                         std::max(lane_dy[lane], 0.0f));
+                glm::vec3 color = sky;
+                if (hit_lanes & (1 << lane)) {
+                    glm::vec3 base;
+                    if (menger_lanes & (1 << lane))
+                        base = kMengerColor;
+                    else if (lane_y[lane] < 0.125f)
+                        base = kWaterColor;
+                    else if (lane_y[lane] < 10.025f)
+                        base = kGrassColor;
+                    else
+                        base = kStoneColor;
+                    color = base * (0.3f + 0.7f * lane_diffuse[lane]);
+                    float fog = std::exp(-lane_t[lane] * kFogDensity);
+                    color = glm::mix(sky, color, fog);
+                }
+                unsigned char* out =
+                    rgb + (size_t(y) * options.width + x + lane) * 3;
+                out[0] = toByte(color[0]);
+                out[1] = toByte(color[1]);
+                out[2] = toByte(color[2]);
+            }
+        }
+    }
+    return steps;
+}
+
+Float4 RayMarcher::distance(Float4 x, Float4 y, Float4 z,
+                            Float4* menger) const {
+    Float4 terrain =
+        scene_.terrain ? terrainDistance(x, y, z) : Float4(kFar);
+    if (scene_.menger_level < 0) {
+        *menger = Float4(0.0f);
+        return terrain;
+    }
+    Float4 sponge = mengerDistance(x, y, z);
+    *menger = sponge < terrain;
+    return min(sponge, terrain);
+}
+
+Float4 RayMarcher::mengerDistance(Float4 x, Float4 y, Float4 z) const {
+    // Work in the sponge's frame, where it spans [-1, 1]^3.
+    float half_size = scene_.menger_size * 0.5f;
+    Float4 inverse_half(1.0f / half_size);
+    Float4 qx = (x - Float4(scene_.menger_center.x)) * inverse_half;
+    Float4 qy = (y - Float4(scene_.menger_center.y)) * inverse_half;
+    Float4 qz = (z - Float4(scene_.menger_center.z)) * inverse_half;
+
+    // Distance to the unit box.
+    Float4 one(1.0f), zero(0.0f);
+    Float4 bx = abs(qx) - one;
+    Float4 by = abs(qy) - one;
+    Float4 bz = abs(qz) - one;
+    Float4 ox = max(bx, zero), oy = max(by, zero), oz = max(bz, zero);
+    Float4 d = min(max(bx, max(by, bz)), zero) +
+               sqrt(ox * ox + oy * oy + oz * oz);
+
+    // Carve the cross-shaped tunnels of each level: fold space into one
+    // cell of that level and take the distance to its cross.
+    Float4 two(2.0f), half(0.5f), three(3.0f);
+    float scale = 1.0f;
+    for (int level = 0; level < scene_.menger_level; level++) {
+        Float4 s(scale);
+        Float4 ax = qx * s, ay = qy * s, az = qz * s;
+        ax = ax - two * floor(ax * half) - one;
+        ay = ay - two * floor(ay * half) - one;
+        az = az - two * floor(az * half) - one;
+        scale *= 3.0f;
+        Float4 rx = abs(one - three * abs(ax));
+        Float4 ry = abs(one - three * abs(ay));
+        Float4 rz = abs(one - three * abs(az));
+        Float4 cross = min(max(rx, ry), min(max(ry, rz), max(rz, rx)));
+        d = max(d, (cross - one) * Float4(1.0f / scale));
+    }
+    return d * Float4(half_size);
+}
+
+Float4 RayMarcher::terrainDistance(Float4 x, Float4 y, Float4 z) const {
+    float lane_x[4], lane_z[4], lane_h[4];
+    x.store(lane_x);
+    z.store(lane_z);
+    for (int lane = 0; lane < Float4::kWidth; lane++)
+        lane_h[lane] = scene_.terrain->height(lane_x[lane], lane_z[lane]);
+    // The slope-scaled estimate is very conservative for steep columns;
+    // high above the terrain the distance to its highest point is a
+    // tighter bound.
+    return max((y - Float4::load(lane_h)) * Float4(terrain_step_),
+               y - Float4(scene_.terrain->maxHeight()));
+}
@@ -0,0 +1,107 @@
+#ifndef RAYMARCHER_H
+#define RAYMARCHER_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+#include "simd.h"
+
+class Terrain;
+class ThreadPool;
+
+// Terrain column heights resampled into a flat grid so they can be read
+// from many threads at once (Terrain itself generates chunks lazily and is
+// not thread safe). Heights are the tops of the surface cubes, and are
+// interpolated bilinearly between column centres.
+class HeightField {
+   public:
+    HeightField() {}
+
+    // Generates the (2 * radius + 1)^2 chunks around center_chunk.
+    static HeightField fromTerrain(Terrain& terrain, glm::ivec2 center_chunk,
+                                   int radius);
+
+    // Outside the grid the edge heights extend outwards.
+    float height(float x, float z) const;
+    // Largest height change per unit of horizontal distance.
+    float maxSlope() const { return max_slope_; }
+    float maxHeight() const { return max_height_; }
+    bool empty() const { return heights_.empty(); }
+
+   private:
+    float at(int x, int z) const;
+
+    int origin_x_ = 0;
+    int origin_z_ = 0;
+    int width_ = 0;
+    int depth_ = 0;
+    float max_slope_ = 0.0f;
+    float max_height_ = 0.0f;
+    std::vector<float> heights_;
+};
+
+// CPU renderer for high-resolution stills; needs no GPU or display.
+//
+// Rays are sphere-traced against signed distance estimates: the analytic
+// Menger sponge estimator and a Lipschitz-bounded estimate for the height
+// field. The image is cut into tiles that run on a ThreadPool, and each
+// tile marches packets of Float4::kWidth horizontally adjacent rays in
+// SIMD lanes until every lane has hit or escaped.
+class RayMarcher {
+   public:
+    struct Scene {
+        const HeightField* terrain = nullptr;
+        int menger_level = -1;  // < 0 leaves the sponge out
+        glm::vec3 menger_center = glm::vec3(0.0f);
+        float menger_size = 1.0f;
+    };
+
+    struct View {
+        glm::vec3 eye = glm::vec3(0.0f);
+        glm::vec3 target = glm::vec3(0.0f, 0.0f, -1.0f);
+        glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
+        float fov_y = glm::radians(45.0f);
+    };
+
+    struct Options {
+        int width = 1920;
+        int height = 1080;
+        int tile_size = 32;
+        int max_steps = 256;
+        float max_distance = 1000.0f;
+    };
+
+    struct Stats {
+        size_t rays = 0;
+        size_t steps = 0;  // distance evaluations across all rays
+        double ms = 0.0;
+
+        double mraysPerSecond() const {
+            return ms > 0.0 ? rays / (ms * 1000.0) : 0.0;
+        }
+    };
+
+    explicit RayMarcher(const Scene& scene);
+
+    // Writes width * height tightly packed RGB pixels, top row first.
+    // Runs on the calling thread when pool is null.
+    Stats render(const View& view, const Options& options, ThreadPool* pool,
+                 std::vector<unsigned char>* rgb) const;
+
+   private:
+    struct Frame;
+
+    size_t renderTile(const Frame& frame, int x0, int y0, int x1, int y1,
+                      unsigned char* rgb) const;
+    // Scene distance; *menger is set in lanes where the sponge is nearer.
+    Float4 distance(Float4 x, Float4 y, Float4 z, Float4* menger) const;
+    Float4 mengerDistance(Float4 x, Float4 y, Float4 z) const;
+    Float4 terrainDistance(Float4 x, Float4 y, Float4 z) const;
+
+    Scene scene_;
+    float terrain_step_ = 1.0f;  // scales height differences to distances
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include "region_export.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <future>
+
+#include "chunk_mesher.h"
+#include "thread_pool.h"
+
+bool ExportRegion(const ChunkMesher& mesher, glm::ivec2 lo, glm::ivec2 hi,
+                  const std::string& path,
+                  const MeshExporter::Options& options, ThreadPool& pool,
+                  size_t max_in_flight, RegionExportStats* stats) {
+    auto start = std::chrono::steady_clock::now();
+    RegionExportStats local_stats;
+    if (stats == nullptr) stats = &local_stats;
+    *stats = RegionExportStats();
+    if (max_in_flight == 0)
+        max_in_flight = 4 * std::max<size_t>(pool.size(), 1);
+
+    MeshExporter exporter;
+    if (!exporter.open(path, options)) return false;
+
+    // Futures in submission order; writing from the front keeps the file
+    // in order while later chunks are still being meshed.
+    std::deque<std::future<ChunkMesh>> in_flight;
+    bool ok = true;
+    auto writeOldest = [&]() {
+        ChunkMesh mesh = in_flight.front().get();
+        in_flight.pop_front();
+        ok = ok && exporter.write(mesh.vertices, mesh.faces);
+        stats->chunks++;
+    };
+
+    for (int z = lo.y; z < hi.y; z++) {
+        for (int x = lo.x; x < hi.x; x++) {
+            if (in_flight.size() >= max_in_flight) writeOldest();
+            glm::ivec2 coords(x, z);
+            in_flight.push_back(pool.submit(
+                [&mesher, coords]() { return mesher.mesh(coords); }));
+            stats->peak_in_flight =
+                std::max(stats->peak_in_flight, in_flight.size());
+        }
+    }
+    // Drain even after a failed write: the jobs reference the mesher.
+    while (!in_flight.empty()) writeOldest();
+
+    ok = exporter.close() && ok;
+    stats->vertices = exporter.stats().vertices;
+    stats->faces = exporter.stats().faces;
+    stats->bytes = exporter.stats().bytes;
+    stats->ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    return ok;
+}
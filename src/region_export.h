@@ -0,0 +1,36 @@
+#ifndef REGION_EXPORT_H
+#define REGION_EXPORT_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <string>
+
+#include "mesh_export.h"
+
+class ChunkMesher;
+class ThreadPool;
+
+struct RegionExportStats {
+    size_t chunks = 0;
+    size_t vertices = 0;
+    size_t faces = 0;
+    size_t bytes = 0;
+    size_t peak_in_flight = 0;  // meshes held in memory at once
+    double ms = 0.0;
+};
+
+// Meshes the chunks in [lo, hi) on the pool and streams them into one file,
+// row by row (z, then x), in the format options.format selects.
+//
+// At most max_in_flight chunks are being built or waiting to be written at
+// any time (0 picks four per worker), so memory stays constant however
+// large the region is. Leave options.deduplicate off for huge regions:
+// its vertex table grows with the whole file.
+bool ExportRegion(const ChunkMesher& mesher, glm::ivec2 lo, glm::ivec2 hi,
+                  const std::string& path,
+                  const MeshExporter::Options& options, ThreadPool& pool,
+                  size_t max_in_flight = 0,
+                  RegionExportStats* stats = nullptr);
+
+#endif
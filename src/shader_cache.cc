@@ -0,0 +1,172 @@
+#include "shader_cache.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#include <debuggl.h>
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+const uint32_t kMagic = 0x42504c47;  // "GLPB"
+
+struct Header {
+    uint32_t magic;
+    uint32_t format;
+    uint64_t key;
+    uint64_t length;
+};
+
+double millisSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+}
+
+void hashBytes(uint64_t& hash, const void* data, size_t size) {
+    // FNV-1a
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+}
+
+std::string glString(GLenum name) {
+    const GLubyte* value = glGetString(name);
+    return value ? reinterpret_cast<const char*>(value) : "";
+}
+};  // namespace
+
+std::string readFile(const char* filePath) {
+    std::ifstream fileStream(filePath, std::ios::in | std::ios::binary);
+    if (!fileStream.is_open()) {
+        std::cerr << "Could not read file " << filePath
+                  << ". File does not exist." << std::endl;
+        return "";
+    }
+
+    fileStream.seekg(0, std::ios::end);
+    std::string content(static_cast<size_t>(fileStream.tellg()), '\0');
+    fileStream.seekg(0, std::ios::beg);
+    fileStream.read(&content[0], content.size());
+    return content;
+}
+
+ShaderCache::ShaderCache(const std::string& directory)
+    : directory_(directory) {
+    driver_ = glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" +
+              glString(GL_VERSION);
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    glGetError();
+    binaries_supported_ = formats > 0;
+}
+
+uint64_t ShaderCache::key(const std::vector<ShaderStage>& stages) const {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hashBytes(hash, driver_.data(), driver_.size());
+    for (const auto& stage : stages) {
+        hashBytes(hash, &stage.type, sizeof(stage.type));
+        hashBytes(hash, stage.source.data(), stage.source.size());
+    }
+    return hash;
+}
+
+GLuint ShaderCache::build(const std::string& name,
+                          const std::vector<ShaderStage>& stages,
+                          const std::function<void(GLuint)>& bind_locations) {
+    timing_ = Timing();
+    std::string path = directory_ + "/" + name + ".glbin";
+    uint64_t program_key = key(stages);
+
+    GLuint program_id = 0;
+    CHECK_GL_ERROR(program_id = glCreateProgram());
+
+    Clock::time_point start = Clock::now();
+    if (binaries_supported_ && loadBinary(path, program_key, program_id)) {
+        timing_.cache_hit = true;
+        timing_.load_ms = millisSince(start);
+        std::cout << "Shader program " << name << ": cached binary loaded in "
+                  << timing_.load_ms << " ms" << std::endl;
+        return program_id;
+    }
+
+    start = Clock::now();
+    std::vector<GLuint> shader_ids;
+    for (const auto& stage : stages) {
+        GLuint shader_id = 0;
+        const char* source_pointer = stage.source.c_str();
+        CHECK_GL_ERROR(shader_id = glCreateShader(stage.type));
+        CHECK_GL_ERROR(
+            glShaderSource(shader_id, 1, &source_pointer, nullptr));
+        glCompileShader(shader_id);
+        CHECK_GL_SHADER_ERROR(shader_id);
+        CHECK_GL_ERROR(glAttachShader(program_id, shader_id));
+        shader_ids.push_back(shader_id);
+    }
+    timing_.compile_ms = millisSince(start);
+
+    start = Clock::now();
+    if (bind_locations) bind_locations(program_id);
+    if (binaries_supported_) {
+        CHECK_GL_ERROR(glProgramParameteri(
+            program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+    }
+    glLinkProgram(program_id);
+    CHECK_GL_PROGRAM_ERROR(program_id);
+    timing_.link_ms = millisSince(start);
+
+    for (GLuint shader_id : shader_ids) {
+        CHECK_GL_ERROR(glDetachShader(program_id, shader_id));
+        CHECK_GL_ERROR(glDeleteShader(shader_id));
+    }
+    std::cout << "Shader program " << name << ": compiled in "
+              << timing_.compile_ms << " ms, linked in " << timing_.link_ms
+              << " ms" << std::endl;
+
+    if (binaries_supported_) saveBinary(path, program_key, program_id);
+    return program_id;
+}
+
+bool ShaderCache::loadBinary(const std::string& path, uint64_t key,
+                             GLuint program_id) {
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in.is_open()) return false;
+
+    Header header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || header.magic != kMagic || header.key != key) return false;
+
+    std::vector<char> binary(header.length);
+    in.read(binary.data(), binary.size());
+    if (!in) return false;
+
+    glProgramBinary(program_id, header.format, binary.data(), binary.size());
+    // An unknown format raises GL_INVALID_ENUM; treat it like a rejected
+    // binary and recompile.
+    GLenum error = glGetError();
+    GLint status = GL_FALSE;
+    glGetProgramiv(program_id, GL_LINK_STATUS, &status);
+    return error == GL_NO_ERROR && status == GL_TRUE;
+}
+
+void ShaderCache::saveBinary(const std::string& path, uint64_t key,
+                             GLuint program_id) {
+    GLint length = 0;
+    CHECK_GL_ERROR(
+        glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH, &length));
+    if (length <= 0) return;
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    CHECK_GL_ERROR(glGetProgramBinary(program_id, length, nullptr, &format,
+                                      binary.data()));
+
+    Header header = {kMagic, format, key, uint64_t(length)};
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(binary.data(), binary.size());
+    if (!out)
+        std::cerr << "Could not write shader cache " << path << std::endl;
+}
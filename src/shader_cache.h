@@ -0,0 +1,59 @@
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Reads a whole text file in a single read. Returns "" if it cannot be
+// opened.
+std::string readFile(const char* filePath);
+
+struct ShaderStage {
+    GLenum type;  // GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, ...
+    std::string source;
+};
+
+// Builds GL programs and keeps their linked binaries on disk
+// (glGetProgramBinary / glProgramBinary), so a warm start skips GLSL
+// compilation entirely.
+//
+// Each program is stored as <directory>/<name>.glbin together with a key
+// hashed from the stage sources and the driver's vendor/renderer/version
+// strings. A key mismatch, an unsupported binary format or a binary the
+// driver rejects all fall back to compiling from source, after which the
+// cache file is rewritten.
+class ShaderCache {
+   public:
+    struct Timing {
+        bool cache_hit = false;
+        double load_ms = 0.0;     // reading + glProgramBinary
+        double compile_ms = 0.0;  // all stages
+        double link_ms = 0.0;
+    };
+
+    explicit ShaderCache(const std::string& directory);
+
+    // bind_locations is called on the new program before linking, for
+    // glBindAttribLocation / glBindFragDataLocation.
+    GLuint build(const std::string& name,
+                 const std::vector<ShaderStage>& stages,
+                 const std::function<void(GLuint)>& bind_locations = nullptr);
+
+    const Timing& lastTiming() const { return timing_; }
+
+   private:
+    uint64_t key(const std::vector<ShaderStage>& stages) const;
+    bool loadBinary(const std::string& path, uint64_t key, GLuint program);
+    void saveBinary(const std::string& path, uint64_t key, GLuint program);
+
+    std::string directory_;
+    std::string driver_;
+    bool binaries_supported_ = false;
+    Timing timing_;
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CRAFT_SIMD_SSE2 1
+#endif
+
+// Four-lane float vector for processing packets of rays, pixels or
+// vertices together. Compiles to SSE2 on x86-64 (which every 64-bit x86
+// CPU has) and to plain loops elsewhere, so callers never need their own
+// fallback path.
+//
+// Comparisons return a Float4 whose lanes are all-ones or all-zero bits,
+// for use with select(), any() and all(); andNot(a, b) is a & ~b.
+//
+// The functions live in namespace simd with Float4, so unqualified calls
+// on Float4s still find them, while min(), sqrt(), floor() and the rest
+// stay out of the way of <cmath> and std:: functions of the same names.
+namespace simd {
+
+struct Float4 {
+#if CRAFT_SIMD_SSE2
+    __m128 v;
+
+    Float4() {}
+    Float4(__m128 value) : v(value) {}
+    Float4(float x) : v(_mm_set1_ps(x)) {}
+    Float4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) {}
+
+    static Float4 load(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+#else
+    float v[4];
+
+    Float4() {}
+    Float4(float x) : v{x, x, x, x} {}
+    Float4(float a, float b, float c, float d) : v{a, b, c, d} {}
+
+    static Float4 load(const float* p) {
+        return Float4(p[0], p[1], p[2], p[3]);
+    }
+    void store(float* p) const {
+        for (int i = 0; i < 4; i++) p[i] = v[i];
+    }
+#endif
+    static const int kWidth = 4;
+};
+
+#if CRAFT_SIMD_SSE2
+
+inline Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+inline Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline Float4 operator/(Float4 a, Float4 b) { return _mm_div_ps(a.v, b.v); }
+inline Float4 operator<(Float4 a, Float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+inline Float4 operator>(Float4 a, Float4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline Float4 operator&(Float4 a, Float4 b) { return _mm_and_ps(a.v, b.v); }
+inline Float4 operator|(Float4 a, Float4 b) { return _mm_or_ps(a.v, b.v); }
+inline Float4 andNot(Float4 a, Float4 b) { return _mm_andnot_ps(b.v, a.v); }
+inline Float4 min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+inline Float4 max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+inline Float4 sqrt(Float4 a) { return _mm_sqrt_ps(a.v); }
+inline Float4 abs(Float4 a) {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v);
+}
+inline Float4 floor(Float4 a) {
+    // Truncate, then step down where truncation rounded up (negatives).
+    // Only valid within int range, which is all ray marching needs.
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.0f)));
+}
+// Lanes of mask choose a, the others b.
+inline Float4 select(Float4 mask, Float4 a, Float4 b) {
+    return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+inline int laneMask(Float4 mask) { return _mm_movemask_ps(mask.v); }
+
+#else
+
+namespace detail {
+inline float bits(bool b) {
+    union {
+        unsigned u;
+        float f;
+    } x;
+    x.u = b ? ~0u : 0u;
+    return x.f;
+}
+inline unsigned toBits(float f) {
+    union {
+        float f;
+        unsigned u;
+    } x;
+    x.f = f;
+    return x.u;
+}
+inline float fromBits(unsigned u) {
+    union {
+        unsigned u;
+        float f;
+    } x;
+    x.u = u;
+    return x.f;
+}
+};  // namespace detail
+
+#define CRAFT_SIMD_LANES(expr)                         \
+    Float4 r;                                          \
+    for (int i = 0; i < 4; i++) r.v[i] = (expr);       \
+    return r
+
+inline Float4 operator+(Float4 a, Float4 b) {
+    CRAFT_SIMD_LANES(a.v[i] + b.v[i]);
+}
+inline Float4 operator-(Float4 a, Float4 b) {
+    CRAFT_SIMD_LANES(a.v[i] - b.v[i]);
+}
+inline Float4 operator*(Float4 a, Float4 b) {
+    CRAFT_SIMD_LANES(a.v[i] * b.v[i]);
+}
+inline Float4 operator/(Float4 a, Float4 b) {
+    CRAFT_SIMD_LANES(a.v[i] / b.v[i]);
+}
+inline Float4 operator<(Float4 a, Float4 b) {
+    CRAFT_SIMD_LANES(detail::bits(a.v[i] < b.v[i]));
+}
+inline Float4 operator>(Float4 a, Float4 b) {
+    CRAFT_SIMD_LANES(detail::bits(a.v[i] > b.v[i]));
+}
+inline Float4 operator&(Float4 a, Float4 b) {
+    CRAFT_SIMD_LANES(detail::fromBits(detail::toBits(a.v[i]) &
+                                           detail::toBits(b.v[i])));
+}
+inline Float4 operator|(Float4 a, Float4 b) {
+    CRAFT_SIMD_LANES(detail::fromBits(detail::toBits(a.v[i]) |
+                                           detail::toBits(b.v[i])));
+}
+inline Float4 andNot(Float4 a, Float4 b) {
+    CRAFT_SIMD_LANES(detail::fromBits(detail::toBits(a.v[i]) &
+                                           ~detail::toBits(b.v[i])));
+}
+inline Float4 min(Float4 a, Float4 b) {
+    CRAFT_SIMD_LANES(b.v[i] < a.v[i] ? b.v[i] : a.v[i]);
+}
+inline Float4 max(Float4 a, Float4 b) {
+    CRAFT_SIMD_LANES(b.v[i] > a.v[i] ? b.v[i] : a.v[i]);
+}
+inline Float4 sqrt(Float4 a) { CRAFT_SIMD_LANES(std::sqrt(a.v[i])); }
+inline Float4 abs(Float4 a) { CRAFT_SIMD_LANES(std::fabs(a.v[i])); }
+inline Float4 floor(Float4 a) { CRAFT_SIMD_LANES(std::floor(a.v[i])); }
+inline Float4 select(Float4 mask, Float4 a, Float4 b) {
+    CRAFT_SIMD_LANES(detail::toBits(mask.v[i]) ? a.v[i] : b.v[i]);
+}
+inline int laneMask(Float4 mask) {
+    int bits = 0;
+    for (int i = 0; i < 4; i++)
+        if (detail::toBits(mask.v[i]) >> 31) bits |= 1 << i;
+    return bits;
+}
+
+#undef CRAFT_SIMD_LANES
+
+#endif
+
+inline bool any(Float4 mask) { return laneMask(mask) != 0; }
+inline bool all(Float4 mask) { return laneMask(mask) == 0xf; }
+
+inline Float4& operator+=(Float4& a, Float4 b) { return a = a + b; }
+inline Float4& operator-=(Float4& a, Float4 b) { return a = a - b; }
+inline Float4& operator*=(Float4& a, Float4 b) { return a = a * b; }
+
+};  // namespace simd
+
+using simd::Float4;
+
+#endif
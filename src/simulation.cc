@@ -0,0 +1,156 @@
+#include "simulation.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "trace.h"
+
+namespace {
+// How far around the player Camera::physics looks for blocks.
+const int kCollisionRadius = 4;
+// Past this many ticks behind, the simulation skips ahead rather than
+// trying to catch up.
+const int kMaxLag = 5;
+};  // namespace
+
+Simulation::Simulation(const Camera& camera, double ticks_per_second)
+    : tick_(std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(1.0 / ticks_per_second))),
+      inputs_(256),
+      camera_(camera) {
+    // move() goes by the view matrix.
+    camera_.update();
+    // So camera() has something to show before the first tick.
+    Snapshot& snapshot = snapshots_.back();
+    snapshot.previous = snapshot.current = camera;
+    snapshot.time = Clock::now();
+    snapshots_.publish();
+    thread_ = std::thread([this]() { run(); });
+}
+
+Simulation::~Simulation() {
+    stop_ = true;
+    thread_.join();
+}
+
+void Simulation::walk(int direction) {
+    Input input;
+    input.type = InputType::kWalk;
+    input.value = direction;
+    send(input);
+}
+
+void Simulation::strafe(int direction) {
+    Input input;
+    input.type = InputType::kStrafe;
+    input.value = direction;
+    send(input);
+}
+
+void Simulation::jump() {
+    Input input;
+    input.type = InputType::kJump;
+    send(input);
+}
+
+void Simulation::move(Camera::Direction direction) {
+    Input input;
+    input.type = InputType::kMove;
+    input.value = direction;
+    send(input);
+}
+
+void Simulation::rotate(double dx, double dy) {
+    Input input;
+    input.type = InputType::kRotate;
+    input.delta = glm::dvec2(dx, dy);
+    send(input);
+}
+
+void Simulation::setGravity(bool enable) {
+    Input input;
+    input.type = InputType::kGravity;
+    input.value = enable;
+    send(input);
+}
+
+// Input beyond what fits in a tick's queue is dropped.
+void Simulation::send(const Input& input) {
+    Input copy = input;
+    inputs_.push(std::move(copy));
+}
+
+void Simulation::setWorld(const BlockWorld::Neighbourhood& world) {
+    worlds_.back() = world;
+    worlds_.publish();
+}
+
+Camera Simulation::camera(Clock::time_point now) {
+    snapshots_.update();
+    const Snapshot& snapshot = snapshots_.front();
+    float t = std::chrono::duration<float>(now - snapshot.time) /
+              std::chrono::duration<float>(tick_);
+    return snapshot.previous.interpolate(snapshot.current,
+                                         std::min(std::max(t, 0.0f), 1.0f));
+}
+
+void Simulation::run() {
+    TRACE_THREAD("simulation");
+    Clock::time_point next = Clock::now();
+    while (!stop_) {
+        tick(next);
+        next += tick_;
+        Clock::time_point now = Clock::now();
+        if (now - next > kMaxLag * tick_) next = now;
+        std::this_thread::sleep_until(next);
+    }
+}
+
+void Simulation::tick(Clock::time_point time) {
+    TRACE_SCOPE("Simulation::tick");
+    float seconds = std::chrono::duration<float>(tick_).count();
+    Camera previous = camera_;
+
+    Input input;
+    while (inputs_.pop(&input)) {
+        switch (input.type) {
+            case InputType::kWalk:
+                walk_ = input.value;
+                break;
+            case InputType::kStrafe:
+                strafe_ = input.value;
+                break;
+            case InputType::kJump:
+                camera_.jump();
+                break;
+            case InputType::kMove:
+                camera_.move(Camera::Direction(input.value));
+                break;
+            case InputType::kRotate:
+                camera_.rotate(input.delta.x, input.delta.y);
+                break;
+            case InputType::kGravity:
+                gravity_ = input.value != 0;
+                break;
+        }
+        camera_.update();
+    }
+
+    if (worlds_.update()) world_ = worlds_.front();
+    // Nothing to stand on until the player's chunk is loaded.
+    if (gravity_ && world_.columns[4]) {
+        std::vector<glm::vec3> nearby =
+            world_.blocksNear(camera_.getPos(), kCollisionRadius);
+        camera_.physics(seconds, nearby);
+        camera_.walk(walk_);
+        camera_.strafe(strafe_);
+        camera_.update();
+    }
+
+    Snapshot& snapshot = snapshots_.back();
+    snapshot.previous = previous;
+    snapshot.current = camera_;
+    snapshot.time = time;
+    snapshots_.publish();
+    ticks_++;
+}
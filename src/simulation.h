@@ -0,0 +1,94 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "block_world.h"
+#include "camera.h"
+#include "spsc_queue.h"
+#include "triple_buffer.h"
+
+// Moves the player on a thread of its own, at a fixed number of ticks per
+// second however long frames take to draw.
+//
+// The simulation owns the camera. Input reaches it through a lock-free
+// queue and is applied at the start of the next tick; after each tick the
+// camera before and after it is published through a TripleBuffer, and
+// camera() blends the two for the moment a frame is drawn. Frames are
+// drawn up to a tick behind the simulation in exchange for motion that is
+// smooth at any frame rate. Collisions are resolved against the
+// BlockWorld::Neighbourhood the render thread last handed over in
+// setWorld(), the other way through a second TripleBuffer, so neither
+// thread ever waits for the other.
+class Simulation {
+   public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Starts ticking from camera.
+    explicit Simulation(const Camera& camera, double ticks_per_second = 60.0);
+    // Stops the thread.
+    ~Simulation();
+
+    Simulation(const Simulation&) = delete;
+    Simulation& operator=(const Simulation&) = delete;
+
+    // Input, as for Camera; from the thread that handles input only.
+    // Walking and strafing hold until changed; the rest happen once.
+    void walk(int direction);
+    void strafe(int direction);
+    void jump();
+    void move(Camera::Direction direction);
+    void rotate(double dx, double dy);
+    void setGravity(bool enable);
+
+    // From the render thread only.
+    // The blocks to collide with from now on.
+    void setWorld(const BlockWorld::Neighbourhood& world);
+    // The camera as it was at now, one tick ago.
+    Camera camera(Clock::time_point now = Clock::now());
+    uint64_t ticks() const { return ticks_; }
+
+   private:
+    enum class InputType { kWalk, kStrafe, kJump, kMove, kRotate, kGravity };
+
+    struct Input {
+        InputType type = InputType::kJump;
+        int value = 0;  // direction or flag
+        glm::dvec2 delta = glm::dvec2(0.0);
+    };
+
+    // The camera before and after the tick that was due at time; frames
+    // drawn in the tick after it blend from one to the other.
+    struct Snapshot {
+        Camera previous;
+        Camera current;
+        Clock::time_point time;
+    };
+
+    void send(const Input& input);
+    void run();
+    void tick(Clock::time_point time);
+
+    Clock::duration tick_;
+    SpscQueue<Input> inputs_;
+    TripleBuffer<Snapshot> snapshots_;
+    TripleBuffer<BlockWorld::Neighbourhood> worlds_;
+
+    // Simulation thread only.
+    Camera camera_;
+    int walk_ = 0;
+    int strafe_ = 0;
+    bool gravity_ = false;
+    BlockWorld::Neighbourhood world_;
+
+    std::atomic<uint64_t> ticks_{0};
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
+
+#endif
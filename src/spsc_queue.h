@@ -0,0 +1,48 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// A bounded queue between exactly one producer thread and one consumer
+// thread. Neither side ever locks or waits: each index is written by one
+// side only and published to the other with release/acquire ordering, so
+// push() and pop() just fail when the queue is full or empty.
+template <typename T>
+class SpscQueue {
+   public:
+    // One slot stays empty to tell a full queue from an empty one.
+    explicit SpscQueue(size_t capacity) : slots_(capacity + 1) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer only. Leaves value alone if the queue is full.
+    bool push(T&& value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % slots_.size();
+        if (next == head_.load(std::memory_order_acquire)) return false;
+        slots_[tail] = std::move(value);
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only.
+    bool pop(T* value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) return false;
+        *value = std::move(slots_[head]);
+        head_.store((head + 1) % slots_.size(), std::memory_order_release);
+        return true;
+    }
+
+   private:
+    std::vector<T> slots_;
+    // On separate cache lines, as each is written by a different thread.
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+#endif
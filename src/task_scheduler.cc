@@ -0,0 +1,51 @@
+#include "task_scheduler.h"
+
+TaskScheduler::TaskScheduler(ThreadPool& pool) : pool_(pool) {}
+
+TaskScheduler::~TaskScheduler() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+    // Each pump drops one task, which may queue the tasks awaiting it with
+    // pumps of their own.
+    idle_.wait(lock, [this]() { return pumps_ == 0 && ready_.empty(); });
+}
+
+void TaskScheduler::schedule(std::coroutine_handle<> handle,
+                             TaskPromiseBase* promise) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_.push_back(Entry{handle, promise});
+        pumps_++;
+    }
+    // One pool job per queued task, but each takes whichever task is most
+    // urgent when it gets a worker rather than the one it was queued for.
+    pool_.submit([this]() { pump(); });
+}
+
+void TaskScheduler::pump() {
+    Entry entry;
+    bool cancel;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Linear, but only tasks ready to run are queued, and their
+        // priorities may have changed since.
+        size_t best = 0;
+        for (size_t i = 1; i < ready_.size(); i++)
+            if (ready_[i].promise->control->priority() >
+                ready_[best].promise->control->priority())
+                best = i;
+        entry = ready_[best];
+        ready_.erase(ready_.begin() + best);
+        cancel = stopping_ || entry.promise->control->cancelled();
+    }
+    if (cancel) {
+        entry.promise->cancel();
+        entry.handle.destroy();
+        cancelled_++;
+    } else {
+        entry.handle.resume();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    pumps_--;
+    if (pumps_ == 0 && ready_.empty()) idle_.notify_all();
+}
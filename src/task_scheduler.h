@@ -0,0 +1,250 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "thread_pool.h"
+
+// Coroutine tasks on a ThreadPool, for work made of stages that depend on
+// each other, such as generating chunks and then meshing them.
+//
+// A coroutine returning Task<T> does nothing until TaskScheduler::spawn()
+// queues it, which hands back a TaskHandle<T>. Other tasks co_await
+// handles, so a task waits for what it needs without holding a worker: it
+// is resumed once the last of it is done. Every task runs under a
+// TaskControl, shared by the tasks of one job, whose priority decides
+// which queued task a free worker runs next and may change while it
+// waits, e.g. as the player moves. Cancelling the control makes the
+// scheduler drop its tasks instead of running or resuming them; whoever
+// awaits them gets an empty result.
+
+class TaskScheduler;
+
+// The priority and cancellation of a job. Higher priorities run first.
+class TaskControl {
+   public:
+    explicit TaskControl(int priority = 0) : priority_(priority) {}
+
+    int priority() const { return priority_.load(std::memory_order_relaxed); }
+    void setPriority(int priority) {
+        priority_.store(priority, std::memory_order_relaxed);
+    }
+    // Tasks that are running carry on to their next co_await.
+    void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+    bool cancelled() const {
+        return cancelled_.load(std::memory_order_relaxed);
+    }
+
+   private:
+    std::atomic<int> priority_;
+    std::atomic<bool> cancelled_{false};
+};
+
+typedef std::shared_ptr<TaskControl> TaskControlPtr;
+
+// What the scheduler needs of every task's coroutine.
+class TaskPromiseBase {
+   public:
+    TaskScheduler* scheduler = nullptr;
+    TaskControlPtr control;
+
+    // Completes the task with an empty result instead of resuming it.
+    virtual void cancel() = 0;
+
+   protected:
+    ~TaskPromiseBase() = default;
+};
+
+template <typename T>
+class Task;
+template <typename T>
+class TaskHandle;
+
+class TaskScheduler {
+   public:
+    explicit TaskScheduler(ThreadPool& pool);
+    // Cancels every task still queued and waits for the workers to let go
+    // of them. The pool must outlive the scheduler.
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    // Queues task to start under control.
+    template <typename T>
+    TaskHandle<T> spawn(Task<T> task, TaskControlPtr control);
+
+    // Queues a suspended task to be resumed on a worker.
+    void schedule(std::coroutine_handle<> handle, TaskPromiseBase* promise);
+
+    // Tasks run to completion and tasks dropped, so far.
+    size_t completed() const { return completed_; }
+    size_t cancelled() const { return cancelled_; }
+    void countCompleted() { completed_++; }
+
+   private:
+    struct Entry {
+        std::coroutine_handle<> handle;
+        TaskPromiseBase* promise;
+    };
+
+    void pump();
+
+    ThreadPool& pool_;
+    std::mutex mutex_;
+    std::condition_variable idle_;
+    std::vector<Entry> ready_;
+    size_t pumps_ = 0;  // pool jobs submitted and not yet finished
+    bool stopping_ = false;
+    std::atomic<size_t> completed_{0};
+    std::atomic<size_t> cancelled_{0};
+};
+
+// The result of a task, shared by its handles.
+template <typename T>
+struct TaskState {
+    std::mutex mutex;
+    bool done = false;
+    std::optional<T> value;  // empty if cancelled
+    std::vector<std::pair<std::coroutine_handle<>, TaskPromiseBase*>>
+        waiters;
+
+    void finish(std::optional<T> result) {
+        std::vector<std::pair<std::coroutine_handle<>, TaskPromiseBase*>>
+            woken;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            value = std::move(result);
+            done = true;
+            woken.swap(waiters);
+        }
+        for (const auto& waiter : woken)
+            waiter.second->scheduler->schedule(waiter.first, waiter.second);
+    }
+};
+
+// A task's result; copies share it. Can be awaited by any number of tasks
+// and polled from any thread.
+template <typename T>
+class TaskHandle {
+   public:
+    TaskHandle() = default;
+    // A handle that is done already, for results that need no task.
+    static TaskHandle ready(T value) {
+        auto state = std::make_shared<TaskState<T>>();
+        state->value = std::move(value);
+        state->done = true;
+        return TaskHandle(state);
+    }
+
+    bool valid() const { return state_ != nullptr; }
+    bool done() const {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        return state_->done;
+    }
+    // Only once done(), which never changes back. Empty if the task was
+    // cancelled.
+    const std::optional<T>& result() const { return state_->value; }
+    // Moves the result out, for the only reader of a task.
+    std::optional<T> take() { return std::move(state_->value); }
+
+    struct Awaiter {
+        std::shared_ptr<TaskState<T>> state;
+
+        bool await_ready() {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            return state->done;
+        }
+        template <typename Promise>
+        bool await_suspend(std::coroutine_handle<Promise> awaiting) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->done) return false;
+            state->waiters.emplace_back(awaiting, &awaiting.promise());
+            return true;
+        }
+        std::optional<T> await_resume() { return state->value; }
+    };
+    Awaiter operator co_await() const { return Awaiter{state_}; }
+
+   private:
+    friend class TaskScheduler;
+    explicit TaskHandle(std::shared_ptr<TaskState<T>> state)
+        : state_(std::move(state)) {}
+
+    std::shared_ptr<TaskState<T>> state_;
+};
+
+// The return type of task coroutines. Move only; destroying a task that
+// was never spawned destroys its coroutine.
+template <typename T>
+class Task {
+   public:
+    struct promise_type : TaskPromiseBase {
+        std::shared_ptr<TaskState<T>> state =
+            std::make_shared<TaskState<T>>();
+        std::optional<T> result;
+
+        // Frees the coroutine before waking the tasks that await it.
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            void await_suspend(
+                std::coroutine_handle<promise_type> handle) noexcept {
+                std::shared_ptr<TaskState<T>> state = handle.promise().state;
+                std::optional<T> result = std::move(handle.promise().result);
+                handle.promise().scheduler->countCompleted();
+                handle.destroy();
+                state->finish(std::move(result));
+            }
+            void await_resume() noexcept {}
+        };
+
+        Task get_return_object() {
+            return Task(
+                std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_value(T value) { result = std::move(value); }
+        void unhandled_exception() { std::terminate(); }
+        void cancel() override { state->finish(std::nullopt); }
+    };
+
+    Task(Task&& other) : handle_(std::exchange(other.handle_, nullptr)) {}
+    Task& operator=(Task&& other) {
+        if (handle_) handle_.destroy();
+        handle_ = std::exchange(other.handle_, nullptr);
+        return *this;
+    }
+    ~Task() {
+        if (handle_) handle_.destroy();
+    }
+
+   private:
+    friend class TaskScheduler;
+    explicit Task(std::coroutine_handle<promise_type> handle)
+        : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+template <typename T>
+TaskHandle<T> TaskScheduler::spawn(Task<T> task, TaskControlPtr control) {
+    auto handle = std::exchange(task.handle_, nullptr);
+    typename Task<T>::promise_type& promise = handle.promise();
+    promise.scheduler = this;
+    promise.control = std::move(control);
+    TaskHandle<T> result(promise.state);
+    schedule(handle, &promise);
+    return result;
+}
+
+#endif
@@ -2,6 +2,7 @@
 // #include "perlin.h"
 #include <algorithm>
 #include "noise.h"
+#include "trace.h"
 
 #include <glm/glm.hpp>
 
@@ -20,44 +21,98 @@ Chunk::Chunk(const glm::ivec2& pos, int size, std::mt19937& gen,
     this->n3 = OctaveNoise(6, rnd);
 }
 
+float Chunk::columnHeight(int x, int z) {
+    double heightMin =
+        n1.compute(x + (pos.x * size), z + (pos.y * size)) / 6 - 4;
+    double height = heightMin;
+
+    // if (n3.compute(x + (pos.x * size), z + (pos.y * size)) <= 0) {
+    double heightMax =
+        n2.compute(x + (pos.x * size), z + (pos.y * size)) / 5 + 6;
+    height = std::max(heightMin, heightMax);
+    // }
+
+    height *= 0.8;
+    if (height < 0) height *= 0.4f;
+    return height;
+}
+
 std::vector<float> Chunk::heightMap() {
+    TRACE_SCOPE("Chunk::heightMap");
     std::vector<float> heightMap;
     heightMap.resize(size * size);
 
     for (int z = 0; z < size; ++z) {
         for (int x = 0; x < size; ++x) {
             int index = x + z * size;
-            double heightMin =
-                n1.compute(x + (pos.x * size), z + (pos.y * size)) / 6 - 4;
-            double height = heightMin;
-
-            // if (n3.compute(x + (pos.x * size), z + (pos.y * size)) <= 0) {
-            double heightMax =
-                n2.compute(x + (pos.x * size), z + (pos.y * size)) / 5 + 6;
-            height = std::max(heightMin, heightMax);
-            // }
+            heightMap[index] = columnHeight(x, z);
+        }
+    }
 
-            height *= 0.8;
-            if (height < 0) height *= 0.4f;
+    return heightMap;
+}
 
-            heightMap[index] = height;
+std::vector<float> Chunk::regionHeights(int x0, int z0, int w, int d,
+                                        int smoothing) {
+    int r = std::max(smoothing, 0);
+    int rw = w + 2 * r, rd = d + 2 * r;
+    std::vector<float> raw(rw * rd);
+    for (int z = 0; z < rd; z++)
+        for (int x = 0; x < rw; x++)
+            raw[x + z * rw] = columnHeight(x0 - r + x, z0 - r + z);
+    if (r == 0) return raw;
+
+    // Separable box filter: rows into rowSums, then columns into heights.
+    std::vector<float> rowSums(w * rd);
+    for (int z = 0; z < rd; z++) {
+        float sum = 0;
+        for (int x = 0; x < 2 * r + 1; x++) sum += raw[x + z * rw];
+        for (int x = 0; x < w; x++) {
+            rowSums[x + z * w] = sum;
+            if (x + 1 < w) sum += raw[x + 2 * r + 1 + z * rw] - raw[x + z * rw];
+        }
+    }
+    std::vector<float> heights(w * d);
+    float scale = 1.0f / ((2 * r + 1) * (2 * r + 1));
+    for (int x = 0; x < w; x++) {
+        float sum = 0;
+        for (int z = 0; z < 2 * r + 1; z++) sum += rowSums[x + z * w];
+        for (int z = 0; z < d; z++) {
+            heights[x + z * w] = sum * scale;
+            if (z + 1 < d)
+                sum += rowSums[x + (z + 2 * r + 1) * w] - rowSums[x + z * w];
         }
     }
+    return heights;
+}
 
-    return heightMap;
+glm::ivec3 Terrain::toBlockCoords(glm::vec3 coords) const {
+    return glm::ivec3(glm::floor(coords));
 }
 
 glm::ivec2 Terrain::toChunkCoords(glm::vec3 coords) const {
-    return glm::ivec2((int)coords.x / this->size, (int)coords.z / this->size);
+    return toChunkCoords(toBlockCoords(coords));
+}
+
+glm::ivec2 Terrain::toChunkCoords(glm::ivec3 block) const {
+    return glm::ivec2(floorDiv(block.x, size), floorDiv(block.z, size));
+}
+
+glm::ivec2 Terrain::toLocalCoords(glm::ivec3 block) const {
+    return glm::ivec2(floorMod(block.x, size), floorMod(block.z, size));
 }
 
 std::vector<glm::vec3> Terrain::genChunkSurface(glm::ivec2 chunkCoords) {
+    TRACE_SCOPE("Terrain::genChunkSurface");
     Chunk& chunk = this->getChunk(chunkCoords);
-    std::vector<float> heightMap = chunk.heightMap();
+    std::vector<float> heightMap =
+        edgeMode == EdgeMode::kSeamless
+            ? chunk.regionHeights(0, 0, size, size, smoothingRadius)
+            : chunk.heightMap();
     std::vector<glm::vec3> surfaceMap;
     surfaceMap.resize(this->size * this->size);
 
-    for (int z = 0; z < 4; z++) {
+    for (int z = 0; edgeMode == EdgeMode::kNeighbourBlend && z < 4; z++) {
         std::vector<float> neighborNoise;
         int start, Nstart;
         int stride, Nstride;
@@ -108,8 +163,8 @@ std::vector<glm::vec3> Terrain::genChunkSurface(glm::ivec2 chunkCoords) {
     for (int i = 0; i < this->size; i++) {
         for (int j = 0; j < this->size; j++) {
             int index = i + this->size * j;
-            glm::vec3 coords(chunk.pos.x + i, round(heightMap[index]),
-                             chunk.pos.y + j);
+            glm::vec3 coords(chunk.pos.x * size + i, round(heightMap[index]),
+                             chunk.pos.y * size + j);
             surfaceMap[index] = coords;
         }
     }
@@ -117,26 +172,36 @@ std::vector<glm::vec3> Terrain::genChunkSurface(glm::ivec2 chunkCoords) {
     return surfaceMap;
 }
 
+// surfaceMap holds one surface block per column of a size x size grid,
+// ordered x + size * z. Appends the blocks below each surface block down
+// to just above its lowest in-grid neighbour, so cliffs have no holes.
+// Each column is filled once, to the deepest gap, so no block is added
+// twice.
 void fill(std::vector<glm::vec3>& surfaceMap, int size) {
-    for (int i = (int)surfaceMap.size() - 1; i >= 0; i--) {
-        std::vector<int> neighbors = {i + 1, i - 1, i + size, i - size};
-
-        for (int j : neighbors) {
-            if (j < size * size && j > 0) {
-                float gapSize =
-                    floor(surfaceMap[i].y - surfaceMap[j].y - 0.001);
-                if (gapSize <= 0.0) continue;
-                for (int k = 1; k <= gapSize; k++) {
-                    surfaceMap.push_back(glm::vec3(surfaceMap[i].x,
-                                                   surfaceMap[i].y - (float)k,
-                                                   surfaceMap[i].z));
-                }
-            }
+    TRACE_SCOPE("fill");
+    for (int z = 0; z < size; z++) {
+        for (int x = 0; x < size; x++) {
+            const glm::vec3 top = surfaceMap[x + size * z];
+            float lowest = top.y;
+            if (x > 0)
+                lowest = std::min(lowest, surfaceMap[x - 1 + size * z].y);
+            if (x + 1 < size)
+                lowest = std::min(lowest, surfaceMap[x + 1 + size * z].y);
+            if (z > 0)
+                lowest = std::min(lowest, surfaceMap[x + size * (z - 1)].y);
+            if (z + 1 < size)
+                lowest = std::min(lowest, surfaceMap[x + size * (z + 1)].y);
+
+            float gapSize = floor(top.y - lowest - 0.001);
+            for (int k = 1; k <= gapSize; k++)
+                surfaceMap.push_back(
+                    glm::vec3(top.x, top.y - (float)k, top.z));
         }
     }
 }
 
 std::vector<glm::vec3> Terrain::getSurfaceForRender(glm::vec3 pos) {
+    TRACE_SCOPE("Terrain::getSurfaceForRender");
     glm::ivec2 center = this->toChunkCoords(pos);
     int distance = 9;
     std::vector<glm::vec3> surfaceMap;
@@ -149,9 +214,6 @@ std::vector<glm::vec3> Terrain::getSurfaceForRender(glm::vec3 pos) {
             glm::ivec2 c(center +
                          glm::ivec2(i - distance / 2, j - distance / 2));
             std::vector<glm::vec3> cOffsets = this->genChunkSurface(c);
-            for (auto& offset : cOffsets) {
-                offset += glm::vec3(c.x, 0.0, c.y) * (float)(this->size - 1);
-            }
 
             for (int cj = 0; cj < this->size; cj++) {
                 for (int ci = 0; ci < this->size; ci++) {
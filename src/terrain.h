@@ -10,6 +10,7 @@
 #include <unordered_map>
 #include <vector>
 
+#include "memory_tracker.h"
 #include "noise.h"
 
 #include <glm/glm.hpp>
@@ -19,16 +20,35 @@
 
 class Terrain;
 
+// Integer division and remainder rounding towards negative infinity, so
+// block -1 belongs to chunk -1 at local coordinate size - 1.
+inline int floorDiv(int a, int b) {
+    return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+}
+inline int floorMod(int a, int b) { return a - floorDiv(a, b) * b; }
+
+// Coordinates: a block is identified by the integer world position of its
+// minimum corner and occupies [x, x + 1) x [y, y + 1) x [z, z + 1). Chunk c
+// holds blocks c * size <= x, z < (c + 1) * size.
 class Chunk {
    public:
     int size;
     uint32_t tex_seed;
     glm::ivec2 pos;
     std::vector<float> heightMap();
+    // Height of the column at chunk-local (x, z). Coordinates outside
+    // [0, size) read the neighbouring chunks' columns; the noise depends
+    // only on the seed, so no neighbour needs to exist.
+    float columnHeight(int x, int z);
+    // Heights of the w x d columns starting at chunk-local (x0, z0), each
+    // averaged over the (2 * smoothing + 1)^2 columns around it. The
+    // filter runs on global columns, so it is seamless across chunks.
+    std::vector<float> regionHeights(int x0, int z0, int w, int d,
+                                     int smoothing);
     Terrain* terrain;
     std::mt19937 gen;
 
-    std::vector<glm::vec2> gradients;
+    TrackedVector<glm::vec2, MemoryTag::kTerrain> gradients;
 
     std::vector<float> perlinNoise(uint64_t seed) const;
     Chunk(const glm::ivec2& pos, int extent, std::mt19937& gen,
@@ -40,21 +60,54 @@ class Chunk {
 };
 
 class Terrain {
+   public:
+    // How genChunkSurface treats chunk borders.
+    enum class EdgeMode {
+        // Each chunk is a pure function of its own coordinates: heights
+        // come from the global noise field, optionally box-filtered, and
+        // no neighbour chunk is generated.
+        kSeamless,
+        // Generates the four neighbours and mixes each edge row 40% of the
+        // way towards them. Five heightMap()s per chunk.
+        kNeighbourBlend,
+    };
+
+   private:
     std::mt19937 gen;
-    std::unordered_map<glm::ivec2, Chunk, std::hash<glm::ivec2>,
-                       std::equal_to<glm::ivec2>>
+    std::unordered_map<
+        glm::ivec2, Chunk, std::hash<glm::ivec2>, std::equal_to<glm::ivec2>,
+        TrackingAllocator<std::pair<const glm::ivec2, Chunk>,
+                          MemoryTag::kTerrain>>
         chunkMap;
 
     int chunkSeed;
+    EdgeMode edgeMode = EdgeMode::kSeamless;
+    int smoothingRadius = 0;
 
    public:
     int size = 16;
     // Perlin p = Perlin();
 
     Terrain(std::mt19937& gen) : gen(gen) { chunkSeed = gen(); }
+    // Every chunk's noise is seeded with this.
+    int seed() const { return chunkSeed; }
+
+    void setEdgeMode(EdgeMode mode) { edgeMode = mode; }
+    EdgeMode getEdgeMode() const { return edgeMode; }
+    // Box filter radius, in columns, for EdgeMode::kSeamless.
+    void setSmoothingRadius(int radius) { smoothingRadius = radius; }
+    int getSmoothingRadius() const { return smoothingRadius; }
     Chunk& getChunk(glm::ivec2);
     v3 getSurfaceForRender(glm::vec3 camCoords);
+    // The block containing a world position.
+    glm::ivec3 toBlockCoords(glm::vec3 coords) const;
+    // The chunk containing a world position or block.
     glm::ivec2 toChunkCoords(glm::vec3 coords) const;
+    glm::ivec2 toChunkCoords(glm::ivec3 block) const;
+    // A block's x/z within its chunk, in [0, size).
+    glm::ivec2 toLocalCoords(glm::ivec3 block) const;
+    // The chunk's surface blocks in world block coordinates, one per
+    // column, ordered x + size * z.
     v3 genChunkSurface(glm::ivec2 chunkCoords);
 };
 
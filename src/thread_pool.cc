@@ -0,0 +1,63 @@
+#include "thread_pool.h"
+
+#include "trace.h"
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    workers_.reserve(threads);
+    for (size_t i = 0; i < threads; i++) {
+        workers_.emplace_back(&ThreadPool::run, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    has_job_.notify_all();
+    for (auto& worker : workers_) worker.join();
+}
+
+void ThreadPool::enqueue(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(std::move(job));
+    }
+    has_job_.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]() { return jobs_.empty() && active_ == 0; });
+}
+
+size_t ThreadPool::pending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return jobs_.size() + active_;
+}
+
+void ThreadPool::run() {
+    TRACE_THREAD("worker");
+    for (;;) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            has_job_.wait(lock,
+                          [this]() { return stopping_ || !jobs_.empty(); });
+            // Drain the queue before honouring shutdown so that queued
+            // writes (screenshots, exported chunks) are not lost.
+            if (jobs_.empty()) return;
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+            active_++;
+        }
+        job();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            active_--;
+            if (jobs_.empty() && active_ == 0) idle_.notify_all();
+        }
+    }
+}
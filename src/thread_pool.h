@@ -0,0 +1,54 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads draining a FIFO of jobs. Used for any
+// CPU work that should stay off the render thread (image encoding, chunk
+// generation, meshing).
+class ThreadPool {
+   public:
+    // A thread count of 0 picks std::thread::hardware_concurrency().
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    template <typename F>
+    auto submit(F&& f) -> std::future<decltype(f())> {
+        using R = decltype(f());
+        auto task =
+            std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        std::future<R> result = task->get_future();
+        enqueue([task]() { (*task)(); });
+        return result;
+    }
+
+    // Blocks until every queued and running job has finished.
+    void wait();
+
+    size_t size() const { return workers_.size(); }
+    size_t pending() const;
+
+   private:
+    void enqueue(std::function<void()> job);
+    void run();
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> jobs_;
+    mutable std::mutex mutex_;
+    std::condition_variable has_job_;
+    std::condition_variable idle_;
+    size_t active_ = 0;
+    bool stopping_ = false;
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "trace.h"
+
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef CRAFT_TRACE
+
+namespace {
+// Zones past this many per thread and recording are dropped.
+const size_t kEventsPerThread = 1 << 16;
+
+struct Event {
+    const char* name;
+    Trace::Clock::time_point begin, end;
+};
+
+// Written by its thread only. A buffer whose session is not the current
+// one holds nothing of this recording, and is cleared by its thread on
+// its next zone.
+struct ThreadBuffer {
+    int id = 0;
+    std::string name;  // under g_mutex
+    std::atomic<uint64_t> session{0};
+    std::atomic<size_t> count{0};
+    std::unique_ptr<Event[]> events{new Event[kEventsPerThread]};
+};
+
+// Guards the list of buffers and their names, not their events.
+std::mutex g_mutex;
+// Kept after their threads exit, for the threads' last zones.
+std::vector<std::shared_ptr<ThreadBuffer>> g_buffers;
+std::atomic<uint64_t> g_session{0};
+Trace::Clock::time_point g_start;
+
+ThreadBuffer& threadBuffer() {
+    thread_local std::shared_ptr<ThreadBuffer> buffer = []() {
+        auto buffer = std::make_shared<ThreadBuffer>();
+        std::lock_guard<std::mutex> lock(g_mutex);
+        buffer->id = g_buffers.size() + 1;
+        g_buffers.push_back(buffer);
+        return buffer;
+    }();
+    return *buffer;
+}
+
+double micros(Trace::Clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+};  // namespace
+
+bool Trace::compiled() { return true; }
+
+void Trace::start() {
+    g_start = Clock::now();
+    g_session++;
+    recording_ = true;
+}
+
+bool Trace::stop(const std::string& path) {
+    if (!recording_) return false;
+    recording_ = false;
+    uint64_t session = g_session;
+
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Cannot write trace " << path << std::endl;
+        return false;
+    }
+    out << std::fixed << std::setprecision(3)
+        << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    std::lock_guard<std::mutex> lock(g_mutex);
+    for (const auto& buffer : g_buffers) {
+        if (!buffer->name.empty()) {
+            out << (first ? "" : ",") << "\n{\"ph\":\"M\",\"pid\":1,\"tid\":"
+                << buffer->id
+                << ",\"name\":\"thread_name\",\"args\":{\"name\":\""
+                << buffer->name << "\"}}";
+            first = false;
+        }
+        // The session before the count: a thread clears its count before
+        // it moves to a new session.
+        if (buffer->session.load(std::memory_order_acquire) != session)
+            continue;
+        size_t count = buffer->count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; i++) {
+            const Event& event = buffer->events[i];
+            out << (first ? "" : ",") << "\n{\"ph\":\"X\",\"pid\":1,\"tid\":"
+                << buffer->id << ",\"name\":\"" << event.name
+                << "\",\"ts\":" << micros(event.begin - g_start)
+                << ",\"dur\":" << micros(event.end - event.begin) << "}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+    return bool(out);
+}
+
+void Trace::nameThread(const char* name) {
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(g_mutex);
+    buffer.name = name;
+}
+
+void Trace::record(const char* name, Clock::time_point begin,
+                   Clock::time_point end) {
+    ThreadBuffer& buffer = threadBuffer();
+    uint64_t session = g_session.load(std::memory_order_relaxed);
+    if (buffer.session.load(std::memory_order_relaxed) != session) {
+        buffer.count.store(0, std::memory_order_relaxed);
+        buffer.session.store(session, std::memory_order_release);
+    }
+    size_t count = buffer.count.load(std::memory_order_relaxed);
+    if (count == kEventsPerThread) return;
+    buffer.events[count] = Event{name, begin, end};
+    buffer.count.store(count + 1, std::memory_order_release);
+}
+
+#else
+
+bool Trace::compiled() { return false; }
+void Trace::start() {}
+bool Trace::stop(const std::string&) { return false; }
+void Trace::nameThread(const char*) {}
+void Trace::record(const char*, Clock::time_point, Clock::time_point) {}
+
+#endif
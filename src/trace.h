@@ -0,0 +1,75 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// Timed zones on every thread, written out as Chrome trace events for
+// chrome://tracing or Perfetto, to see where a frame's time goes.
+//
+// TRACE_SCOPE("name") times the rest of the enclosing block while a
+// recording runs. Each thread appends its zones to a fixed buffer of its
+// own, so recording a zone takes two clock reads and no lock; stop()
+// collects the buffers afterwards. Names must be string literals. Unless
+// the build defines CRAFT_TRACE (cmake -DCRAFT_TRACE=ON) the macros expand
+// to nothing and recording does nothing, so zones can stay in hot code.
+class Trace {
+   public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Whether this build can record.
+    static bool compiled();
+    // Drops what was recorded before and starts recording.
+    static void start();
+    // Stops recording and writes what was recorded to path as trace
+    // event JSON. Zones still open are left out.
+    static bool stop(const std::string& path);
+    static bool recording() {
+        return recording_.load(std::memory_order_relaxed);
+    }
+
+    // Names the calling thread in the trace.
+    static void nameThread(const char* name);
+    // Adds a zone of the calling thread; see TRACE_SCOPE.
+    static void record(const char* name, Clock::time_point begin,
+                       Clock::time_point end);
+
+   private:
+    static inline std::atomic<bool> recording_{false};
+};
+
+#ifdef CRAFT_TRACE
+
+class TraceScope {
+   public:
+    explicit TraceScope(const char* name)
+        : name_(Trace::recording() ? name : nullptr) {
+        if (name_) begin_ = Trace::Clock::now();
+    }
+    ~TraceScope() {
+        if (name_) Trace::record(name_, begin_, Trace::Clock::now());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+   private:
+    const char* name_;
+    Trace::Clock::time_point begin_;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+    TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_THREAD(name) Trace::nameThread(name)
+
+#else
+
+#define TRACE_SCOPE(name) static_cast<void>(0)
+#define TRACE_THREAD(name) static_cast<void>(0)
+
+#endif
+
+#endif
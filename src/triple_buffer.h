@@ -0,0 +1,49 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Hands the latest of a stream of values from one writer thread to one
+// reader thread without either ever waiting.
+//
+// Of the three buffers the writer owns one and the reader another; the
+// third is the one most recently published. publish() swaps the writer's
+// buffer with it and update() swaps it with the reader's, both with one
+// atomic exchange, so values the reader has not picked up yet are simply
+// replaced by newer ones.
+template <typename T>
+class TripleBuffer {
+   public:
+    TripleBuffer() = default;
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Writer only. Holds whatever was published two publish() calls ago,
+    // so it must be written in full.
+    T& back() { return buffers_[back_]; }
+    void publish() {
+        back_ = middle_.exchange(back_ | kFresh, std::memory_order_acq_rel) &
+                kIndex;
+    }
+
+    // Reader only. Moves to the latest published value, if there is a new
+    // one; front() is default constructed until the first.
+    bool update() {
+        if (!(middle_.load(std::memory_order_relaxed) & kFresh)) return false;
+        front_ = middle_.exchange(front_, std::memory_order_acq_rel) & kIndex;
+        return true;
+    }
+    const T& front() const { return buffers_[front_]; }
+
+   private:
+    static const uint8_t kIndex = 3;
+    static const uint8_t kFresh = 4;  // published and not yet picked up
+
+    T buffers_[3];
+    alignas(64) std::atomic<uint8_t> middle_{1};
+    alignas(64) uint8_t back_ = 0;
+    alignas(64) uint8_t front_ = 2;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef VOXEL_RAYCAST_H
+#define VOXEL_RAYCAST_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <limits>
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;  // need not be normalised
+};
+
+struct RayHit {
+    bool hit = false;
+    glm::ivec3 block = glm::ivec3(0);
+    // Outward normal of the face the ray entered through; zero when the
+    // ray starts inside the block. block + face is the empty cell in
+    // front of it.
+    glm::ivec3 face = glm::ivec3(0);
+    float distance = 0.0f;  // along the normalised direction
+};
+
+// Walks the unit grid cells a ray passes through in order (Amanatides and
+// Woo's DDA: each step crosses whichever cell boundary is nearest), and
+// stops at the first cell for which solid(glm::ivec3) is true or once
+// max_distance is passed. Every cell costs one comparison and one add, and
+// no cell is visited twice or skipped.
+template <typename Solid>
+RayHit VoxelRaycast(const glm::vec3& origin, const glm::vec3& direction,
+                    float max_distance, Solid&& solid) {
+    RayHit result;
+    float length = glm::length(direction);
+    if (!(length > 0.0f)) return result;
+    glm::vec3 dir = direction / length;
+
+    const float kInfinity = std::numeric_limits<float>::infinity();
+    glm::ivec3 cell(std::floor(origin.x), std::floor(origin.y),
+                    std::floor(origin.z));
+    glm::ivec3 step;
+    glm::vec3 t_delta, t_max;  // per axis: cell width and next boundary
+    for (int i = 0; i < 3; i++) {
+        if (dir[i] > 0.0f) {
+            step[i] = 1;
+            t_delta[i] = 1.0f / dir[i];
+            t_max[i] = (cell[i] + 1 - origin[i]) * t_delta[i];
+        } else if (dir[i] < 0.0f) {
+            step[i] = -1;
+            t_delta[i] = -1.0f / dir[i];
+            t_max[i] = (origin[i] - cell[i]) * t_delta[i];
+        } else {
+            step[i] = 0;
+            t_delta[i] = t_max[i] = kInfinity;
+        }
+    }
+
+    float t = 0.0f;
+    glm::ivec3 face(0);
+    while (t <= max_distance) {
+        if (solid(cell)) {
+            result.hit = true;
+            result.block = cell;
+            result.face = face;
+            result.distance = t;
+            return result;
+        }
+        int axis = t_max.x < t_max.y ? (t_max.x < t_max.z ? 0 : 2)
+                                     : (t_max.y < t_max.z ? 1 : 2);
+        t = t_max[axis];
+        t_max[axis] += t_delta[axis];
+        cell[axis] += step[axis];
+        face = glm::ivec3(0);
+        face[axis] = -step[axis];
+    }
+    return result;
+}
+
+#endif
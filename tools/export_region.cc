@@ -0,0 +1,55 @@
+// Exports a rectangle of terrain chunks as one mesh, without a window.
+// The format follows the extension (.obj, .ply or .glb).
+//
+// usage: export_region output x0 z0 x1 z1 [seed=1] [threads=0 (all cores)]
+//                      [dedup=0]
+//
+// Chunks x0 <= x < x1, z0 <= z < z1 are exported. The same seed gives the
+// same world as the game started with std::mt19937(seed).
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#include "chunk_mesher.h"
+#include "region_export.h"
+#include "terrain.h"
+#include "thread_pool.h"
+
+int main(int argc, char* argv[]) {
+    if (argc < 6) {
+        std::fprintf(stderr,
+                     "usage: %s output x0 z0 x1 z1 [seed] [threads] [dedup]\n",
+                     argv[0]);
+        return 1;
+    }
+    std::string output = argv[1];
+    glm::ivec2 lo(std::atoi(argv[2]), std::atoi(argv[3]));
+    glm::ivec2 hi(std::atoi(argv[4]), std::atoi(argv[5]));
+    unsigned seed = argc > 6 ? std::strtoul(argv[6], nullptr, 10) : 1;
+    ThreadPool pool(argc > 7 ? std::atoi(argv[7]) : 0);
+
+    MeshExporter::Options options;
+    options.format = MeshFormatFromPath(output);
+    options.deduplicate = argc > 8 && std::atoi(argv[8]) != 0;
+
+    std::mt19937 gen(seed);
+    Terrain terrain(gen);
+    ChunkMesher mesher(terrain.seed(), terrain.size,
+                       terrain.getSmoothingRadius());
+
+    RegionExportStats stats;
+    if (!ExportRegion(mesher, lo, hi, output, options, pool, 0, &stats)) {
+        std::fprintf(stderr, "export to %s failed\n", output.c_str());
+        return 1;
+    }
+    double seconds = stats.ms / 1000.0;
+    double mib = stats.bytes / (1024.0 * 1024.0);
+    std::printf("%zu chunks, %zu vertices, %zu triangles, %.1f MiB\n",
+                stats.chunks, stats.vertices, stats.faces, mib);
+    std::printf("%.2f s on %zu threads: %.0f chunks/s, %.1f MiB/s, "
+                "at most %zu chunks in memory\n",
+                seconds, pool.size(), stats.chunks / seconds, mib / seconds,
+                stats.peak_in_flight);
+    return 0;
+}
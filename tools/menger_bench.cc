@@ -0,0 +1,62 @@
+// Times Menger::generate_geometry at each nesting level, single-threaded
+// and split across a thread pool.
+//
+// usage: menger_bench [max_level=5] [repetitions=3] [threads=0 (all cores)]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "menger.h"
+#include "thread_pool.h"
+
+namespace {
+double bestOf(int repetitions, const Menger& menger, ThreadPool* pool,
+              std::vector<glm::vec4>& vertices,
+              std::vector<glm::uvec3>& faces) {
+    double best_ms = 1e30;
+    for (int i = 0; i < repetitions; i++) {
+        // Fresh vectors each run so allocation is part of the cost.
+        std::vector<glm::vec4>().swap(vertices);
+        std::vector<glm::uvec3>().swap(faces);
+        auto start = std::chrono::steady_clock::now();
+        menger.generate_geometry(vertices, faces, pool);
+        auto end = std::chrono::steady_clock::now();
+        best_ms = std::min(
+            best_ms,
+            std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best_ms;
+}
+};  // namespace
+
+int main(int argc, char* argv[]) {
+    int max_level = argc > 1 ? std::atoi(argv[1]) : 5;
+    int repetitions = argc > 2 ? std::max(1, std::atoi(argv[2])) : 3;
+    ThreadPool pool(argc > 3 ? std::atoi(argv[3]) : 0);
+
+    std::printf("%zu threads\n", pool.size());
+    std::printf("%5s %10s %10s %10s %10s %10s %10s\n", "level", "cubes",
+                "vertices", "triangles", "MiB", "serial ms", "pool ms");
+    for (int level = 0; level <= max_level; level++) {
+        Menger menger;
+        menger.set_nesting_level(level);
+
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::uvec3> faces;
+        double serial_ms =
+            bestOf(repetitions, menger, nullptr, vertices, faces);
+        double pool_ms = bestOf(repetitions, menger, &pool, vertices, faces);
+
+        double mib = (vertices.size() * sizeof(glm::vec4) +
+                      faces.size() * sizeof(glm::uvec3)) /
+                     (1024.0 * 1024.0);
+        std::printf("%5d %10zu %10zu %10zu %10.2f %10.3f %10.3f\n", level,
+                    Menger::cube_count(level), vertices.size(), faces.size(),
+                    mib, serial_ms, pool_ms);
+    }
+    return 0;
+}
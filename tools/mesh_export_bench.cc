@@ -0,0 +1,118 @@
+// Times exporting a Menger sponge with the old std::ofstream/std::endl
+// OBJ writer and with MeshExporter in each format, streamed one part at a
+// time the way a chunked exporter would.
+//
+// usage: mesh_export_bench [level=4] [directory=.]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "menger.h"
+#include "mesh_export.h"
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+double millisSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+}
+
+// What main.cc's SaveObj used to do.
+void saveObjWithStreams(const std::string& file,
+                        const std::vector<glm::vec4>& vertices,
+                        const std::vector<glm::uvec3>& indices) {
+    std::ofstream ofs(file);
+    for (const auto& vert : vertices)
+        ofs << "v " << vert[0] << " " << vert[1] << " " << vert[2] << std::endl;
+    for (const auto& index : indices)
+        ofs << "f " << index[0] + 1 << " " << index[1] + 1 << " "
+            << index[2] + 1 << std::endl;
+}
+
+void report(const char* name, double ms, size_t bytes, size_t vertices,
+            size_t duplicates) {
+    std::printf("%-22s %10.1f %10.1f %10.1f %10zu %10zu\n", name, ms,
+                bytes / (1024.0 * 1024.0),
+                bytes / (1024.0 * 1024.0) / (ms / 1000.0), vertices,
+                duplicates);
+}
+};  // namespace
+
+int main(int argc, char* argv[]) {
+    int level = argc > 1 ? std::atoi(argv[1]) : 4;
+    std::string directory = argc > 2 ? argv[2] : ".";
+
+    Menger menger;
+    menger.set_nesting_level(level);
+    std::vector<glm::vec4> vertices;
+    std::vector<glm::uvec3> faces;
+    menger.generate_geometry(vertices, faces);
+    std::printf("level %d: %zu vertices, %zu triangles\n", level,
+                vertices.size(), faces.size());
+    std::printf("%-22s %10s %10s %10s %10s %10s\n", "writer", "ms", "MiB",
+                "MiB/s", "vertices", "merged");
+
+    std::string path = directory + "/menger_streams.obj";
+    Clock::time_point start = Clock::now();
+    saveObjWithStreams(path, vertices, faces);
+    double ms = millisSince(start);
+    std::ifstream written(path, std::ios::binary | std::ios::ate);
+    report("ofstream + endl", ms, size_t(written.tellg()), vertices.size(), 0);
+    std::remove(path.c_str());
+
+    // Split into parts of whole faces to exercise the streaming path.
+    const size_t kPartVertices = 8 * 4096;
+    const struct {
+        const char* name;
+        MeshFormat format;
+        bool deduplicate;
+        const char* extension;
+    } kRuns[] = {
+        {"MeshExporter obj", MeshFormat::kObj, false, "obj"},
+        {"MeshExporter obj dedup", MeshFormat::kObj, true, "obj"},
+        {"MeshExporter ply dedup", MeshFormat::kPly, true, "ply"},
+        {"MeshExporter glb dedup", MeshFormat::kGlb, true, "glb"},
+    };
+    for (const auto& run : kRuns) {
+        MeshExporter::Options options;
+        options.format = run.format;
+        options.deduplicate = run.deduplicate;
+        path = directory + "/menger_export." + run.extension;
+
+        MeshExporter exporter;
+        bool ok = exporter.open(path, options);
+        std::vector<glm::uvec3> part_faces;
+        size_t face = 0;
+        for (size_t first = 0; ok && first < vertices.size();
+             first += kPartVertices) {
+            size_t count = std::min(kPartVertices, vertices.size() - first);
+            part_faces.clear();
+            // Faces are generated as quads of four vertices and two
+            // triangles each, so each part's triangles are contiguous and
+            // only reference that part's vertices.
+            for (; face < faces.size() &&
+                   faces[face].x < first + count;
+                 face++)
+                part_faces.push_back(faces[face] - glm::uvec3(first));
+            ok = exporter.write(&vertices[first], count, part_faces.data(),
+                                part_faces.size());
+        }
+        ok = exporter.close() && ok;
+        if (!ok) {
+            std::fprintf(stderr, "%s failed\n", run.name);
+            return 1;
+        }
+        const MeshExporter::Stats& stats = exporter.stats();
+        report(run.name, stats.ms, stats.bytes, stats.vertices,
+               stats.duplicates);
+        std::remove(path.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,219 @@
+// Culls the game's 9 x 9 chunk window from random eye positions, first
+// against the view frustum and then with OcclusionCuller, the way
+// ChunkRenderer::cull does: occluders from every chunk in the frustum,
+// tests per 8 x 8 column cell. Views are taken at eye height on the
+// ground, looking roughly ahead, and flying well above it, looking down
+// as steeply as the camera allows. Reports for each how many cells and
+// cube instances survive each step, what the occlusion pass costs, and
+// whether it ever hid a visible block face (checked with
+// BlockWorld::raycast), in which case it exits with 1.
+//
+// usage: occlusion_bench [views=200] [threads=0 (all cores)] [seed=1]
+//                        [width=256] [height=128]
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "block_world.h"
+#include "frustum.h"
+#include "occlusion_culler.h"
+#include "thread_pool.h"
+
+namespace {
+const int kRadius = 4;  // as ChunkRenderer draws
+const int kCellSize = 8;
+const float kAspect = 4.0f / 3.0f;
+
+// Where views are taken from: the eye's height above the ground and the
+// pitch of the view, in radians.
+struct ViewKind {
+    const char* name;
+    float min_height, max_height;
+    float min_pitch, max_pitch;
+};
+
+const ViewKind kViewKinds[] = {
+    {"on the ground", 1.75f, 1.75f, -0.35f, 0.1f},
+    {"flying", 10.0f, 64.0f, -1.5f, 0.1f},
+};
+
+struct Cell {
+    std::vector<glm::vec3> instances;
+    OcclusionCuller::Box bounds;
+};
+
+struct ChunkData {
+    std::vector<Cell> cells;
+    std::vector<OcclusionCuller::Box> occluders;
+    OcclusionCuller::Box bounds;
+};
+
+void grow(OcclusionCuller::Box* box, const glm::vec3& lo,
+          const glm::vec3& hi) {
+    box->lo = glm::min(box->lo, lo);
+    box->hi = glm::max(box->hi, hi);
+}
+
+// Whether any face of an exposed block that looks towards the eye can be
+// seen: a ray to a point just off the face reaches it unobstructed, and the
+// point is on screen.
+bool faceVisible(const BlockWorld& world, const glm::mat4& view_projection,
+                 const glm::vec3& eye, const glm::vec3& block) {
+    for (int axis = 0; axis < 3; axis++) {
+        for (int side = 0; side < 2; side++) {
+            glm::vec3 normal(0.0f);
+            normal[axis] = side ? 1.0f : -1.0f;
+            glm::vec3 point = block + glm::vec3(0.5f) + normal * 0.51f;
+            if (glm::dot(eye - point, normal) <= 0.0f) continue;
+            glm::vec4 clip = view_projection * glm::vec4(point, 1.0f);
+            if (clip.w <= 0.0f || std::fabs(clip.x) > clip.w ||
+                std::fabs(clip.y) > clip.w)
+                continue;
+            float distance = glm::length(point - eye);
+            RayHit hit = world.raycast(eye, point - eye, distance);
+            if (!hit.hit) return true;
+        }
+    }
+    return false;
+}
+
+// Culls from views of one kind and reports the results. Returns the
+// number of visible blocks hidden.
+size_t run(const ViewKind& kind, int views, const BlockWorld& world,
+           const std::vector<ChunkData>& chunks, OcclusionCuller& culler,
+           ThreadPool& pool, std::mt19937& gen) {
+    std::uniform_real_distribution<float> across(0.0f, 16.0f);
+    std::uniform_real_distribution<float> yaw(0.0f, 6.2831853f);
+    std::uniform_real_distribution<float> height_above(kind.min_height,
+                                                       kind.max_height);
+    std::uniform_real_distribution<float> pitch(kind.min_pitch,
+                                                kind.max_pitch);
+    size_t in_frustum = 0, drawn = 0, frustum_instances = 0,
+           drawn_instances = 0, triangles = 0, hidden_faces = 0;
+    double raster_ms = 0.0, test_ms = 0.0;
+    glm::mat4 projection =
+        glm::perspective(glm::radians(45.0f), kAspect, 0.0001f, 1000.0f);
+    for (int v = 0; v < views; v++) {
+        glm::vec3 eye(across(gen), 0.0f, across(gen));
+        while (world.get(glm::ivec3(glm::floor(eye))) != kAir) eye.y += 1.0f;
+        eye.y += height_above(gen);
+        float a = yaw(gen), b = pitch(gen);
+        glm::vec3 look(std::cos(a) * std::cos(b), std::sin(b),
+                       std::sin(a) * std::cos(b));
+        glm::mat4 view_projection =
+            projection *
+            glm::lookAt(eye, eye + look, glm::vec3(0.0f, 1.0f, 0.0f));
+
+        Frustum frustum(view_projection);
+        std::vector<OcclusionCuller::Box> occluders, tested;
+        std::vector<const Cell*> candidates;
+        for (const auto& chunk : chunks) {
+            if (!frustum.intersects(chunk.bounds.lo, chunk.bounds.hi))
+                continue;
+            occluders.insert(occluders.end(), chunk.occluders.begin(),
+                             chunk.occluders.end());
+            for (const auto& cell : chunk.cells) {
+                if (cell.instances.empty() ||
+                    !frustum.intersects(cell.bounds.lo, cell.bounds.hi))
+                    continue;
+                tested.push_back(cell.bounds);
+                candidates.push_back(&cell);
+            }
+        }
+        std::vector<bool> visible;
+        culler.render(view_projection, occluders, &pool);
+        culler.test(tested, &visible);
+        raster_ms += culler.stats().raster_ms;
+        test_ms += culler.stats().test_ms;
+        triangles += culler.stats().triangles;
+
+        in_frustum += candidates.size();
+        for (size_t i = 0; i < candidates.size(); i++) {
+            frustum_instances += candidates[i]->instances.size();
+            if (visible[i]) {
+                drawn++;
+                drawn_instances += candidates[i]->instances.size();
+                continue;
+            }
+            for (const auto& block : candidates[i]->instances)
+                hidden_faces +=
+                    faceVisible(world, view_projection, eye, block);
+        }
+    }
+
+    std::printf("\n%s, %g to %g blocks up, pitch %g to %g:\n",
+                kind.name, kind.min_height, kind.max_height, kind.min_pitch,
+                kind.max_pitch);
+    std::printf("%-20s %10s %12s\n", "", "cells", "instances");
+    std::printf("%-20s %10.1f %12.0f\n", "in frustum",
+                double(in_frustum) / views,
+                double(frustum_instances) / views);
+    std::printf("%-20s %10.1f %12.0f (%.0f%% fewer)\n", "after occlusion",
+                double(drawn) / views, double(drawn_instances) / views,
+                100.0 * (1.0 - double(drawn_instances) /
+                                   std::max<size_t>(frustum_instances, 1)));
+    std::printf("occlusion pass: %.3f ms raster (%.0f triangles), %.3f ms "
+                "test per view\n",
+                raster_ms / views, double(triangles) / views,
+                test_ms / views);
+    std::printf("%zu visible blocks in occluded cells\n", hidden_faces);
+    return hidden_faces;
+}
+};  // namespace
+
+int main(int argc, char* argv[]) {
+    int views = argc > 1 ? std::max(1, std::atoi(argv[1])) : 200;
+    ThreadPool pool(argc > 2 ? std::atoi(argv[2]) : 0);
+    unsigned seed = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1;
+    int width = argc > 4 ? std::atoi(argv[4]) : 256;
+    int height = argc > 5 ? std::atoi(argv[5]) : 128;
+
+    BlockWorld world(seed);
+    world.load(glm::ivec2(-kRadius - 1), glm::ivec2(kRadius + 2), pool);
+    std::vector<ChunkData> chunks;
+    for (int z = -kRadius; z <= kRadius; z++) {
+        for (int x = -kRadius; x <= kRadius; x++) {
+            BlockWorld::Snapshot snapshot = world.snapshot(glm::ivec2(x, z));
+            ChunkData chunk;
+            chunk.occluders = BlockWorld::occluders(snapshot);
+            const OcclusionCuller::Box empty = {glm::vec3(1e9f),
+                                                glm::vec3(-1e9f)};
+            const int cells = BlockWorld::kChunkSize / kCellSize;
+            chunk.bounds = empty;
+            chunk.cells.assign(cells * cells, Cell{{}, empty});
+            for (const auto& block : BlockWorld::exposedBlocks(snapshot)) {
+                int cx = (int(block.x) - x * BlockWorld::kChunkSize) /
+                         kCellSize;
+                int cz = (int(block.z) - z * BlockWorld::kChunkSize) /
+                         kCellSize;
+                Cell& cell = chunk.cells[cx + cz * cells];
+                cell.instances.push_back(block);
+                grow(&cell.bounds, block, block + glm::vec3(1.0f));
+                grow(&chunk.bounds, block, block + glm::vec3(1.0f));
+            }
+            chunks.push_back(chunk);
+        }
+    }
+
+    size_t total_instances = 0;
+    for (const auto& chunk : chunks)
+        for (const auto& cell : chunk.cells)
+            total_instances += cell.instances.size();
+    std::printf("%d views of each kind, %zu chunks, %zu instances, %dx%d "
+                "depth buffer, %zu threads\n",
+                views, chunks.size(), total_instances, width, height,
+                pool.size());
+
+    std::mt19937 gen(seed);
+    OcclusionCuller culler(width, height);
+
+    size_t hidden_faces = 0;
+    for (const ViewKind& kind : kViewKinds)
+        hidden_faces += run(kind, views, world, chunks, culler, pool, gen);
+    return hidden_faces > 0 ? 1 : 0;
+}
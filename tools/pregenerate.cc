@@ -0,0 +1,160 @@
+// Generates the chunk columns of an area on every core and writes them to
+// a ChunkStore, so the game never waits on noise there. Reports chunks/s,
+// and how generation speeds up with the thread count.
+//
+// usage: pregenerate directory area [seed=1] [threads=0 (all)] [scaling=1]
+//
+// area is either a radius r, for the (2r + 1)^2 chunks around the spawn
+// chunk (0, 0), or x0,z0,x1,z1 for the chunks x0 <= x < x1, z0 <= z < z1.
+// Chunks already in the store are skipped, nearest the centre first, so
+// an interrupted run can simply be started again. The same seed gives
+// the same world as the game started with std::mt19937(seed).
+//
+// With scaling on, up to kScalingChunks of the area are first generated
+// (and serialised, but not stored) on 1, 2, 4, ... threads; efficiency is
+// the speedup over one thread divided by the thread count.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <random>
+#include <vector>
+
+#include "block_world.h"
+#include "chunk_store.h"
+#include "terrain.h"
+#include "thread_pool.h"
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+const size_t kScalingChunks = 1024;
+
+struct Result {
+    double seconds = 0.0;
+    size_t chunks = 0;
+    size_t failed = 0;
+
+    double rate() const { return seconds > 0.0 ? chunks / seconds : 0.0; }
+};
+
+// Generates the chunks on the pool's threads and writes them to the
+// store, or only serialises them without one.
+Result run(const BlockWorld& world, const std::vector<glm::ivec2>& chunks,
+           ThreadPool& pool, ChunkStore* store) {
+    Clock::time_point start = Clock::now();
+    std::vector<std::future<bool>> jobs;
+    jobs.reserve(chunks.size());
+    for (glm::ivec2 coords : chunks) {
+        jobs.push_back(pool.submit([&world, store, coords]() {
+            BlockWorld::ColumnPtr column = world.generate(coords);
+            if (store) return store->write(coords, *column);
+            std::vector<char> bytes;
+            column->serialize(&bytes);
+            return !bytes.empty();
+        }));
+    }
+    Result result;
+    for (auto& job : jobs) {
+        if (job.get())
+            result.chunks++;
+        else
+            result.failed++;
+    }
+    result.seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    return result;
+}
+};  // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::fprintf(stderr,
+                     "usage: %s directory radius|x0,z0,x1,z1 [seed] "
+                     "[threads] [scaling]\n",
+                     argv[0]);
+        return 1;
+    }
+    glm::ivec2 lo, hi;
+    if (std::sscanf(argv[2], "%d,%d,%d,%d", &lo.x, &lo.y, &hi.x, &hi.y) !=
+        4) {
+        int radius = std::max(0, std::atoi(argv[2]));
+        lo = glm::ivec2(-radius);
+        hi = glm::ivec2(radius + 1);
+    }
+    unsigned seed = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1;
+    ThreadPool pool(argc > 4 ? std::atoi(argv[4]) : 0);
+    bool scaling = argc > 5 ? std::atoi(argv[5]) != 0 : true;
+    if (hi.x <= lo.x || hi.y <= lo.y) {
+        std::fprintf(stderr, "empty area\n");
+        return 1;
+    }
+
+    std::mt19937 gen(seed);
+    Terrain terrain(gen);
+    BlockWorld world(terrain.seed(), terrain.getSmoothingRadius());
+    ChunkStore store(argv[1], terrain.seed(), terrain.getSmoothingRadius());
+
+    // Nearest the centre first.
+    glm::ivec2 center = (lo + hi) / 2;
+    std::vector<glm::ivec2> chunks;
+    size_t stored = 0;
+    for (int z = lo.y; z < hi.y; z++) {
+        for (int x = lo.x; x < hi.x; x++) {
+            if (store.contains(glm::ivec2(x, z)))
+                stored++;
+            else
+                chunks.push_back(glm::ivec2(x, z));
+        }
+    }
+    std::stable_sort(chunks.begin(), chunks.end(),
+                     [center](glm::ivec2 a, glm::ivec2 b) {
+                         glm::ivec2 da = a - center, db = b - center;
+                         return da.x * da.x + da.y * da.y <
+                                db.x * db.x + db.y * db.y;
+                     });
+    std::printf("chunks %d,%d to %d,%d: %zu to generate, %zu already in %s\n",
+                lo.x, lo.y, hi.x, hi.y, chunks.size(), stored, argv[1]);
+    if (chunks.empty()) return 0;
+
+    double single_rate = 0.0;
+    if (scaling) {
+        std::vector<glm::ivec2> sample(
+            chunks.begin(),
+            chunks.begin() + std::min(chunks.size(), kScalingChunks));
+        std::printf("\n%zu chunks, generated and serialised:\n",
+                    sample.size());
+        std::printf("%8s %10s %10s %10s %11s\n", "threads", "s", "chunks/s",
+                    "speedup", "efficiency");
+        for (size_t threads = 1;;
+             threads = std::min(threads * 2, pool.size())) {
+            ThreadPool scaled(threads);
+            Result result = run(world, sample, scaled, nullptr);
+            if (threads == 1) single_rate = result.rate();
+            double speedup = result.rate() / single_rate;
+            std::printf("%8zu %10.2f %10.0f %10.2f %10.0f%%\n", threads,
+                        result.seconds, result.rate(), speedup,
+                        100.0 * speedup / threads);
+            if (threads == pool.size()) break;
+        }
+    }
+
+    Result result = run(world, chunks, pool, &store);
+    double bytes = store.bytesWritten();
+    std::printf("\n%zu chunks stored in %.2f s on %zu threads: %.0f chunks/s, "
+                "%.1f MiB (%.0f bytes/chunk)\n",
+                result.chunks, result.seconds, pool.size(), result.rate(),
+                bytes / (1024.0 * 1024.0),
+                result.chunks ? bytes / result.chunks : 0.0);
+    if (single_rate > 0.0)
+        std::printf("efficiency against one thread without the store: "
+                    "%.0f%%\n",
+                    100.0 * result.rate() / (single_rate * pool.size()));
+    if (result.failed > 0) {
+        std::fprintf(stderr, "%zu chunks could not be stored\n",
+                     result.failed);
+        return 1;
+    }
+    return 0;
+}
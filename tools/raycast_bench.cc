@@ -0,0 +1,116 @@
+// Times BlockWorld::raycast on random rays through generated terrain, one
+// at a time and batched across threads, against sampling the ray at fixed
+// steps, and checks that both find the same blocks.
+//
+// usage: raycast_bench [rays=100000] [max_distance=64] [threads=0 (all)]
+//                      [seed=1]
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "block_world.h"
+#include "thread_pool.h"
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+double millisSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+}
+
+// What picking did before: sample every kStep along the ray.
+RayHit sampleRay(const BlockWorld& world, const Ray& ray,
+                 float max_distance) {
+    const float kStep = 0.02f;
+    RayHit result;
+    glm::vec3 dir = glm::normalize(ray.direction);
+    for (float t = 0.0f; t <= max_distance; t += kStep) {
+        glm::ivec3 cell = glm::ivec3(glm::floor(ray.origin + dir * t));
+        if (world.get(cell) != kAir) {
+            result.hit = true;
+            result.block = cell;
+            result.distance = t;
+            return result;
+        }
+    }
+    return result;
+}
+};  // namespace
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    float max_distance = argc > 2 ? std::atof(argv[2]) : 64.0f;
+    ThreadPool pool(argc > 3 ? std::atoi(argv[3]) : 0);
+    unsigned seed = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 1;
+
+    const int kRadius = 5;  // chunks around the origin
+    BlockWorld world(seed);
+    world.load(glm::ivec2(-kRadius), glm::ivec2(kRadius + 1), pool);
+
+    // Eyes a little above the ground looking in every direction, as for
+    // picking and line of sight.
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> across(-32.0f, 32.0f);
+    std::normal_distribution<float> normal;
+    std::vector<Ray> rays(count);
+    for (auto& ray : rays) {
+        ray.origin = glm::vec3(across(gen), 0.0f, across(gen));
+        while (world.get(glm::ivec3(glm::floor(ray.origin))) != kAir)
+            ray.origin.y += 1.0f;
+        ray.origin.y += 1.6f;
+        ray.direction = glm::vec3(normal(gen), normal(gen), normal(gen));
+    }
+
+    std::vector<RayHit> hits(count);
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < count; i++)
+        hits[i] = world.raycast(rays[i].origin, rays[i].direction,
+                                max_distance);
+    double single_ms = millisSince(start);
+
+    std::vector<RayHit> batched;
+    start = Clock::now();
+    world.raycast(rays, max_distance, &batched, &pool);
+    double batched_ms = millisSince(start);
+
+    // The sampled version is slow; a subset is enough to compare.
+    size_t sampled = std::min<size_t>(count, 5000);
+    size_t mismatches = 0, hit_count = 0;
+    double cells = 0.0;
+    start = Clock::now();
+    for (size_t i = 0; i < sampled; i++) {
+        RayHit hit = sampleRay(world, rays[i], max_distance);
+        // Sampling can step past a corner the ray only clips, so only
+        // count hits it finds that the traversal does not.
+        if (hit.hit && (!hits[i].hit || hit.distance < hits[i].distance))
+            mismatches++;
+    }
+    double sampled_ms = millisSince(start);
+    for (size_t i = 0; i < count; i++) {
+        if (batched[i].hit != hits[i].hit ||
+            batched[i].block != hits[i].block)
+            mismatches++;
+        if (!hits[i].hit) continue;
+        hit_count++;
+        glm::ivec3 d = glm::abs(hits[i].block -
+                                glm::ivec3(glm::floor(rays[i].origin)));
+        cells += d.x + d.y + d.z + 1;
+    }
+
+    std::printf("%zu rays, max distance %.0f: %zu hit, %.1f cells per hit\n",
+                count, max_distance, hit_count,
+                hit_count ? cells / hit_count : 0.0);
+    std::printf("%-24s %10.1f ns/ray %8.2f Mrays/s\n", "DDA",
+                1e6 * single_ms / count, count / single_ms / 1000.0);
+    std::printf("%-24s %10.1f ns/ray %8.2f Mrays/s (%zu threads)\n",
+                "DDA batched", 1e6 * batched_ms / count,
+                count / batched_ms / 1000.0, pool.size());
+    std::printf("%-24s %10.1f ns/ray %8.2f Mrays/s\n", "sampled every 0.02",
+                1e6 * sampled_ms / sampled, sampled / sampled_ms / 1000.0);
+    std::printf("%zu mismatches\n", mismatches);
+    return mismatches == 0 ? 0 : 1;
+}
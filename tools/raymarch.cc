@@ -0,0 +1,81 @@
+// Renders a still of the terrain with a Menger sponge floating above it on
+// the CPU, writes it as a JPEG and reports ray throughput. Needs no GPU.
+//
+// usage: raymarch [output=raymarch.jpg] [width=1920] [height=1080]
+//                 [menger_level=4] [threads=0 (all cores)] [repetitions=1]
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <jpegio.h>
+
+#include "raymarcher.h"
+#include "terrain.h"
+#include "thread_pool.h"
+
+namespace {
+// Fixed so stills are reproducible between runs and machines.
+const unsigned kTerrainSeed = 1;
+const int kTerrainRadius = 12;  // chunks around the origin
+
+// Matches where the game places the sponge.
+const glm::vec3 kMengerCenter(0.0f, 60.0f, 0.0f);
+const float kMengerSize = 81.0f;
+};  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string output = argc > 1 ? argv[1] : "raymarch.jpg";
+    RayMarcher::Options options;
+    if (argc > 2) options.width = std::max(1, std::atoi(argv[2]));
+    if (argc > 3) options.height = std::max(1, std::atoi(argv[3]));
+    int menger_level = argc > 4 ? std::atoi(argv[4]) : 4;
+    ThreadPool pool(argc > 5 ? std::atoi(argv[5]) : 0);
+    int repetitions = argc > 6 ? std::max(1, std::atoi(argv[6])) : 1;
+
+    std::mt19937 gen(kTerrainSeed);
+    Terrain terrain(gen);
+    HeightField height_field =
+        HeightField::fromTerrain(terrain, glm::ivec2(0, 0), kTerrainRadius);
+
+    RayMarcher::Scene scene;
+    scene.terrain = &height_field;
+    scene.menger_level = menger_level;
+    scene.menger_center = kMengerCenter;
+    scene.menger_size = kMengerSize;
+    RayMarcher marcher(scene);
+
+    RayMarcher::View view;
+    view.eye = glm::vec3(-110.0f, 45.0f, -120.0f);
+    view.target = glm::vec3(0.0f, 40.0f, 0.0f);
+
+    std::printf("%dx%d, level %d, %zu threads, SIMD width %d\n",
+                options.width, options.height, menger_level, pool.size(),
+                Float4::kWidth);
+    std::vector<unsigned char> pixels;
+    RayMarcher::Stats best;
+    for (int i = 0; i < repetitions; i++) {
+        RayMarcher::Stats stats = marcher.render(view, options, &pool, &pixels);
+        std::printf("%10.2f ms %10.2f Mrays/s %8.1f steps/ray\n", stats.ms,
+                    stats.mraysPerSecond(),
+                    double(stats.steps) / stats.rays);
+        if (i == 0 || stats.ms < best.ms) best = stats;
+    }
+    std::printf("best: %.2f Mrays/s\n", best.mraysPerSecond());
+
+    JPEGOptions jpeg;
+    jpeg.quality = 95;
+    jpeg.bottom_up = false;
+    jpeg.threads = pool.size();
+    if (!SaveJPEG(output, options.width, options.height, pixels.data(),
+                  jpeg)) {
+        std::fprintf(stderr, "Could not write %s\n", output.c_str());
+        return 1;
+    }
+    std::printf("wrote %s\n", output.c_str());
+    return 0;
+}
@@ -0,0 +1,136 @@
+// Times Terrain::genChunkSurface in each edge mode, compares how rough
+// the terrain is across chunk borders with how rough it is inside chunks,
+// and counts blocks that getSurfaceForRender emits more than once.
+// Exits with 1 if any mode emits a duplicate, or has a step across a chunk
+// border more than kSeamSlack blocks above its steepest step inside one.
+//
+// usage: terrain_bench [chunks_per_side=16] [smoothing=0] [seed=1]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+#include <glm/gtx/hash.hpp>
+
+#include "terrain.h"
+
+namespace {
+const float kSeamSlack = 1.0f;
+
+struct Result {
+    double ms;
+    float max_step_inside;    // between neighbouring columns of one chunk
+    float max_step_border;    // between columns of neighbouring chunks
+    glm::ivec2 border_chunk;  // on the far side of max_step_border
+    size_t render_blocks;
+    size_t render_duplicates;
+    glm::ivec2 duplicate_chunk;  // of the first duplicate
+};
+
+// The render window straddles the origin, where chunk coordinates change
+// sign.
+void countDuplicates(Terrain& terrain, Result* result) {
+    std::vector<glm::vec3> blocks =
+        terrain.getSurfaceForRender(glm::vec3(0.5f, 0.0f, 0.5f));
+    std::unordered_set<glm::ivec3> seen;
+    result->render_blocks = result->render_duplicates = 0;
+    for (const auto& block : blocks) {
+        if (block.y <= -1000.0f) continue;  // padding
+        result->render_blocks++;
+        if (!seen.insert(glm::ivec3(block)).second &&
+            result->render_duplicates++ == 0)
+            result->duplicate_chunk = terrain.toChunkCoords(block);
+    }
+}
+
+Result run(Terrain::EdgeMode mode, int chunks, int smoothing, unsigned seed) {
+    std::mt19937 gen(seed);
+    Terrain terrain(gen);
+    terrain.setEdgeMode(mode);
+    terrain.setSmoothingRadius(smoothing);
+    int size = terrain.size;
+    int width = chunks * size;
+    std::vector<float> heights(width * width);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int cz = 0; cz < chunks; cz++) {
+        for (int cx = 0; cx < chunks; cx++) {
+            std::vector<glm::vec3> surface =
+                terrain.genChunkSurface(glm::ivec2(cx, cz));
+            for (int j = 0; j < size; j++)
+                for (int i = 0; i < size; i++)
+                    heights[(cz * size + j) * width + cx * size + i] =
+                        surface[i + size * j].y;
+        }
+    }
+    Result result;
+    result.ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+
+    result.max_step_inside = result.max_step_border = 0.0f;
+    result.border_chunk = glm::ivec2(0);
+    auto compare = [&](int x, int z, int nx, int nz) {
+        float step =
+            std::fabs(heights[nz * width + nx] - heights[z * width + x]);
+        if (nx / size == x / size && nz / size == z / size) {
+            result.max_step_inside = std::max(result.max_step_inside, step);
+        } else if (step > result.max_step_border) {
+            result.max_step_border = step;
+            result.border_chunk = glm::ivec2(nx / size, nz / size);
+        }
+    };
+    for (int z = 0; z < width; z++) {
+        for (int x = 0; x < width; x++) {
+            if (x + 1 < width) compare(x, z, x + 1, z);
+            if (z + 1 < width) compare(x, z, x, z + 1);
+        }
+    }
+    countDuplicates(terrain, &result);
+    return result;
+}
+};  // namespace
+
+int main(int argc, char* argv[]) {
+    int chunks = argc > 1 ? std::max(1, std::atoi(argv[1])) : 16;
+    int smoothing = argc > 2 ? std::atoi(argv[2]) : 0;
+    unsigned seed = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1;
+
+    std::printf("%d x %d chunks, smoothing %d\n", chunks, chunks, smoothing);
+    std::printf("%-16s %10s %12s %12s %14s %14s %12s\n", "mode", "ms",
+                "us/chunk", "max inside", "max at border", "render blocks",
+                "duplicates");
+    const struct {
+        const char* name;
+        Terrain::EdgeMode mode;
+    } kModes[] = {
+        {"neighbour blend", Terrain::EdgeMode::kNeighbourBlend},
+        {"seamless", Terrain::EdgeMode::kSeamless},
+    };
+    bool failed = false;
+    for (const auto& mode : kModes) {
+        Result result = run(mode.mode, chunks, smoothing, seed);
+        std::printf("%-16s %10.1f %12.1f %12.0f %14.0f %14zu %12zu\n",
+                    mode.name, result.ms,
+                    1000.0 * result.ms / (chunks * chunks),
+                    result.max_step_inside, result.max_step_border,
+                    result.render_blocks, result.render_duplicates);
+        if (result.render_duplicates > 0) {
+            std::fprintf(stderr, "%s: first duplicate in chunk %d, %d\n",
+                         mode.name, result.duplicate_chunk.x,
+                         result.duplicate_chunk.y);
+            failed = true;
+        }
+        if (result.max_step_border > result.max_step_inside + kSeamSlack) {
+            std::fprintf(stderr, "%s: seam of %.0f blocks at chunk %d, %d\n",
+                         mode.name, result.max_step_border,
+                         result.border_chunk.x, result.border_chunk.y);
+            failed = true;
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,119 @@
+// Generates a square of chunk columns into palette-compressed sections and
+// reports how much memory they take, then times random get/set.
+//
+// usage: voxel_stats [chunks_per_side=16] [seed=1]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "chunk_section.h"
+#include "terrain.h"
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+double nanosPerOp(Clock::time_point start, size_t ops) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start)
+               .count() /
+           ops;
+}
+};  // namespace
+
+int main(int argc, char* argv[]) {
+    int chunks = argc > 1 ? std::max(1, std::atoi(argv[1])) : 16;
+    unsigned seed = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1;
+
+    std::mt19937 gen(seed);
+    Terrain terrain(gen);
+    std::vector<ChunkColumn> columns(chunks * chunks);
+    Clock::time_point start = Clock::now();
+    for (int z = 0; z < chunks; z++)
+        for (int x = 0; x < chunks; x++)
+            columns[x + z * chunks].generate(
+                terrain.getChunk(glm::ivec2(x, z)),
+                terrain.getSmoothingRadius());
+    double generate_ms = std::chrono::duration<double, std::milli>(
+                             Clock::now() - start)
+                             .count();
+
+    size_t sections = 0, uniform = 0, bytes = 0, mixed_bytes = 0;
+    size_t by_bits[17] = {0};
+    for (const auto& column : columns) {
+        bytes += column.memoryUsage();
+        for (int i = 0; i < ChunkColumn::kSections; i++) {
+            const ChunkSection& section = column.section(i);
+            sections++;
+            by_bits[section.bitsPerBlock()]++;
+            if (section.uniform())
+                uniform++;
+            else
+                mixed_bytes += section.memoryUsage();
+        }
+    }
+    size_t flat_bytes = sections * ChunkSection::kVolume * sizeof(BlockId);
+    std::printf("%d x %d columns generated in %.1f ms\n", chunks, chunks,
+                generate_ms);
+    std::printf("%zu sections, %zu uniform; bits per block:", sections,
+                uniform);
+    for (int bits : {0, 1, 2, 4, 8, 16})
+        std::printf(" %d:%zu", bits, by_bits[bits]);
+    std::printf("\n");
+    std::printf("%.2f MiB total (%.0f bytes per section, %.0f per "
+                "non-uniform one); flat 16-bit arrays: %.2f MiB\n",
+                bytes / (1024.0 * 1024.0), double(bytes) / sections,
+                uniform == sections
+                    ? 0.0
+                    : double(mixed_bytes) / (sections - uniform),
+                flat_bytes / (1024.0 * 1024.0));
+
+    // Random access against a flat reference copy of one column.
+    ChunkColumn& column = columns[0];
+    std::vector<BlockId> reference(16 * 16 * ChunkColumn::kHeight);
+    auto at = [](int x, int y, int z) {
+        return (y - ChunkColumn::kMinY) * 256 + z * 16 + x;
+    };
+    for (int y = ChunkColumn::kMinY;
+         y < ChunkColumn::kMinY + ChunkColumn::kHeight; y++)
+        for (int z = 0; z < 16; z++)
+            for (int x = 0; x < 16; x++)
+                reference[at(x, y, z)] = column.get(x, y, z);
+
+    const size_t kOps = 1 << 22;
+    std::vector<int> xs(kOps), ys(kOps), zs(kOps);
+    std::vector<BlockId> blocks(kOps);
+    std::uniform_int_distribution<int> local(0, 15);
+    std::uniform_int_distribution<int> height(-32, 32);
+    std::uniform_int_distribution<int> type(kAir, kStone);
+    for (size_t i = 0; i < kOps; i++) {
+        xs[i] = local(gen);
+        ys[i] = height(gen);
+        zs[i] = local(gen);
+        blocks[i] = type(gen);
+    }
+
+    start = Clock::now();
+    for (size_t i = 0; i < kOps; i++) {
+        column.set(xs[i], ys[i], zs[i], blocks[i]);
+        reference[at(xs[i], ys[i], zs[i])] = blocks[i];
+    }
+    double set_ns = nanosPerOp(start, kOps);
+
+    size_t checksum = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < kOps; i++)
+        checksum += column.get(xs[i], ys[i], zs[i]);
+    double get_ns = nanosPerOp(start, kOps);
+
+    size_t mismatches = 0;
+    for (int y = ChunkColumn::kMinY;
+         y < ChunkColumn::kMinY + ChunkColumn::kHeight; y++)
+        for (int z = 0; z < 16; z++)
+            for (int x = 0; x < 16; x++)
+                mismatches += column.get(x, y, z) != reference[at(x, y, z)];
+    std::printf("get %.1f ns, set %.1f ns (checksum %zu), %zu mismatches\n",
+                get_ns, set_ns, checksum, mismatches);
+    return mismatches == 0 ? 0 : 1;
+}